@@ -0,0 +1,169 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+/*
+ * Measures the AFE to voice_ui_app hop channel with and without per-period
+ * batching. A producer process paces periods in real time and spends
+ * hop_cost_us per hop (VoiceSeekerLight_Process), the consumer spends
+ * wake_cost_us per hop (VoiceSpot). Reported per mode:
+ *  - context switches per period of both processes
+ *  - CPU time per period of both processes
+ *  - hop latency, from the end of its processing in the AFE to its reception
+ *
+ * Usage: afe_ipc_bench [periods] [hops_per_period] [hop_cost_us] [wake_cost_us] [mq]
+ */
+#include <AFEIpcChannel.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BENCH_HOP_US 12500		// 200 samples at 16 kHz
+
+typedef struct bench_result {
+	double voluntary_switches;
+	double involuntary_switches;
+	double cpu_us;
+	double latency_mean_us;
+	double latency_max_us;
+} bench_result;
+
+static void spin(uint32_t us) {
+	const uint64_t end = AFEIpc::monotonicTimeNs() + us * 1000ull;
+	while (AFEIpc::monotonicTimeNs() < end)
+		;
+}
+
+static void usage(int periods, bench_result* result) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	result->voluntary_switches = (double)ru.ru_nvcsw / periods;
+	result->involuntary_switches = (double)ru.ru_nivcsw / periods;
+	result->cpu_us = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e6 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+	result->cpu_us /= periods;
+}
+
+static void runProducer(AFEIpc::Transport transport, bool batch, int periods, int hops, uint32_t hop_cost_us, bench_result* result) {
+	AFEIpc::HopProducer producer;
+	if (0 != producer.open(transport, AFEIpc::OverflowPolicy::Block, 1000)) {
+		printf("Could not attach to the consumer\n");
+		exit(-1);
+	}
+
+	std::vector<AFEIpc::hop_record> pending(hops);
+	uint64_t next_period = AFEIpc::monotonicTimeNs();
+	uint64_t sample_index = 0;
+
+	for (int p = 0; p < periods; p++) {
+		//The capture thread delivers a full period, then it is processed hop by hop
+		next_period += (uint64_t)hops * BENCH_HOP_US * 1000ull;
+		while (AFEIpc::monotonicTimeNs() < next_period)
+			usleep((useconds_t)((next_period - AFEIpc::monotonicTimeNs()) / 1000 + 1));
+
+		for (int h = 0; h < hops; h++) {
+			spin(hop_cost_us);
+			AFEIpc::hop_record& hop = pending[h];
+			hop.sample_index = sample_index;
+			hop.iteration = p;
+			hop.enable_triggering = 1;
+			uint64_t now = AFEIpc::monotonicTimeNs();
+			memcpy(hop.samples, &now, sizeof(now));
+			sample_index += AFE_IPC_HOP_SAMPLES;
+
+			if (!batch)
+				producer.sendHop(hop);
+		}
+		if (batch)
+			producer.sendHops(pending.data(), hops);
+	}
+
+	usage(periods, result);
+	if (0 != producer.statistics().dropped_hops)
+		printf("Producer dropped %llu hops\n", (unsigned long long)producer.statistics().dropped_hops);
+}
+
+static void runConsumer(AFEIpc::HopConsumer& consumer, int periods, int hops, uint32_t wake_cost_us, bench_result* result) {
+	AFEIpc::hop_record hop;
+	double latency_total = 0.0;
+	double latency_max = 0.0;
+
+	for (int i = 0; i < periods * hops; i++) {
+		if (0 != consumer.receiveHop(hop))
+			exit(-1);
+		uint64_t produced;
+		memcpy(&produced, hop.samples, sizeof(produced));
+		double latency = (AFEIpc::monotonicTimeNs() - produced) / 1e3;
+		latency_total += latency;
+		if (latency > latency_max)
+			latency_max = latency;
+		spin(wake_cost_us);
+	}
+
+	usage(periods, result);
+	result->latency_mean_us = latency_total / (periods * hops);
+	result->latency_max_us = latency_max;
+}
+
+static int runMode(AFEIpc::Transport transport, bool batch, int periods, int hops, uint32_t hop_cost_us, uint32_t wake_cost_us) {
+	AFEIpc::HopConsumer consumer;
+	if (0 != consumer.create(transport)) {
+		printf("Could not create the channel\n");
+		return -1;
+	}
+
+	//Results come back through an anonymous shared mapping
+	bench_result* results = (bench_result*)mmap(nullptr, 2 * sizeof(bench_result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == results)
+		return -1;
+	memset(results, 0, 2 * sizeof(bench_result));
+
+	pid_t producer = fork();
+	if (0 == producer) {
+		runProducer(transport, batch, periods, hops, hop_cost_us, &results[0]);
+		_exit(0);
+	}
+	pid_t wake_word = fork();
+	if (0 == wake_word) {
+		runConsumer(consumer, periods, hops, wake_cost_us, &results[1]);
+		_exit(0);
+	}
+	waitpid(producer, nullptr, 0);
+	waitpid(wake_word, nullptr, 0);
+	consumer.destroy();
+
+	printf("%-10s AFE: %5.2f vol + %5.2f invol switches, %7.1f us CPU per period | voice_ui_app: %5.2f vol + %5.2f invol switches, %7.1f us CPU per period | hop latency mean %8.1f us, max %8.1f us\n",
+		batch ? "batched" : "per hop",
+		results[0].voluntary_switches, results[0].involuntary_switches, results[0].cpu_us,
+		results[1].voluntary_switches, results[1].involuntary_switches, results[1].cpu_us,
+		results[1].latency_mean_us, results[1].latency_max_us);
+
+	munmap(results, 2 * sizeof(bench_result));
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	int periods = (argc > 1) ? atoi(argv[1]) : 400;
+	int hops = (argc > 2) ? atoi(argv[2]) : 4;
+	uint32_t hop_cost_us = (argc > 3) ? atoi(argv[3]) : 1000;
+	uint32_t wake_cost_us = (argc > 4) ? atoi(argv[4]) : 500;
+	AFEIpc::Transport transport = (argc > 5 && 0 == strcmp(argv[5], "mq")) ? AFEIpc::Transport::MessageQueue : AFEIpc::Transport::SharedMemory;
+
+	if (periods <= 0 || hops <= 0) {
+		printf("Usage: %s [periods] [hops_per_period] [hop_cost_us] [wake_cost_us] [mq]\n", argv[0]);
+		return -1;
+	}
+
+	printf("%d periods of %d hops, %u us AFE and %u us wake word processing per hop, %s transport\n",
+		periods, hops, hop_cost_us, wake_cost_us, (AFEIpc::Transport::MessageQueue == transport) ? "message queue" : "shared memory");
+
+	if (0 != runMode(transport, false, periods, hops, hop_cost_us, wake_cost_us) ||
+		0 != runMode(transport, true, periods, hops, hop_cost_us, wake_cost_us))
+		return -1;
+	return 0;
+}
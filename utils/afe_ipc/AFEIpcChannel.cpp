@@ -0,0 +1,629 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+
+#include <AFEIpcChannel.h>
+#include <AFEConfigState.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AFE_IPC_SHM_NAME "/voiceui_hops"
+#define AFE_IPC_SHM_MAGIC 0x56554950u		// "VUIP"
+#define AFE_IPC_SHM_VERSION 3u
+
+namespace AFEIpc
+{
+	/*
+	 * Layout of the shared memory object. Indexes are free running and wrap at
+	 * 2^32, the slot is index % capacity. The producer writes head and the
+	 * records, the consumer advances tail. With OverflowPolicy::DropOldest the
+	 * producer may also advance tail, so both sides move it with a CAS and the
+	 * consumer discards a copy whose slot was taken away meanwhile. Each side only enters the
+	 * kernel (futex) when it has nothing to do, and the other side only wakes
+	 * it when the matching *_waiting flag is set.
+	 */
+	struct shm_ring {
+		std::atomic<uint32_t> magic;
+		uint32_t version;
+		uint32_t capacity;
+		uint32_t trigger_capacity;
+
+		alignas(64) std::atomic<uint32_t> head;				// Written by the AFE
+		std::atomic<uint32_t> consumer_waiting;
+
+		alignas(64) std::atomic<uint32_t> tail;				// Written by voice_ui_app
+		std::atomic<uint32_t> producer_waiting;
+
+		alignas(64) std::atomic<uint32_t> trigger_head;		// Written by voice_ui_app
+		std::atomic<uint32_t> trigger_tail;					// Written by the AFE, which polls and never sleeps on it
+		trigger_record triggers[AFE_IPC_TRIGGER_RECORDS];
+
+		alignas(64) hop_record records[AFE_IPC_RING_RECORDS];
+	};
+
+	static_assert(std::atomic<uint32_t>::is_always_lock_free, "futex words must be lock free");
+	static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be 32 bit");
+
+	static void futexWait(std::atomic<uint32_t>* word, uint32_t expected, const struct timespec* timeout = nullptr) {
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+	}
+
+	static void futexWake(std::atomic<uint32_t>* word) {
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+	}
+
+	//Sleeps until word differs from seen or the relative timeout expires. Spurious returns are handled by the callers' loops.
+	static void waitForChange(std::atomic<uint32_t>& word, uint32_t seen, std::atomic<uint32_t>& waiting, const struct timespec* timeout = nullptr) {
+		waiting.store(1);
+		if (word.load() == seen)
+			futexWait(&word, seen, timeout);
+		waiting.store(0);
+	}
+
+	//Inode of an IPC object, identifies a new instance created by a restarted voice_ui_app
+	static unsigned long inodeOf(int fd) {
+		struct stat st;
+		return (fstat(fd, &st) < 0) ? 0 : (unsigned long)st.st_ino;
+	}
+
+	//Stores value and wakes the other side only if it is sleeping on word
+	static void publish(std::atomic<uint32_t>& word, uint32_t value, std::atomic<uint32_t>& waiting) {
+		word.store(value);
+		if (waiting.load())
+			futexWake(&word);
+	}
+
+	std::string objectName(const char* base) {
+		const char* suffix = getenv(AFE_IPC_CHANNEL_ENV);
+		return (nullptr != suffix) ? std::string(base) + suffix : std::string(base);
+	}
+
+	uint64_t monotonicTimeNs() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+	}
+
+	Transport transportFromConfig() {
+		AFEConfig::AFEConfigState configState;
+		std::string transport = configState.isConfigurationEnable("IpcTransport", "SharedMemory");
+
+		if (transport == "MessageQueue")
+			return Transport::MessageQueue;
+		if (transport != "SharedMemory")
+			std::cout << "Unknown IpcTransport " << transport << ", using SharedMemory" << std::endl;
+		return Transport::SharedMemory;
+	}
+
+	OverflowPolicy overflowPolicyFromConfig() {
+		AFEConfig::AFEConfigState configState;
+		std::string policy = configState.isConfigurationEnable("IpcOverflowPolicy", "DropOldest");
+
+		if (policy == "DropNewest")
+			return OverflowPolicy::DropNewest;
+		if (policy == "Block")
+			return OverflowPolicy::Block;
+		if (policy != "DropOldest")
+			std::cout << "Unknown IpcOverflowPolicy " << policy << ", using DropOldest" << std::endl;
+		return OverflowPolicy::DropOldest;
+	}
+
+	/*
+	 * HopProducer
+	 */
+
+	//The endpoints of one voice_ui_app instance, made and released by the peer watcher
+	struct peer_link {
+		unsigned long inode;		// Identifies the voice_ui_app instance, 0 when none was attached
+		int fd;
+		shm_ring* ring;
+		mqd_t mq_vslout;
+		mqd_t mq_iter;
+		mqd_t mq_trigg;
+		mqd_t mq_trigger;
+	};
+
+	HopProducer::HopProducer() : transport{ Transport::SharedMemory }, policy{ OverflowPolicy::DropOldest }, block_timeout_ms{ 0 },
+		opened{ false }, ever_connected{ false }, stats{ 0 }, link{ nullptr }, pending{ nullptr }, retired{ nullptr }, stopping{ false } {
+	}
+
+	HopProducer::~HopProducer() {
+		close();
+	}
+
+	int HopProducer::open(Transport transport, OverflowPolicy policy, int32_t block_timeout_ms) {
+		close();
+		this->transport = transport;
+		this->policy = policy;
+		this->block_timeout_ms = block_timeout_ms;
+		this->opened = true;
+
+		//Attached here, then by the watcher thread whenever voice_ui_app is (re)started
+		link = attach();
+		stopping = false;
+		watcher = std::thread(&HopProducer::watch, this, link->inode);
+
+		if (0 == link->inode)
+			return -1;
+		ever_connected = true;
+		return 0;
+	}
+
+	void HopProducer::close() {
+		if (watcher.joinable()) {
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_all();
+			watcher.join();
+		}
+		//The audio thread is not sending any more
+		detach(retired.exchange(nullptr));
+		detach(pending.exchange(nullptr));
+		detach(link);
+		link = nullptr;
+		opened = false;
+		ever_connected = false;
+	}
+
+	bool HopProducer::isOpen() const {
+		return opened;
+	}
+
+	bool HopProducer::isConnected() const {
+		return nullptr != link && 0 != link->inode;
+	}
+
+	const producer_stats& HopProducer::statistics() const {
+		return stats;
+	}
+
+	//Opens the endpoints of the running voice_ui_app, a link with inode 0 when it is not running
+	peer_link* HopProducer::attach() const {
+		peer_link* peer = new peer_link{ 0, -1, nullptr, (mqd_t)-1, (mqd_t)-1, (mqd_t)-1, (mqd_t)-1 };
+
+		if (Transport::MessageQueue == transport) {
+			//Block waits in mq_timedsend, the drop policies must never wait
+			const int send_flags = (OverflowPolicy::Block == policy) ? O_WRONLY : O_WRONLY | O_NONBLOCK;
+			peer->mq_vslout = mq_open(objectName("/voicespot_vslout").c_str(), send_flags);
+			peer->mq_iter = mq_open(objectName("/voiceseeker_iterations").c_str(), send_flags);
+			peer->mq_trigg = mq_open(objectName("/voiceseeker_trigger").c_str(), send_flags);
+			peer->mq_trigger = mq_open(objectName("/voicespot_offset").c_str(), O_RDONLY | O_NONBLOCK);
+			if ((mqd_t)-1 == peer->mq_vslout || (mqd_t)-1 == peer->mq_iter || (mqd_t)-1 == peer->mq_trigg || (mqd_t)-1 == peer->mq_trigger) {
+				release(peer);
+				return peer;
+			}
+			//voice_ui_app re-creates the reply queue on start, it identifies the peer instance
+			peer->inode = inodeOf(peer->mq_trigger);
+			return peer;
+		}
+
+		peer->fd = shm_open(objectName(AFE_IPC_SHM_NAME).c_str(), O_RDWR, 0);
+		if (peer->fd < 0)
+			return peer;
+
+		struct stat st;
+		if (fstat(peer->fd, &st) < 0 || st.st_size < (off_t)sizeof(shm_ring)) {
+			release(peer);
+			return peer;
+		}
+
+		void* mem = mmap(nullptr, sizeof(shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, peer->fd, 0);
+		if (MAP_FAILED == mem) {
+			release(peer);
+			return peer;
+		}
+		peer->ring = static_cast<shm_ring*>(mem);
+
+		if (AFE_IPC_SHM_MAGIC != peer->ring->magic.load(std::memory_order_acquire) || AFE_IPC_SHM_VERSION != peer->ring->version) {
+			std::cout << "Incompatible " << objectName(AFE_IPC_SHM_NAME) << " shared memory layout" << std::endl;
+			release(peer);
+			return peer;
+		}
+		peer->inode = (unsigned long)st.st_ino;
+		return peer;
+	}
+
+	//Closes the endpoints, the link stays allocated and reads as not attached
+	void HopProducer::release(peer_link* peer) {
+		if (nullptr != peer->ring) {
+			munmap(peer->ring, sizeof(shm_ring));
+			peer->ring = nullptr;
+		}
+		if (peer->fd >= 0) {
+			::close(peer->fd);
+			peer->fd = -1;
+		}
+
+		mqd_t* queues[] = { &peer->mq_vslout, &peer->mq_iter, &peer->mq_trigg, &peer->mq_trigger };
+		for (mqd_t* mq : queues) {
+			if ((mqd_t)-1 != *mq) {
+				mq_close(*mq);
+				*mq = (mqd_t)-1;
+			}
+		}
+		peer->inode = 0;
+	}
+
+	void HopProducer::detach(peer_link* peer) {
+		if (nullptr == peer)
+			return;
+		release(peer);
+		delete peer;
+	}
+
+	//Inode of the object voice_ui_app creates on start, 0 when it does not exist
+	unsigned long HopProducer::peerInode() const {
+		unsigned long inode = 0;
+
+		if (Transport::MessageQueue == transport) {
+			mqd_t mq = mq_open(objectName("/voicespot_offset").c_str(), O_RDONLY | O_NONBLOCK);
+			if ((mqd_t)-1 == mq)
+				return 0;
+			inode = inodeOf(mq);
+			mq_close(mq);
+		}
+		else {
+			int shm = shm_open(objectName(AFE_IPC_SHM_NAME).c_str(), O_RDONLY, 0);
+			if (shm < 0)
+				return 0;
+			inode = inodeOf(shm);
+			::close(shm);
+		}
+		return inode;
+	}
+
+	//Sleeps ms unless closed, returns false when closed
+	bool HopProducer::waitInterval(uint32_t ms) {
+		std::unique_lock<std::mutex> guard(lock);
+		return !wake.wait_for(guard, std::chrono::milliseconds(ms), [this] { return stopping; });
+	}
+
+	//Watcher thread: every AFE_IPC_PEER_CHECK_MS, attaches a (re)started voice_ui_app and hands the link to the audio thread
+	void HopProducer::watch(unsigned long attached) {
+		while (waitInterval(AFE_IPC_PEER_CHECK_MS)) {
+			detach(retired.exchange(nullptr, std::memory_order_acquire));
+
+			if (peerInode() == attached)
+				continue;
+			//A new instance, or none any more: an empty link makes the audio thread drop its hops
+			peer_link* peer = attach();
+			attached = peer->inode;
+			//A link the audio thread did not take yet is replaced
+			detach(pending.exchange(peer, std::memory_order_acq_rel));
+		}
+	}
+
+	//Audio thread: switches to the link made by the watcher, if any. Never blocks nor releases anything.
+	void HopProducer::adopt() {
+		//The previous link was not released yet, this one waits for the next hop
+		if (nullptr != retired.load(std::memory_order_relaxed))
+			return;
+		peer_link* peer = pending.exchange(nullptr, std::memory_order_acquire);
+		if (nullptr == peer)
+			return;
+
+		if (0 != peer->inode) {
+			if (ever_connected) {
+				stats.reconnects++;
+				std::cout << "Wake word engine restarted, channel re-attached" << std::endl;
+			}
+			ever_connected = true;
+		}
+		retired.store(link, std::memory_order_release);
+		link = peer;
+	}
+
+	int HopProducer::sendHop(const hop_record& hop) {
+		return sendHops(&hop, 1);
+	}
+
+	int HopProducer::sendHops(const hop_record* hops, uint32_t count) {
+		if (opened)
+			adopt();
+		if (!opened || !isConnected()) {
+			stats.dropped_hops += count;
+			return -1;
+		}
+
+		uint32_t sent = 0;
+		if (Transport::MessageQueue == transport) {
+			//The legacy queues carry one hop per message, a batch is sent hop by hop
+			for (uint32_t i = 0; i < count; i++)
+				if (0 == sendHopMq(hops[i]))
+					sent++;
+		}
+		else {
+			//A batch larger than the ring is published in ring sized pieces
+			for (uint32_t i = 0; i < count; i += link->ring->capacity)
+				sent += sendHopsShm(hops + i, std::min(count - i, link->ring->capacity));
+		}
+
+		stats.sent_hops += sent;
+		stats.dropped_hops += count - sent;
+		return (sent == count) ? 0 : -1;
+	}
+
+	//Writes up to count records behind head and publishes them with a single head update (one wake up of voice_ui_app).
+	//Returns the number of records published.
+	uint32_t HopProducer::sendHopsShm(const hop_record* hops, uint32_t count) {
+		shm_ring* ring = link->ring;
+		uint32_t head = ring->head.load(std::memory_order_relaxed);
+		uint32_t tail = ring->tail.load();
+		if (head - tail + count > ring->capacity) {
+			switch (policy) {
+			case OverflowPolicy::DropNewest:
+				break;
+			case OverflowPolicy::DropOldest:
+				//Take the oldest hops away from the consumer. A failed CAS means the consumer moved tail, re-evaluate.
+				while (head - tail + count > ring->capacity) {
+					uint32_t drop = head - tail + count - ring->capacity;
+					if (ring->tail.compare_exchange_strong(tail, tail + drop)) {
+						stats.dropped_hops += drop;
+						tail += drop;
+					}
+				}
+				break;
+			case OverflowPolicy::Block: {
+				const uint64_t deadline = monotonicTimeNs() + (uint64_t)block_timeout_ms * 1000000ull;
+				while (head - (tail = ring->tail.load()) + count > ring->capacity) {
+					uint64_t now = monotonicTimeNs();
+					if (now >= deadline)
+						break;
+					struct timespec timeout = { (time_t)((deadline - now) / 1000000000ull), (long)((deadline - now) % 1000000000ull) };
+					waitForChange(ring->tail, tail, ring->producer_waiting, &timeout);
+				}
+				break;
+			}
+			}
+		}
+
+		//What still does not fit is dropped from the newest end of the batch
+		uint32_t space = ring->capacity - (head - tail);
+		if (count > space)
+			count = space;
+		if (0 == count)
+			return 0;
+
+		for (uint32_t i = 0; i < count; i++)
+			ring->records[(head + i) % ring->capacity] = hops[i];
+		publish(ring->head, head + count, ring->consumer_waiting);
+		return count;
+	}
+
+	int HopProducer::sendHopMq(const hop_record& hop) {
+		struct timespec deadline;
+		if (OverflowPolicy::Block == policy) {
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += (long)block_timeout_ms * 1000000l;
+			deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+			deadline.tv_nsec %= 1000000000l;
+		}
+
+		/*
+		 * The three queues are filled and drained together, so only the frame queue can be the first to overflow.
+		 * A full queue drops the hop being sent whatever the policy: voice_ui_app receives the three messages of
+		 * a hop one after the other, taking the oldest hop away from it could leave the queues out of step.
+		 */
+		int ret = (OverflowPolicy::Block == policy) ?
+			mq_timedsend(link->mq_vslout, (const char*)hop.samples, sizeof(hop.samples), 0, &deadline) :
+			mq_send(link->mq_vslout, (const char*)hop.samples, sizeof(hop.samples), 0);
+		if (ret < 0)
+			return -1;
+
+		if (mq_send(link->mq_iter, (const char*)&hop.iteration, sizeof(int32_t), 0) < 0 ||
+			mq_send(link->mq_trigg, (const char*)&hop.enable_triggering, sizeof(int32_t), 0) < 0) {
+			std::cout << "Wake word message queues out of step" << std::endl;
+			return -1;
+		}
+		return 0;
+	}
+
+	bool HopProducer::pollTrigger(trigger_record& trigger) {
+		if (nullptr == link)
+			return false;
+
+		if (Transport::MessageQueue == transport)
+			return ((mqd_t)-1 != link->mq_trigger) &&
+				(mq_receive(link->mq_trigger, (char*)&trigger, sizeof(trigger_record), NULL) == sizeof(trigger_record));
+
+		shm_ring* ring = link->ring;
+		if (nullptr == ring)
+			return false;
+
+		uint32_t tail = ring->trigger_tail.load(std::memory_order_relaxed);
+		if (ring->trigger_head.load(std::memory_order_acquire) == tail)
+			return false;
+
+		trigger = ring->triggers[tail % ring->trigger_capacity];
+		ring->trigger_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/*
+	 * HopConsumer
+	 */
+
+	HopConsumer::HopConsumer() : transport{ Transport::SharedMemory }, fd{ -1 }, ring{ nullptr }, sample_index{ 0 },
+		mq_vslout{ (mqd_t)-1 }, mq_iter{ (mqd_t)-1 }, mq_trigg{ (mqd_t)-1 }, mq_trigger{ (mqd_t)-1 } {
+	}
+
+	HopConsumer::~HopConsumer() {
+		destroy();
+	}
+
+	int HopConsumer::create(Transport transport) {
+		destroy();
+		this->transport = transport;
+
+		if (Transport::MessageQueue == transport) {
+			struct mq_attr attr;
+			attr.mq_flags = 0;
+			attr.mq_maxmsg = 10;
+			attr.mq_msgsize = sizeof(float) * AFE_IPC_HOP_SAMPLES;
+			attr.mq_curmsgs = 0;
+
+			//Start from empty queues, hops left over by a previous instance would be stale.
+			//A producer still attached to the old queues re-attaches at its next peer check.
+			mq_unlink(objectName("/voicespot_vslout").c_str());
+			mq_unlink(objectName("/voiceseeker_iterations").c_str());
+			mq_unlink(objectName("/voiceseeker_trigger").c_str());
+			mq_vslout = mq_open(objectName("/voicespot_vslout").c_str(), O_CREAT | O_RDONLY, 0644, &attr);
+			attr.mq_msgsize = sizeof(int32_t);
+			mq_iter = mq_open(objectName("/voiceseeker_iterations").c_str(), O_CREAT | O_RDONLY, 0644, &attr);
+			mq_trigg = mq_open(objectName("/voiceseeker_trigger").c_str(), O_CREAT | O_RDONLY, 0644, &attr);
+			//The reply format changed from a bare offset, don't reuse a queue created with the old message size
+			mq_unlink(objectName("/voicespot_offset").c_str());
+			attr.mq_msgsize = sizeof(trigger_record);
+			mq_trigger = mq_open(objectName("/voicespot_offset").c_str(), O_CREAT | O_WRONLY | O_NONBLOCK, 0644, &attr);
+			if ((mqd_t)-1 == mq_vslout || (mqd_t)-1 == mq_iter || (mqd_t)-1 == mq_trigg || (mqd_t)-1 == mq_trigger) {
+				destroy();
+				return -1;
+			}
+			return 0;
+		}
+
+		//Start from a clean object, a stale one may be left over by a crashed instance
+		shm_unlink(objectName(AFE_IPC_SHM_NAME).c_str());
+		fd = shm_open(objectName(AFE_IPC_SHM_NAME).c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (fd < 0)
+			return -1;
+
+		if (ftruncate(fd, sizeof(shm_ring)) < 0) {
+			destroy();
+			return -1;
+		}
+
+		void* mem = mmap(nullptr, sizeof(shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (MAP_FAILED == mem) {
+			destroy();
+			return -1;
+		}
+
+		//ftruncate zero-fills the object, only the constants have to be written
+		ring = static_cast<shm_ring*>(mem);
+		ring->version = AFE_IPC_SHM_VERSION;
+		ring->capacity = AFE_IPC_RING_RECORDS;
+		ring->trigger_capacity = AFE_IPC_TRIGGER_RECORDS;
+		ring->magic.store(AFE_IPC_SHM_MAGIC, std::memory_order_release);
+		return 0;
+	}
+
+	void HopConsumer::destroy() {
+		if (nullptr != ring) {
+			munmap(ring, sizeof(shm_ring));
+			ring = nullptr;
+		}
+		if (fd >= 0) {
+			::close(fd);
+			fd = -1;
+			shm_unlink(objectName(AFE_IPC_SHM_NAME).c_str());
+		}
+
+		//The reply queue identifies this instance, removing it tells the AFE the engine is gone
+		if ((mqd_t)-1 != mq_trigger)
+			mq_unlink(objectName("/voicespot_offset").c_str());
+
+		mqd_t* queues[] = { &mq_vslout, &mq_iter, &mq_trigg, &mq_trigger };
+		for (mqd_t* mq : queues) {
+			if ((mqd_t)-1 != *mq) {
+				mq_close(*mq);
+				*mq = (mqd_t)-1;
+			}
+		}
+	}
+
+	int HopConsumer::receiveHopMq(hop_record& hop, const struct timespec* timeout) {
+		//Only the first message may time out, the AFE sends the other two right after it
+		if ((nullptr == timeout ? mq_receive(mq_vslout, (char*)hop.samples, sizeof(hop.samples), NULL) :
+				mq_timedreceive(mq_vslout, (char*)hop.samples, sizeof(hop.samples), NULL, timeout)) < 0 ||
+			mq_receive(mq_iter, (char*)&hop.iteration, sizeof(int32_t), NULL) < 0 ||
+			mq_receive(mq_trigg, (char*)&hop.enable_triggering, sizeof(int32_t), NULL) < 0)
+			return -1;
+
+		//The legacy transport carries no stamps, count the hops locally
+		hop.sample_index = sample_index;
+		hop.capture_time_ns = 0;
+		hop.flags = 0;
+		sample_index += AFE_IPC_HOP_SAMPLES;
+		return 0;
+	}
+
+	int HopConsumer::receiveHop(hop_record& hop) {
+		if (Transport::MessageQueue == transport)
+			return receiveHopMq(hop, nullptr);
+
+		if (nullptr == ring)
+			return -1;
+
+		uint32_t tail;
+		uint32_t head;
+		while (true) {
+			tail = ring->tail.load();
+			while ((head = ring->head.load()) == tail)
+				waitForChange(ring->head, head, ring->consumer_waiting);
+
+			hop = ring->records[tail % ring->capacity];
+			//Fails when the AFE dropped this hop (DropOldest) while it was copied, take the next one instead
+			if (ring->tail.compare_exchange_strong(tail, tail + 1))
+				break;
+		}
+
+		if (ring->producer_waiting.load())
+			futexWake(&ring->tail);
+		return 0;
+	}
+
+	bool HopConsumer::pollHop(hop_record& hop) {
+		if (Transport::MessageQueue == transport) {
+			//An expired timeout, mq_timedreceive returns at once when the queue is empty
+			const struct timespec expired = { 0, 0 };
+			return 0 == receiveHopMq(hop, &expired);
+		}
+
+		if (nullptr == ring)
+			return false;
+
+		uint32_t tail;
+		do {
+			tail = ring->tail.load();
+			if (ring->head.load() == tail)
+				return false;
+			hop = ring->records[tail % ring->capacity];
+		} while (!ring->tail.compare_exchange_strong(tail, tail + 1));
+
+		if (ring->producer_waiting.load())
+			futexWake(&ring->tail);
+		return true;
+	}
+
+	int HopConsumer::sendTrigger(const trigger_record& trigger) {
+		if (Transport::MessageQueue == transport)
+			return mq_send(mq_trigger, (const char*)&trigger, sizeof(trigger_record), 0);
+
+		if (nullptr == ring)
+			return -1;
+
+		uint32_t head = ring->trigger_head.load(std::memory_order_relaxed);
+		if (head - ring->trigger_tail.load(std::memory_order_acquire) >= ring->trigger_capacity)
+			return -1;
+
+		ring->triggers[head % ring->trigger_capacity] = trigger;
+		ring->trigger_head.store(head + 1, std::memory_order_release);
+		return 0;
+	}
+}
@@ -0,0 +1,184 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <mqueue.h>
+
+#define AFE_IPC_HOP_SAMPLES 200				// Must match VOICESEEKER_OUT_NHOP on both sides
+#define AFE_IPC_RING_RECORDS 32				// Number of hop records in the shared memory ring
+#define AFE_IPC_TRIGGER_RECORDS 16			// Number of pending triggers in the reply ring
+#define AFE_IPC_PEER_CHECK_HOPS 80			// Hops between checks for a restarted/missing AFE peer (1 s)
+#define AFE_IPC_CHANNEL_ENV "AFE_IPC_CHANNEL"	// Suffix of the IPC object names, see objectName
+#define AFE_IPC_PEER_CHECK_MS 1000			// Interval of the AFE's checks for a restarted/missing voice_ui_app
+
+namespace AFEIpc
+{
+	/*
+	 * One record per VoiceSeekerLight output hop. This replaces the three
+	 * messages (/voicespot_vslout, /voiceseeker_iterations, /voiceseeker_trigger)
+	 * which were sent separately for every hop.
+	 */
+	typedef struct hop_record {
+		uint64_t sample_index;					// Index of the first sample of this hop in the AFE output stream, monotonic within an AFE session
+		uint64_t capture_time_ns;				// CLOCK_MONOTONIC time the input of this hop was captured (valid with AFE_IPC_HOP_STAMPED)
+		int32_t iteration;						// AFE processSignal() iteration which produced the hop
+		int32_t enable_triggering;				// 0 while the AFE does not allow re-triggering
+		uint32_t flags;							// AFE_IPC_HOP_* flags
+		uint32_t reserved;
+		float samples[AFE_IPC_HOP_SAMPLES];		// VoiceSeekerLight output
+	} hop_record;
+
+	/*
+	 * sample_index and capture_time_ns were set by the AFE. Keyword offsets can
+	 * then be computed from the sample index alone. Without it (legacy message
+	 * queues) voice_ui_app counts hops itself and has to align the streams.
+	 */
+	#define AFE_IPC_HOP_STAMPED 0x1u
+
+	/*
+	 * The AFE ran its voice activity detector on this hop (VadGate), and
+	 * it heard speech. voice_ui_app may skip the wake word engine on hops
+	 * with AFE_IPC_HOP_VAD but not AFE_IPC_HOP_SPEECH.
+	 */
+	#define AFE_IPC_HOP_VAD 0x2u
+	#define AFE_IPC_HOP_SPEECH 0x4u
+
+	/*
+	 * Sent by voice_ui_app only when a keyword was detected. The AFE polls for
+	 * these without blocking and rebases the offset to its own current position.
+	 */
+	typedef struct trigger_record {
+		uint64_t sample_index;					// AFE output sample index the offset is relative to (end of the detecting hop)
+		int32_t offset;							// Keyword start, in samples back from sample_index
+		int32_t iteration;						// Iteration of the detecting hop
+		uint64_t detect_time_ns;				// CLOCK_MONOTONIC time of the detection
+	} trigger_record;
+
+	//CLOCK_MONOTONIC in nanoseconds, shared time base of both processes
+	uint64_t monotonicTimeNs();
+
+	//Name of a shared memory object or message queue of the AFE: base followed by the value of the
+	//AFE_IPC_CHANNEL environment variable, when set. A test run (voiceui_replay) sets it to get
+	//objects of its own next to the ones of the AFE and voice_ui_app running on the device.
+	std::string objectName(const char* base);
+
+	enum class Transport {
+		SharedMemory,		// Single producer/single consumer ring in POSIX shared memory (default)
+		MessageQueue		// Legacy POSIX message queues
+	};
+
+	//What the AFE does with a hop when voice_ui_app is not keeping up
+	enum class OverflowPolicy {
+		DropOldest,			// Discard the oldest queued hop (default), the hop being sent on the message queues
+		DropNewest,			// Discard the hop being sent
+		Block				// Wait for room up to a timeout, then discard the hop being sent
+	};
+
+	typedef struct producer_stats {
+		uint64_t sent_hops;
+		uint64_t dropped_hops;		// Hops lost to overflow or while voice_ui_app was not running
+		uint32_t reconnects;		// Number of times the channel was re-attached after voice_ui_app restarted
+	} producer_stats;
+
+	//Reads the "IpcTransport" key of Config.ini, SharedMemory when not present
+	Transport transportFromConfig();
+	//Reads the "IpcOverflowPolicy" key of Config.ini, DropOldest when not present
+	OverflowPolicy overflowPolicyFromConfig();
+
+	struct shm_ring;
+	struct peer_link;
+
+	/*
+	 * AFE side of the channel, never blocks the audio thread longer than the Block timeout.
+	 * A watcher thread checks every AFE_IPC_PEER_CHECK_MS whether voice_ui_app was (re)started
+	 * or went away, opens its endpoints and hands them to the audio thread, which switches
+	 * to them at its next send. The audio thread never opens nor closes an IPC object.
+	 */
+	class HopProducer
+	{
+		public:
+			HopProducer();
+			~HopProducer();
+
+			//Returns -1 if voice_ui_app is not running yet, sendHop keeps retrying to attach
+			int open(Transport transport, OverflowPolicy policy = OverflowPolicy::DropOldest, int32_t block_timeout_ms = 0);
+			void close();
+			bool isOpen() const;
+			bool isConnected() const;
+
+			//Publishes one hop, returns -1 when the hop was dropped
+			int sendHop(const hop_record& hop);
+			//Publishes consecutive hops as one batch (one wake up of voice_ui_app on the shared memory transport),
+			//returns -1 when any of them was dropped
+			int sendHops(const hop_record* hops, uint32_t count);
+			//Never blocks, returns true and fills trigger when a trigger is pending
+			bool pollTrigger(trigger_record& trigger);
+
+			const producer_stats& statistics() const;
+
+		private:
+			peer_link* attach() const;
+			static void release(peer_link* peer);
+			static void detach(peer_link* peer);
+			unsigned long peerInode() const;
+			bool waitInterval(uint32_t ms);
+			void watch(unsigned long attached);
+			void adopt();
+			uint32_t sendHopsShm(const hop_record* hops, uint32_t count);
+			int sendHopMq(const hop_record& hop);
+
+			Transport transport;
+			OverflowPolicy policy;
+			int32_t block_timeout_ms;
+			bool opened;
+			bool ever_connected;
+			producer_stats stats;
+
+			peer_link* link;						// Endpoints the audio thread sends to
+			std::atomic<peer_link*> pending;		// Made by the watcher, waiting for the audio thread
+			std::atomic<peer_link*> retired;		// Replaced, waiting to be released by the watcher
+
+			std::thread watcher;
+			std::mutex lock;
+			std::condition_variable wake;
+			bool stopping;							// Guarded by lock
+	};
+
+	//voice_ui_app side of the channel, owns (creates) the IPC objects
+	class HopConsumer
+	{
+		public:
+			HopConsumer();
+			~HopConsumer();
+
+			int create(Transport transport);
+			void destroy();
+
+			//Blocks until the next hop is available
+			int receiveHop(hop_record& hop);
+			//Never blocks, false when no hop is queued (single threaded replay of the AFE and the wake word engines)
+			bool pollHop(hop_record& hop);
+			//Never blocks, the trigger is dropped if the AFE stopped consuming them
+			int sendTrigger(const trigger_record& trigger);
+
+		private:
+			int receiveHopMq(hop_record& hop, const struct timespec* timeout);
+
+			Transport transport;
+			int fd;
+			shm_ring* ring;
+			uint64_t sample_index;
+			mqd_t mq_vslout;
+			mqd_t mq_iter;
+			mqd_t mq_trigg;
+			mqd_t mq_trigger;
+	};
+}
@@ -0,0 +1,267 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+
+#include <AFEPayload.h>
+#include <AFEIpcChannel.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define AFE_PAYLOAD_MAGIC 0x56555041u		// "VUPA"
+#define AFE_PAYLOAD_VERSION 2u
+#define AFE_PAYLOAD_MODE 0640				// No access for other users, the output is the microphone signal
+
+namespace AFEIpc
+{
+	/*
+	 * Offset 0 of the shared object, the ring follows it. magic is stored
+	 * last by publish() and cleared by withdraw(), a reader only trusts the
+	 * rest while it is set. The AFE writes a hop to the ring, then advances
+	 * written (release). owner is stored first, a second AFE leaves the
+	 * object alone while that process runs.
+	 */
+	struct payload_header {
+		std::atomic<uint32_t> magic;
+		uint32_t version;
+		uint32_t ring_samples;
+		int32_t owner;						// Pid of the AFE which created the object
+		uint64_t ring_offset;				// Bytes from the start of the object
+		uint64_t first_index;				// Output sample index at the start of the ring
+
+		alignas(64) std::atomic<uint64_t> written;	// Samples before this index are in the ring
+	};
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "the header is shared between processes");
+
+	//Pid of the AFE which created an existing object, 0 when it has none
+	static pid_t objectOwner(const char* name) {
+		int fd = shm_open(name, O_RDONLY, 0);
+		if (fd < 0)
+			return 0;
+		pid_t owner = 0;
+		struct stat st;
+		if (0 == fstat(fd, &st) && st.st_size >= (off_t)sizeof(payload_header)) {
+			void* mem = mmap(nullptr, sizeof(payload_header), PROT_READ, MAP_SHARED, fd, 0);
+			if (MAP_FAILED != mem) {
+				owner = static_cast<const payload_header*>(mem)->owner;
+				munmap(mem, sizeof(payload_header));
+			}
+		}
+		::close(fd);
+		return owner;
+	}
+
+	PayloadWriter::PayloadWriter() : header{ nullptr }, ring{ nullptr }, size{ 0 }, locked{ false }, next_index{ 0 } {
+	}
+
+	PayloadWriter::~PayloadWriter() {
+		withdraw();
+	}
+
+	int PayloadWriter::publish(const char* name, uint32_t ring_samples, uint64_t first_index, bool lock_memory) {
+		withdraw();
+
+		if (0 == ring_samples)
+			return -1;
+
+		int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, AFE_PAYLOAD_MODE);
+		if (fd < 0 && EEXIST == errno) {
+			//EPERM: the owner runs as another user
+			const pid_t owner = objectOwner(name);
+			if (owner > 0 && (0 == kill(owner, 0) || EPERM == errno)) {
+				printf("Payload export: %s belongs to the running AFE %d, not exported\n", name, (int)owner);
+				return -1;
+			}
+			//Left behind by an AFE which is gone
+			shm_unlink(name);
+			fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, AFE_PAYLOAD_MODE);
+		}
+
+		const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		size = ((sizeof(payload_header) + sizeof(float) * (size_t)ring_samples + page - 1) / page) * page;
+		void* mem = MAP_FAILED;
+		if (fd < 0 || ftruncate(fd, (off_t)size) < 0 ||
+			MAP_FAILED == (mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))) {
+			printf("Payload export: shared memory %s of %zu bytes failed: %s\n", name, size, strerror(errno));
+			if (fd >= 0) {
+				::close(fd);
+				shm_unlink(name);
+			}
+			size = 0;
+			return -1;
+		}
+		//The mapping keeps the object
+		::close(fd);
+		header = static_cast<payload_header*>(mem);
+		header->owner = (int32_t)getpid();
+		ring = reinterpret_cast<float*>(static_cast<char*>(mem) + sizeof(payload_header));
+		shm = name;
+
+		//Fault every page in now, not on the first hops
+		for (size_t offset = 0; offset < size; offset += page)
+			static_cast<volatile char*>(mem)[offset] = 0;
+		if (lock_memory) {
+			locked = (0 == mlock(mem, size));
+			if (!locked)
+				printf("Payload export: mlock of %zu bytes failed: %s (RLIMIT_MEMLOCK)\n", size, strerror(errno));
+		}
+
+		header->version = AFE_PAYLOAD_VERSION;
+		header->ring_samples = ring_samples;
+		header->ring_offset = sizeof(payload_header);
+		header->first_index = first_index;
+		header->written.store(first_index, std::memory_order_relaxed);
+		next_index = first_index;
+		header->magic.store(AFE_PAYLOAD_MAGIC, std::memory_order_release);
+		return 0;
+	}
+
+	void PayloadWriter::write(const float* samples, uint32_t count) {
+		if (nullptr == header)
+			return;
+		//A hop is shorter than the ring, it wraps once at most
+		const uint32_t ring_samples = header->ring_samples;
+		const uint32_t position = (uint32_t)((next_index - header->first_index) % ring_samples);
+		const uint32_t first = (count < ring_samples - position) ? count : ring_samples - position;
+		memcpy(ring + position, samples, sizeof(float) * first);
+		memcpy(ring, samples + first, sizeof(float) * (count - first));
+		next_index += count;
+		header->written.store(next_index, std::memory_order_release);
+	}
+
+	void PayloadWriter::withdraw() {
+		if (nullptr != header) {
+			header->magic.store(0, std::memory_order_release);
+			if (locked)
+				munlock(header, size);
+			munmap(header, size);
+		}
+		//Readers keep their mapping, a new AFE creates a new object
+		if (!shm.empty())
+			shm_unlink(shm.c_str());
+		shm.clear();
+		header = nullptr;
+		ring = nullptr;
+		size = 0;
+		locked = false;
+		next_index = 0;
+	}
+
+	bool PayloadWriter::isPublished() const {
+		return nullptr != header;
+	}
+
+	PayloadReader::PayloadReader() : mapping{ nullptr }, size{ 0 }, header{ nullptr }, ring{ nullptr }, ring_samples{ 0 }, first_index{ 0 } {
+	}
+
+	PayloadReader::~PayloadReader() {
+		close();
+	}
+
+	int PayloadReader::open() {
+		close();
+
+		int fd = shm_open(objectName(AFE_PAYLOAD_SHM_NAME).c_str(), O_RDONLY, 0);
+		if (fd < 0)
+			return -1;
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(payload_header)) {
+			::close(fd);
+			return -1;
+		}
+		void* mem = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		//The mapping keeps the object, also once the AFE unlinked it
+		::close(fd);
+		if (MAP_FAILED == mem)
+			return -1;
+		mapping = mem;
+		size = (size_t)st.st_size;
+		header = static_cast<const payload_header*>(mem);
+
+		if (AFE_PAYLOAD_MAGIC != header->magic.load(std::memory_order_acquire) || AFE_PAYLOAD_VERSION != header->version ||
+			0 == header->ring_samples || header->ring_offset + sizeof(float) * (uint64_t)header->ring_samples > size) {
+			close();
+			return -1;
+		}
+		ring = reinterpret_cast<const float*>(static_cast<const char*>(mapping) + header->ring_offset);
+		ring_samples = header->ring_samples;
+		first_index = header->first_index;
+		return 0;
+	}
+
+	void PayloadReader::close() {
+		if (nullptr != mapping)
+			munmap(mapping, size);
+		mapping = nullptr;
+		size = 0;
+		header = nullptr;
+		ring = nullptr;
+		ring_samples = 0;
+		first_index = 0;
+	}
+
+	bool PayloadReader::isOpen() const {
+		return nullptr != mapping;
+	}
+
+	bool PayloadReader::published() {
+		int fd = shm_open(objectName(AFE_PAYLOAD_SHM_NAME).c_str(), O_RDONLY, 0);
+		if (fd < 0)
+			return false;
+		bool ok = false;
+		struct stat st;
+		if (0 == fstat(fd, &st) && st.st_size >= (off_t)sizeof(payload_header)) {
+			void* mem = mmap(nullptr, sizeof(payload_header), PROT_READ, MAP_SHARED, fd, 0);
+			if (MAP_FAILED != mem) {
+				ok = (AFE_PAYLOAD_MAGIC == static_cast<const payload_header*>(mem)->magic.load(std::memory_order_acquire));
+				munmap(mem, sizeof(payload_header));
+			}
+		}
+		::close(fd);
+		return ok;
+	}
+
+	bool PayloadReader::spans(uint64_t from_index, uint32_t count, payload_span span[2]) const {
+		if (nullptr == header || from_index < first_index || count > ring_samples)
+			return false;
+		//The hop the AFE may be writing now is not readable either
+		const uint64_t end = header->written.load(std::memory_order_acquire);
+		if (from_index + count > end || !valid(from_index))
+			return false;
+
+		const uint32_t position = (uint32_t)((from_index - first_index) % ring_samples);
+		const uint32_t first = (count < ring_samples - position) ? count : ring_samples - position;
+		span[0].samples = ring + position;
+		span[0].count = first;
+		span[1].samples = ring;
+		span[1].count = count - first;
+		return true;
+	}
+
+	bool PayloadReader::valid(uint64_t from_index) const {
+		if (nullptr == header)
+			return false;
+		//Orders the reads of the samples before the loads below
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (AFE_PAYLOAD_MAGIC != header->magic.load(std::memory_order_relaxed))
+			return false;
+		//The next hop overwrites the oldest AFE_IPC_HOP_SAMPLES of the ring
+		return from_index + ring_samples >= header->written.load(std::memory_order_relaxed) + AFE_IPC_HOP_SAMPLES;
+	}
+
+	uint64_t PayloadReader::written() const {
+		return (nullptr != header) ? header->written.load(std::memory_order_acquire) : 0;
+	}
+
+	uint32_t PayloadReader::capacity() const {
+		return ring_samples;
+	}
+}
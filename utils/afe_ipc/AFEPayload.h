@@ -0,0 +1,93 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define AFE_PAYLOAD_SHM_NAME "/voiceui_payload"
+
+namespace AFEIpc
+{
+	/*
+	 * Access to the AFE output after the fact. The AFE keeps a ring of its
+	 * last output samples (RDSP_BUFFER_LENGTH_SEC) in a POSIX shared memory
+	 * object holding nothing else and copies every output hop to it, one
+	 * copy per hop on the AFE side. The header at offset 0 tells where
+	 * the ring is, which AFE output sample index (hop_record::sample_index)
+	 * it holds up to and which process owns it. Consumers map the object
+	 * read only and get the samples of any range still in the ring as one
+	 * or two spans into it, the consumer side copies nothing.
+	 *
+	 * A span stays valid until the AFE writes over it: after reading, the
+	 * consumer checks valid() and discards what it read when it failed.
+	 */
+	typedef struct payload_span {
+		const float* samples;
+		uint32_t count;
+	} payload_span;
+
+	struct payload_header;
+
+	//AFE side, owns the shared object (mode 0640, the AFE's user and group read it)
+	class PayloadWriter
+	{
+		public:
+			PayloadWriter();
+			~PayloadWriter();
+
+			//Creates the object with a ring of ring_samples, first_index: output sample index the ring starts with.
+			//The pages are faulted in, and locked with lock_memory. -1 when it cannot be created or a running AFE owns it,
+			//an object left behind by an AFE which is gone is replaced.
+			int publish(const char* name, uint32_t ring_samples, uint64_t first_index, bool lock_memory);
+			//After each output hop: appends its samples to the ring
+			void write(const float* samples, uint32_t count);
+			//Readers drop their mapping, the object is unmapped and unlinked
+			void withdraw();
+			bool isPublished() const;
+
+		private:
+			payload_header* header;
+			float* ring;
+			size_t size;
+			bool locked;
+			uint64_t next_index;
+			std::string shm;
+	};
+
+	//Consumer side, one thread
+	class PayloadReader
+	{
+		public:
+			PayloadReader();
+			~PayloadReader();
+
+			//-1 when the AFE does not export its output (PayloadExport = 0 or not running)
+			int open();
+			void close();
+			bool isOpen() const;
+			//Cheap check of the object without mapping the ring, for a periodic probe
+			static bool published();
+
+			//Up to two spans holding count samples from from_index on, oldest first.
+			//false when any of them is not in the ring (not written yet or already overwritten) or the AFE withdrew it.
+			bool spans(uint64_t from_index, uint32_t count, payload_span span[2]) const;
+			//The samples from from_index on were not overwritten, check after reading them
+			bool valid(uint64_t from_index) const;
+
+			uint64_t written() const;
+			uint32_t capacity() const;
+
+		private:
+			void* mapping;
+			size_t size;
+			const payload_header* header;
+			const float* ring;
+			uint32_t ring_samples;
+			uint64_t first_index;
+	};
+}
@@ -0,0 +1,114 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include <AFEAllocCheck.h>
+
+#ifdef AFE_ALLOC_CHECK
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+
+/* glibc entry points the interposed functions forward to */
+extern "C" {
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* ptr, size_t size);
+	void* __libc_memalign(size_t alignment, size_t size);
+}
+
+namespace
+{
+	/*
+	 * No thread local storage, a dlopened library may allocate it lazily from
+	 * inside malloc. One scope is checked at a time, that of the audio thread.
+	 */
+	std::atomic<bool> armed{ false };
+	pthread_t checkedThread;
+	std::atomic<uint32_t> scopeAllocations{ 0 };
+	std::atomic<uint64_t> totalViolations{ 0 };
+	std::atomic<uint64_t> totalAllocations{ 0 };
+
+	inline void count() {
+		if (armed.load(std::memory_order_relaxed) && pthread_equal(pthread_self(), checkedThread))
+			scopeAllocations.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+extern "C" {
+	void* malloc(size_t size) {
+		count();
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t count_, size_t size) {
+		count();
+		return __libc_calloc(count_, size);
+	}
+
+	void* realloc(void* ptr, size_t size) {
+		count();
+		return __libc_realloc(ptr, size);
+	}
+
+	int posix_memalign(void** ptr, size_t alignment, size_t size) {
+		count();
+		void* p = __libc_memalign(alignment, size);
+		if (nullptr == p)
+			return ENOMEM;
+		*ptr = p;
+		return 0;
+	}
+
+	void* aligned_alloc(size_t alignment, size_t size) {
+		count();
+		return __libc_memalign(alignment, size);
+	}
+}
+
+namespace AFERt
+{
+	AllocationGuard::AllocationGuard(const char* name) : name{ name } {
+		static bool interposed = false;
+		static bool tested = false;
+
+		checkedThread = pthread_self();
+		scopeAllocations.store(0, std::memory_order_relaxed);
+		armed.store(true);
+
+		//Once, through the dynamic linker: glibc's malloc answers unless the library was preloaded
+		if (!tested) {
+			void* (*volatile allocate)(size_t) = malloc;
+			free(allocate(1));
+			interposed = (0 != scopeAllocations.exchange(0));
+			tested = true;
+			if (!interposed)
+				fprintf(stderr, "%s: allocation check inactive, start the process with LD_PRELOAD=libafe_alloccheck.so\n", name);
+		}
+	}
+
+	AllocationGuard::~AllocationGuard() {
+		armed.store(false);
+		const uint32_t allocations = scopeAllocations.load(std::memory_order_relaxed);
+		if (0 == allocations)
+			return;
+
+		totalAllocations += allocations;
+		const uint64_t violations = ++totalViolations;
+		fprintf(stderr, "%s: %u heap allocations (%llu calls allocated so far)\n", name, allocations,
+			(unsigned long long)violations);
+	}
+
+	uint64_t AllocationGuard::violations() {
+		return totalViolations.load();
+	}
+
+	uint64_t AllocationGuard::allocations() {
+		return totalAllocations.load();
+	}
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#pragma once
+
+#include <cstdint>
+
+namespace AFERt
+{
+	/*
+	 * Checks that a scope of the audio path does not allocate. Built with
+	 * AFE_ALLOC_CHECK, the guard lives in libafe_alloccheck.so which also
+	 * interposes malloc and friends: every heap allocation the owning thread
+	 * makes while a guard is alive is counted and reported when the guard goes
+	 * out of scope. The library has to be preloaded (LD_PRELOAD), a plugin
+	 * loaded with dlopen cannot interpose malloc, the first guard warns when it
+	 * is not. Without AFE_ALLOC_CHECK the guard is empty.
+	 */
+#ifdef AFE_ALLOC_CHECK
+	class AllocationGuard
+	{
+		public:
+			AllocationGuard(const char* name);
+			~AllocationGuard();
+
+			//Scopes which allocated and allocations counted so far, over all guards
+			static uint64_t violations();
+			static uint64_t allocations();
+
+		private:
+			const char* name;
+	};
+#else
+	class AllocationGuard
+	{
+		public:
+			AllocationGuard(const char*) {}
+	};
+#endif
+}
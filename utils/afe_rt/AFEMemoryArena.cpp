@@ -0,0 +1,127 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include <AFEMemoryArena.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace AFERt
+{
+	//Default huge page size of the kernel, 0 when it has none
+	static size_t hugePageSize() {
+		size_t kib = 0;
+		FILE* meminfo = fopen("/proc/meminfo", "r");
+		if (nullptr == meminfo)
+			return 0;
+		char line[128];
+		while (nullptr != fgets(line, sizeof(line), meminfo)) {
+			if (1 == sscanf(line, "Hugepagesize: %zu kB", &kib))
+				break;
+		}
+		fclose(meminfo);
+		return kib * 1024;
+	}
+
+	MemoryArena::MemoryArena() : base{ nullptr }, size{ 0 }, next{ 0 }, huge{ false }, locked_memory{ false } {
+	}
+
+	MemoryArena::~MemoryArena() {
+		destroy();
+	}
+
+	int MemoryArena::create(size_t bytes, bool huge_pages, bool lock_memory) {
+		destroy();
+
+		if (0 == bytes)
+			return -1;
+
+		void* area = MAP_FAILED;
+		if (huge_pages) {
+			const size_t huge_page = hugePageSize();
+			if (0 != huge_page) {
+				size = ((bytes + huge_page - 1) / huge_page) * huge_page;
+				area = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			}
+			if (MAP_FAILED == area)
+				printf("MemoryArena: no huge page for %zu bytes (vm.nr_hugepages), using 4 KiB pages\n", bytes);
+		}
+		huge = (MAP_FAILED != area);
+		if (!huge) {
+			const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+			size = ((bytes + page - 1) / page) * page;
+			area = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (MAP_FAILED == area) {
+				printf("MemoryArena: mmap of %zu bytes failed: %s\n", size, strerror(errno));
+				size = 0;
+				return -1;
+			}
+#ifdef MADV_HUGEPAGE
+			//Fewer TLB entries when transparent huge pages are enabled, ignored otherwise
+			if (huge_pages)
+				madvise(area, size, MADV_HUGEPAGE);
+#endif
+		}
+		base = (char*)area;
+		next = 0;
+
+		//Fault every page in now, not on the first period
+		const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		for (size_t offset = 0; offset < size; offset += page)
+			base[offset] = 0;
+
+		if (lock_memory) {
+			locked_memory = (0 == mlock(base, size));
+			if (!locked_memory)
+				printf("MemoryArena: mlock of %zu bytes failed: %s (RLIMIT_MEMLOCK), the arena may be paged out\n", size, strerror(errno));
+		}
+		return 0;
+	}
+
+	void MemoryArena::destroy() {
+		if (nullptr != base) {
+			if (locked_memory)
+				munlock(base, size);
+			munmap(base, size);
+		}
+		base = nullptr;
+		size = 0;
+		next = 0;
+		huge = false;
+		locked_memory = false;
+	}
+
+	void* MemoryArena::carve(size_t bytes) {
+		const size_t aligned = alignedSize(bytes);
+		if (nullptr == base || aligned > size - next)
+			return nullptr;
+		//A new mapping reads as zeros
+		void* block = base + next;
+		next += aligned;
+		return block;
+	}
+
+	size_t MemoryArena::capacity() const {
+		return size;
+	}
+
+	size_t MemoryArena::used() const {
+		return next;
+	}
+
+	bool MemoryArena::hugePages() const {
+		return huge;
+	}
+
+	bool MemoryArena::locked() const {
+		return locked_memory;
+	}
+
+	size_t MemoryArena::alignedSize(size_t bytes) {
+		return ((bytes + AFE_ARENA_ALIGN - 1) / AFE_ARENA_ALIGN) * AFE_ARENA_ALIGN;
+	}
+}
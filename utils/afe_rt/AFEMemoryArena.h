@@ -0,0 +1,48 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#pragma once
+
+#include <cstddef>
+
+#define AFE_ARENA_ALIGN 64				// Every block starts on a cache line
+
+namespace AFERt
+{
+	/*
+	 * One anonymous mapping holding every buffer of a stage, carved in order.
+	 * create() maps it on huge pages when asked and available (4 KiB pages
+	 * with transparent huge pages advised otherwise), touches every page so
+	 * nothing faults once the audio runs and locks it in RAM when asked.
+	 * Single threaded, blocks are never released one by one.
+	 */
+	class MemoryArena
+	{
+		public:
+			MemoryArena();
+			~MemoryArena();
+
+			//bytes is rounded up to whole pages. Only a failed mapping is an error, a refused lock is reported.
+			int create(size_t bytes, bool huge_pages, bool lock_memory);
+			void destroy();
+
+			//Next zeroed AFE_ARENA_ALIGN aligned block, nullptr when the arena is exhausted
+			void* carve(size_t bytes);
+
+			size_t capacity() const;
+			size_t used() const;
+			bool hugePages() const;
+			bool locked() const;
+
+			//Size of a block as carve() lays it out
+			static size_t alignedSize(size_t bytes);
+
+		private:
+			char* base;
+			size_t size;
+			size_t next;
+			bool huge;
+			bool locked_memory;
+	};
+}
@@ -0,0 +1,116 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include <AFEMirrorRing.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace AFERt
+{
+	MirrorRing::MirrorRing() : base{ nullptr }, size{ 0 }, head{ 0 }, tail{ 0 }, entries{ 0 } {
+	}
+
+	MirrorRing::~MirrorRing() {
+		destroy();
+	}
+
+	int MirrorRing::create(size_t min_capacity, size_t delay_bytes) {
+		destroy();
+
+		const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		size_t bytes = ((min_capacity + page - 1) / page) * page;
+		if (0 == bytes || delay_bytes > bytes) {
+			printf("MirrorRing: delay of %zu bytes does not fit in %zu bytes\n", delay_bytes, bytes);
+			return -1;
+		}
+
+		int fd = memfd_create("afe_mirror_ring", MFD_CLOEXEC);
+		if (fd < 0) {
+			printf("MirrorRing: memfd_create failed: %s\n", strerror(errno));
+			return -1;
+		}
+		if (0 != ftruncate(fd, bytes)) {
+			printf("MirrorRing: ftruncate failed: %s\n", strerror(errno));
+			close(fd);
+			return -1;
+		}
+
+		//Reserve both halves at once, then map the same pages over each of them
+		void* area = mmap(nullptr, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (MAP_FAILED == area) {
+			printf("MirrorRing: mmap failed: %s\n", strerror(errno));
+			close(fd);
+			return -1;
+		}
+		char* first = (char*)area;
+		if (MAP_FAILED == mmap(first, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) ||
+			MAP_FAILED == mmap(first + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)) {
+			printf("MirrorRing: mirror mapping failed: %s\n", strerror(errno));
+			munmap(area, 2 * bytes);
+			close(fd);
+			return -1;
+		}
+		//The mappings keep the memory alive
+		close(fd);
+
+		base = first;
+		size = bytes;
+		//A new memfd reads as zeros, the delay is queued silence
+		head = 0;
+		tail = delay_bytes % size;
+		entries = delay_bytes;
+		return 0;
+	}
+
+	void MirrorRing::destroy() {
+		if (nullptr != base)
+			munmap(base, 2 * size);
+		base = nullptr;
+		size = 0;
+		head = 0;
+		tail = 0;
+		entries = 0;
+	}
+
+	bool MirrorRing::write(const void* data, size_t bytes) {
+		if (bytes > size - entries)
+			return false;
+
+		memcpy(base + tail, data, bytes);
+		tail = (tail + bytes) % size;
+		entries += bytes;
+		return true;
+	}
+
+	const char* MirrorRing::read(size_t bytes) {
+		if (bytes > entries)
+			return nullptr;
+
+		const char* data = base + head;
+		head = (head + bytes) % size;
+		entries -= bytes;
+		return data;
+	}
+
+	bool MirrorRing::seek(ptrdiff_t bytes) {
+		if ((bytes > 0 && (size_t)bytes > entries) || (bytes < 0 && (size_t)-bytes > size - entries))
+			return false;
+
+		head = (head + size + bytes) % size;
+		entries -= bytes;
+		return true;
+	}
+
+	size_t MirrorRing::capacity() const {
+		return size;
+	}
+
+	size_t MirrorRing::fill() const {
+		return entries;
+	}
+}
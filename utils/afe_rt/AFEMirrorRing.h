@@ -0,0 +1,46 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#pragma once
+
+#include <cstddef>
+
+namespace AFERt
+{
+	/*
+	 * Byte ring whose storage (a memfd) is mapped twice back to back, so any
+	 * span up to the capacity starting inside the ring is contiguous in memory:
+	 * no wrap-around split on write and reads are pointers into the ring.
+	 * Single threaded, used as a delay line: create() queues delay_bytes of
+	 * silence, then every write of a block is followed by the read of one.
+	 */
+	class MirrorRing
+	{
+		public:
+			MirrorRing();
+			~MirrorRing();
+
+			//The capacity is min_capacity rounded up to whole pages
+			int create(size_t min_capacity, size_t delay_bytes);
+			void destroy();
+
+			//Copies the bytes in, false when they do not fit
+			bool write(const void* data, size_t bytes);
+			//Oldest bytes, contiguous and consumed, valid until the next write. nullptr when not queued.
+			const char* read(size_t bytes);
+			//Moves the read position: forward drops queued bytes, backward queues bytes read before again
+			//(they stay in the ring until overwritten). false when out of range, nothing is moved.
+			bool seek(ptrdiff_t bytes);
+
+			size_t capacity() const;
+			size_t fill() const;
+
+		private:
+			char* base;
+			size_t size;
+			size_t head;		// Read position
+			size_t tail;		// Write position
+			size_t entries;
+	};
+}
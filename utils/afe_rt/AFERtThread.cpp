@@ -0,0 +1,58 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include <AFERtThread.h>
+#include <AFEConfigState.h>
+
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+
+namespace AFERt
+{
+	thread_config threadConfigFromConfig(const std::string& prefix, thread_config defaults) {
+		AFEConfig::AFEConfigState configState;
+		thread_config config;
+
+		config.cpu = configState.isConfigurationEnable(prefix + "Cpu", defaults.cpu);
+		config.priority = configState.isConfigurationEnable(prefix + "Priority", defaults.priority);
+		return config;
+	}
+
+	int32_t applyThreadConfig(const char* name, const thread_config& config) {
+		int32_t ret = 0;
+		int err;
+
+		//Names are limited to 15 characters, the call fails otherwise
+		char short_name[16];
+		strncpy(short_name, name, sizeof(short_name) - 1);
+		short_name[sizeof(short_name) - 1] = '\0';
+		pthread_setname_np(pthread_self(), short_name);
+
+		if (config.cpu >= 0) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(config.cpu, &cpus);
+			if (0 != (err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))) {
+				printf("%s: cannot pin to CPU %d: %s\n", name, config.cpu, strerror(err));
+				ret = -1;
+			}
+		}
+
+		if (config.priority > 0) {
+			struct sched_param param;
+			memset(&param, 0, sizeof(param));
+			param.sched_priority = config.priority;
+			if (0 != (err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))) {
+				printf("%s: cannot set SCHED_FIFO priority %d: %s\n", name, config.priority, strerror(err));
+				ret = -1;
+			}
+		}
+
+		if (0 == ret && (config.cpu >= 0 || config.priority > 0))
+			printf("%s: CPU %d, SCHED_FIFO priority %d\n", name, config.cpu, config.priority);
+		return ret;
+	}
+}
@@ -0,0 +1,22 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace AFERt
+{
+	typedef struct thread_config {
+		int32_t cpu;			// CPU the thread is pinned to, -1 to leave it to the scheduler
+		int32_t priority;		// SCHED_FIFO priority (1-99), 0 keeps SCHED_OTHER
+	} thread_config;
+
+	//Reads "<prefix>Cpu" and "<prefix>Priority" from Config.ini, a missing key keeps the default
+	thread_config threadConfigFromConfig(const std::string& prefix, thread_config defaults = { -1, 0 });
+
+	//Names the calling thread and applies the configuration. Failures (e.g. no CAP_SYS_NICE) are reported, not fatal.
+	int32_t applyThreadConfig(const char* name, const thread_config& config);
+}
@@ -0,0 +1,100 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace AFERt
+{
+	/*
+	 * Bounded single producer/single consumer ring between two threads of one
+	 * process. Same scheme as the AFE hop channel: free running indexes, and a
+	 * side only enters the kernel (private futex) when it has to sleep and the
+	 * other side only wakes it when it is sleeping.
+	 */
+	template <typename T, uint32_t Capacity>
+	class SpscRing
+	{
+		static_assert(0 == (Capacity & (Capacity - 1)), "Capacity must be a power of two");
+
+		public:
+			SpscRing() : head{ 0 }, consumer_waiting{ 0 }, tail{ 0 }, producer_waiting{ 0 } {
+			}
+
+			//Never blocks, returns false when the ring is full
+			bool push(const T& item) {
+				uint32_t h = head.load(std::memory_order_relaxed);
+				if (h - tail.load(std::memory_order_acquire) >= Capacity)
+					return false;
+				items[h & (Capacity - 1)] = item;
+				publish(head, h + 1, consumer_waiting);
+				return true;
+			}
+
+			//Blocks while the ring is full
+			void pushWait(const T& item) {
+				uint32_t h = head.load(std::memory_order_relaxed);
+				uint32_t t;
+				while (h - (t = tail.load()) >= Capacity)
+					waitForChange(tail, t, producer_waiting);
+				items[h & (Capacity - 1)] = item;
+				publish(head, h + 1, consumer_waiting);
+			}
+
+			//Never blocks, returns false when the ring is empty
+			bool pop(T& item) {
+				uint32_t t = tail.load(std::memory_order_relaxed);
+				if (head.load(std::memory_order_acquire) == t)
+					return false;
+				item = items[t & (Capacity - 1)];
+				publish(tail, t + 1, producer_waiting);
+				return true;
+			}
+
+			//Blocks while the ring is empty
+			void popWait(T& item) {
+				uint32_t t = tail.load(std::memory_order_relaxed);
+				uint32_t h;
+				while ((h = head.load()) == t)
+					waitForChange(head, h, consumer_waiting);
+				item = items[t & (Capacity - 1)];
+				publish(tail, t + 1, producer_waiting);
+			}
+
+			//Items queued, approximate when read by the other side
+			uint32_t depth() const {
+				return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed);
+			}
+
+			static constexpr uint32_t capacity() {
+				return Capacity;
+			}
+
+		private:
+			static void waitForChange(std::atomic<uint32_t>& word, uint32_t seen, std::atomic<uint32_t>& waiting) {
+				waiting.store(1);
+				if (word.load() == seen)
+					syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+				waiting.store(0);
+			}
+
+			static void publish(std::atomic<uint32_t>& word, uint32_t value, std::atomic<uint32_t>& waiting) {
+				word.store(value);
+				if (waiting.load())
+					syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+			}
+
+			alignas(64) std::atomic<uint32_t> head;		// Written by the producer
+			std::atomic<uint32_t> consumer_waiting;
+			alignas(64) std::atomic<uint32_t> tail;		// Written by the consumer
+			std::atomic<uint32_t> producer_waiting;
+			alignas(64) T items[Capacity];
+	};
+}
@@ -0,0 +1,71 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include <AFEStageMetrics.h>
+
+#include <cstdio>
+#include <time.h>
+
+namespace AFERt
+{
+	static uint64_t nowNs() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	}
+
+	StageMetrics::StageMetrics(const char* name, uint32_t report_interval_ms) : name{ name },
+		interval_ns{ (uint64_t)report_interval_ms * 1000000ull }, window_start_ns{ nowNs() }, items{ 0 }, dropped{ 0 }, clipped{ 0 },
+		depth_total{ 0 }, depth_max{ 0 }, wait_total_ns{ 0 }, wait_max_ns{ 0 }, process_total_ns{ 0 }, process_max_ns{ 0 } {
+	}
+
+	void StageMetrics::record(uint32_t queue_depth, uint64_t wait_ns, uint64_t process_ns) {
+		items++;
+		depth_total += queue_depth;
+		if (queue_depth > depth_max)
+			depth_max = queue_depth;
+		wait_total_ns += wait_ns;
+		if (wait_ns > wait_max_ns)
+			wait_max_ns = wait_ns;
+		process_total_ns += process_ns;
+		if (process_ns > process_max_ns)
+			process_max_ns = process_ns;
+
+		if (0 != interval_ns) {
+			uint64_t now = nowNs();
+			if (now - window_start_ns >= interval_ns)
+				report(now);
+		}
+	}
+
+	void StageMetrics::drop() {
+		dropped++;
+	}
+
+	void StageMetrics::clip(uint32_t samples) {
+		clipped += samples;
+	}
+
+	void StageMetrics::report(uint64_t now_ns) {
+		const double n = (items > 0) ? items : 1;
+
+		printf("[%s] %u items, %u dropped, queue depth mean %.1f max %u, wait mean %.2f ms max %.2f ms, process mean %.2f ms max %.2f ms",
+			name, items, dropped, depth_total / n, depth_max,
+			wait_total_ns / n / 1e6, wait_max_ns / 1e6, process_total_ns / n / 1e6, process_max_ns / 1e6);
+		if (0 != clipped)
+			printf(", %llu samples clipped", (unsigned long long)clipped);
+		printf("\n");
+
+		window_start_ns = now_ns;
+		items = 0;
+		dropped = 0;
+		clipped = 0;
+		depth_total = 0;
+		depth_max = 0;
+		wait_total_ns = 0;
+		wait_max_ns = 0;
+		process_total_ns = 0;
+		process_max_ns = 0;
+	}
+}
@@ -0,0 +1,47 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#pragma once
+
+#include <cstdint>
+
+namespace AFERt
+{
+	/*
+	 * Per stage counters of a thread pipeline, owned and updated by the stage's
+	 * thread only. Every report interval one line is printed and the window
+	 * starts over:
+	 *  - queue depth seen when an item was taken from the input ring
+	 *  - wait: time the item spent before the stage took it
+	 *  - process: time the stage spent on it
+	 *  - dropped: items the stage could not pass on
+	 *  - clipped: samples saturated when the stage converted to PCM, shown when any
+	 */
+	class StageMetrics
+	{
+		public:
+			//report_interval_ms 0 disables the reports
+			StageMetrics(const char* name, uint32_t report_interval_ms);
+
+			void record(uint32_t queue_depth, uint64_t wait_ns, uint64_t process_ns);
+			void drop();
+			void clip(uint32_t samples);
+
+		private:
+			void report(uint64_t now_ns);
+
+			const char* name;
+			uint64_t interval_ns;
+			uint64_t window_start_ns;
+			uint32_t items;
+			uint32_t dropped;
+			uint64_t clipped;
+			uint64_t depth_total;
+			uint32_t depth_max;
+			uint64_t wait_total_ns;
+			uint64_t wait_max_ns;
+			uint64_t process_total_ns;
+			uint64_t process_max_ns;
+	};
+}
@@ -0,0 +1,256 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include <AFEStreamAligner.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#define FFT_SIZE (2 * STREAM_ALIGNER_BLOCK)
+
+namespace AFERt
+{
+
+	StreamAligner::StreamAligner() : partitions{ 0 }, bins{ 0 }, history_length{ 0 }, fft{ nullptr },
+		fft_time{ nullptr }, fft_freq{ nullptr }, capture_spectrum{ nullptr }, reference_spectra{ nullptr }, cross_spectra{ nullptr },
+		reference_history{ nullptr }, capture_history{ nullptr }, partition_peak{ nullptr }, partition_delay{ nullptr },
+		samples{ 0 }, blocks{ 0 }, current{ 0 } {
+	}
+
+	StreamAligner::~StreamAligner() {
+		destroy();
+	}
+
+	int32_t StreamAligner::init(int32_t max_delay) {
+		destroy();
+
+		if (max_delay <= 0)
+			return -1;
+
+		//Selects the NEON or the C FFT, NE10_ERR only means NEON is not available
+		ne10_init();
+
+		partitions = (max_delay + STREAM_ALIGNER_BLOCK - 1) / STREAM_ALIGNER_BLOCK;
+		bins = FFT_SIZE / 2 + 1;
+		//Oldest reference window plus the samples of the confidence check
+		history_length = (partitions + 2) * STREAM_ALIGNER_BLOCK + STREAM_ALIGNER_CONFIDENCE_LENGTH;
+
+		fft = ne10_fft_alloc_r2c_float32(FFT_SIZE);
+		fft_time = (float*)malloc(sizeof(float) * FFT_SIZE);
+		fft_freq = (ne10_fft_cpx_float32_t*)malloc(sizeof(ne10_fft_cpx_float32_t) * bins);
+		capture_spectrum = (ne10_fft_cpx_float32_t*)malloc(sizeof(ne10_fft_cpx_float32_t) * bins);
+		reference_spectra = (ne10_fft_cpx_float32_t*)malloc(sizeof(ne10_fft_cpx_float32_t) * bins * partitions);
+		cross_spectra = (ne10_fft_cpx_float32_t*)malloc(sizeof(ne10_fft_cpx_float32_t) * bins * partitions);
+		reference_history = (float*)malloc(sizeof(float) * history_length);
+		capture_history = (float*)malloc(sizeof(float) * history_length);
+		partition_peak = (float*)malloc(sizeof(float) * partitions);
+		partition_delay = (int32_t*)malloc(sizeof(int32_t) * partitions);
+
+		if (nullptr == fft || nullptr == fft_time || nullptr == fft_freq || nullptr == capture_spectrum ||
+			nullptr == reference_spectra || nullptr == cross_spectra || nullptr == reference_history ||
+			nullptr == capture_history || nullptr == partition_peak || nullptr == partition_delay) {
+			destroy();
+			return -1;
+		}
+
+		reset();
+		return 0;
+	}
+
+	void StreamAligner::destroy() {
+		if (nullptr != fft)
+			ne10_fft_destroy_r2c_float32(fft);
+		fft = nullptr;
+
+		free(fft_time);
+		free(fft_freq);
+		free(capture_spectrum);
+		free(reference_spectra);
+		free(cross_spectra);
+		free(reference_history);
+		free(capture_history);
+		free(partition_peak);
+		free(partition_delay);
+		fft_time = nullptr;
+		fft_freq = nullptr;
+		capture_spectrum = nullptr;
+		reference_spectra = nullptr;
+		cross_spectra = nullptr;
+		reference_history = nullptr;
+		capture_history = nullptr;
+		partition_peak = nullptr;
+		partition_delay = nullptr;
+		partitions = 0;
+	}
+
+	void StreamAligner::reset() {
+		if (0 == partitions)
+			return;
+
+		memset(reference_spectra, 0, sizeof(ne10_fft_cpx_float32_t) * bins * partitions);
+		memset(cross_spectra, 0, sizeof(ne10_fft_cpx_float32_t) * bins * partitions);
+		memset(reference_history, 0, sizeof(float) * history_length);
+		memset(capture_history, 0, sizeof(float) * history_length);
+		memset(partition_peak, 0, sizeof(float) * partitions);
+		memset(partition_delay, 0, sizeof(int32_t) * partitions);
+		samples = 0;
+		blocks = 0;
+		current = { 0 };
+	}
+
+	const alignment_estimate& StreamAligner::estimate() const {
+		return current;
+	}
+
+	bool StreamAligner::locked() const {
+		return current.confidence >= STREAM_ALIGNER_MIN_CONFIDENCE && current.stable_updates >= STREAM_ALIGNER_MIN_STABLE;
+	}
+
+	bool StreamAligner::process(const float* reference, const float* capture, int32_t length) {
+		bool updated = false;
+
+		if (0 == partitions)
+			return false;
+
+		for (int32_t i = 0; i < length; i++) {
+			int32_t pos = (int32_t)(samples % history_length);
+			reference_history[pos] = reference[i];
+			capture_history[pos] = capture[i];
+			samples++;
+
+			if (0 == samples % STREAM_ALIGNER_BLOCK) {
+				processBlock();
+				//A round over all partitions completes an estimate
+				if (0 == blocks % partitions && updateEstimate())
+					updated = true;
+			}
+		}
+
+		return updated;
+	}
+
+	//Copies samples [start, start + length) of a stream, samples before the start of the stream are zero
+	void StreamAligner::copyHistory(const float* history, int64_t start, int32_t length, float* out) const {
+		for (int32_t i = 0; i < length; i++) {
+			int64_t index = start + i;
+			out[i] = (index < 0) ? 0.0f : history[index % history_length];
+		}
+	}
+
+	void StreamAligner::processBlock() {
+		const int64_t block_start = (int64_t)blocks * STREAM_ALIGNER_BLOCK;
+		ne10_fft_cpx_float32_t* reference_spectrum = reference_spectra + (blocks % partitions) * bins;
+		float capture_power = 0.0f;
+		float reference_power = 0.0f;
+
+		//Capture block, zero padded so the circular correlation has no wrap around for lags [0, BLOCK)
+		copyHistory(capture_history, block_start, STREAM_ALIGNER_BLOCK, fft_time);
+		for (int32_t i = 0; i < STREAM_ALIGNER_BLOCK; i++)
+			capture_power += fft_time[i] * fft_time[i];
+		memset(fft_time + STREAM_ALIGNER_BLOCK, 0, sizeof(float) * STREAM_ALIGNER_BLOCK);
+		ne10_fft_r2c_1d_float32(capture_spectrum, fft_time, fft);
+
+		//Reference window [block_start - BLOCK, block_start + BLOCK), computed once and reused by all partitions
+		copyHistory(reference_history, block_start - STREAM_ALIGNER_BLOCK, FFT_SIZE, fft_time);
+		for (int32_t i = STREAM_ALIGNER_BLOCK; i < FFT_SIZE; i++)
+			reference_power += fft_time[i] * fft_time[i];
+		ne10_fft_r2c_1d_float32(reference_spectrum, fft_time, fft);
+
+		//Silence carries no delay information, don't let it wash out the accumulated spectra
+		const bool active = capture_power > STREAM_ALIGNER_MIN_POWER * STREAM_ALIGNER_BLOCK &&
+			reference_power > STREAM_ALIGNER_MIN_POWER * STREAM_ALIGNER_BLOCK;
+
+		/*
+		 * Partition p correlates the capture block with the reference window
+		 * p blocks older. The peak at lag l in [0, BLOCK) means a delay of
+		 * (p + 1) * BLOCK - l samples.
+		 */
+		const int32_t valid_partitions = (blocks < (uint64_t)partitions) ? (int32_t)blocks : partitions;
+		for (int32_t p = 0; active && p < valid_partitions; p++) {
+			const ne10_fft_cpx_float32_t* x = reference_spectra + ((blocks - p) % partitions) * bins;
+			ne10_fft_cpx_float32_t* c = cross_spectra + p * bins;
+
+			for (int32_t k = 0; k < bins; k++) {
+				const ne10_fft_cpx_float32_t& y = capture_spectrum[k];
+				//conj(Y) * X, PHAT weighted so only the phase (delay) counts, not the level or the spectrum shape
+				float re = y.r * x[k].r + y.i * x[k].i;
+				float im = y.r * x[k].i - y.i * x[k].r;
+				float weight = (1.0f - STREAM_ALIGNER_FORGETTING) / (sqrtf(re * re + im * im) + 1e-20f);
+				c[k].r = STREAM_ALIGNER_FORGETTING * c[k].r + weight * re;
+				c[k].i = STREAM_ALIGNER_FORGETTING * c[k].i + weight * im;
+			}
+		}
+
+		searchPartition((int32_t)(blocks % partitions));
+		blocks++;
+	}
+
+	void StreamAligner::searchPartition(int32_t partition) {
+		//The inverse transform may use its input as scratch, keep the accumulated spectrum intact
+		memcpy(fft_freq, cross_spectra + partition * bins, sizeof(ne10_fft_cpx_float32_t) * bins);
+		ne10_fft_c2r_1d_float32(fft_time, fft_freq, fft);
+
+		float peak = 0.0f;
+		int32_t lag = 0;
+		for (int32_t l = 0; l < STREAM_ALIGNER_BLOCK; l++) {
+			if (fabsf(fft_time[l]) > peak) {
+				peak = fabsf(fft_time[l]);
+				lag = l;
+			}
+		}
+
+		partition_peak[partition] = peak;
+		partition_delay[partition] = (partition + 1) * STREAM_ALIGNER_BLOCK - lag;
+	}
+
+	bool StreamAligner::updateEstimate() {
+		int32_t best = 0;
+		for (int32_t p = 1; p < partitions; p++) {
+			if (partition_peak[p] > partition_peak[best])
+				best = p;
+		}
+
+		const int32_t delay = partition_delay[best];
+		const float confidence = (partition_peak[best] > 0.0f) ? correlationAt(delay) : 0.0f;
+
+		//Silence says nothing about the delay, keep the previous estimate and its stability
+		if (confidence < 0.0f)
+			return false;
+
+		if (confidence >= STREAM_ALIGNER_MIN_CONFIDENCE && abs(delay - current.delay) <= 1)
+			current.stable_updates++;
+		else
+			current.stable_updates = (confidence >= STREAM_ALIGNER_MIN_CONFIDENCE) ? 1 : 0;
+
+		current.delay = delay;
+		current.confidence = confidence;
+		return true;
+	}
+
+	//Normalized correlation of the latest capture samples with the reference delayed by delay samples, -1 if either is silent
+	float StreamAligner::correlationAt(int32_t delay) const {
+		const int64_t end = (int64_t)blocks * STREAM_ALIGNER_BLOCK;
+		const int64_t start = end - STREAM_ALIGNER_CONFIDENCE_LENGTH;
+
+		if (start - delay < 0)
+			return 0.0f;
+
+		double xy = 0.0;
+		double xx = 0.0;
+		double yy = 0.0;
+		for (int64_t i = start; i < end; i++) {
+			const float x = reference_history[(i - delay) % history_length];
+			const float y = capture_history[i % history_length];
+			xy += (double)x * y;
+			xx += (double)x * x;
+			yy += (double)y * y;
+		}
+
+		const double min_energy = (double)STREAM_ALIGNER_MIN_POWER * STREAM_ALIGNER_CONFIDENCE_LENGTH;
+		if (xx <= min_energy || yy <= min_energy)
+			return -1.0f;
+		return (float)(fabs(xy) / sqrt(xx * yy));
+	}
+}
@@ -0,0 +1,82 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#pragma once
+
+#include <stdint.h>
+#include <NE10.h>
+
+#define STREAM_ALIGNER_BLOCK 256					// Correlation block in samples, the FFT size is twice this
+#define STREAM_ALIGNER_CONFIDENCE_LENGTH 2048		// Samples used for the normalized correlation of an estimate
+#define STREAM_ALIGNER_FORGETTING 0.97f				// Per block forgetting factor of the accumulated cross spectra
+#define STREAM_ALIGNER_MIN_POWER 1e-8f				// Mean square below which a block is treated as silence (-80 dBFS)
+#define STREAM_ALIGNER_MIN_CONFIDENCE 0.6f			// Confidence needed before an estimate is used
+#define STREAM_ALIGNER_MIN_STABLE 2					// Consecutive matching estimates needed before an estimate is used
+
+namespace AFERt
+{
+
+	typedef struct alignment_estimate {
+		int32_t delay;				// Samples the capture stream lags the reference stream
+		float confidence;			// Normalized correlation at that delay (0..1), independent of gain
+		int32_t stable_updates;		// Consecutive estimates which found the same delay (+-1 sample)
+	} alignment_estimate;
+
+	/*
+	 * Estimates the delay between a reference stream and a delayed, possibly
+	 * scaled or dithered copy of it (capture) by cross-correlation.
+	 *
+	 * The delay range is split into partitions of STREAM_ALIGNER_BLOCK lags.
+	 * Every block the spectrum of the new samples is computed once and a
+	 * PHAT weighted cross spectrum is accumulated for every partition. Only one
+	 * partition is transformed back and searched per block, so the cost is the
+	 * same for every block. A new estimate is available after all partitions
+	 * were searched once.
+	 */
+	class StreamAligner {
+
+		int32_t partitions;
+		int32_t bins;
+		int32_t history_length;
+		ne10_fft_r2c_cfg_float32_t fft;
+
+		float* fft_time;								// FFT sized time domain scratch
+		ne10_fft_cpx_float32_t* fft_freq;				// FFT sized frequency domain scratch
+		ne10_fft_cpx_float32_t* capture_spectrum;		// Latest capture block, zero padded
+		ne10_fft_cpx_float32_t* reference_spectra;		// Reference windows of the last partitions blocks
+		ne10_fft_cpx_float32_t* cross_spectra;			// Accumulated cross spectrum per partition
+		float* reference_history;
+		float* capture_history;
+		float* partition_peak;
+		int32_t* partition_delay;
+
+		uint64_t samples;								// Samples fed per stream
+		uint64_t blocks;								// Blocks processed
+		alignment_estimate current;
+
+		void copyHistory(const float* history, int64_t start, int32_t length, float* out) const;
+		void processBlock();
+		void searchPartition(int32_t partition);
+		bool updateEstimate();
+		float correlationAt(int32_t delay) const;
+
+	public:
+		StreamAligner();
+		~StreamAligner();
+
+		//Allocates everything needed for delays up to max_delay samples
+		int32_t init(int32_t max_delay);
+		void destroy();
+		//Forgets the streams, e.g. after samples were lost on one of them
+		void reset();
+
+		//Feeds the same number of samples of both streams, returns true when a new estimate is available.
+		//Estimates are only updated while both streams carry signal.
+		bool process(const float* reference, const float* capture, int32_t length);
+
+		const alignment_estimate& estimate() const;
+		//Whether the latest estimate is confident and stable enough to be used
+		bool locked() const;
+	};
+}
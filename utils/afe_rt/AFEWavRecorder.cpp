@@ -0,0 +1,170 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include <AFEWavRecorder.h>
+#include <AFERtThread.h>
+#include <RdspWavfile.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+//Records kept free for open/close/stop, data never takes them
+#define AFE_WAV_CONTROL_RECORDS (2 * AFE_WAV_STREAMS + 1)
+//stdio buffer of each file on the writer thread
+#define AFE_WAV_FILE_BUFFER (64 * 1024)
+
+namespace AFERt
+{
+	WavRecorder::WavRecorder() : dropped_writes{ 0 }, dropped_records{ 0 }, thread_prefix{ nullptr } {
+		memset(frame_bytes, 0, sizeof(frame_bytes));
+	}
+
+	WavRecorder::~WavRecorder() {
+		stop();
+	}
+
+	int WavRecorder::start(const char* thread_prefix) {
+		stop();
+
+		this->thread_prefix = thread_prefix;
+		memset(frame_bytes, 0, sizeof(frame_bytes));
+		dropped_writes.store(0);
+		dropped_records.store(0);
+		writer = std::thread(&WavRecorder::run, this);
+		return 0;
+	}
+
+	void WavRecorder::stop() {
+		if (!writer.joinable())
+			return;
+
+		for (int32_t stream = 0; stream < AFE_WAV_STREAMS; stream++)
+			close(stream);
+
+		//Not the audio thread any more, wait for room instead of dropping the stop
+		staging.command = Command::Stop;
+		ring.pushWait(staging);
+		writer.join();
+	}
+
+	bool WavRecorder::pushControl(const record& item) {
+		if (ring.push(item))
+			return true;
+		dropped_records.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	bool WavRecorder::open(int32_t stream, const char* name, uint32_t sample_rate, uint16_t channels, uint16_t bits_per_sample, WaveFormat format) {
+		if (stream < 0 || stream >= AFE_WAV_STREAMS || !writer.joinable())
+			return false;
+		if (0 != frame_bytes[stream])
+			close(stream);
+
+		staging.command = Command::Open;
+		staging.stream = (uint8_t)stream;
+		staging.channels = channels;
+		staging.bits_per_sample = bits_per_sample;
+		staging.format = format;
+		staging.sample_rate = sample_rate;
+		strncpy(staging.data, name, AFE_WAV_NAME_MAX - 1);
+		staging.data[AFE_WAV_NAME_MAX - 1] = '\0';
+		if (!pushControl(staging))
+			return false;
+
+		frame_bytes[stream] = (uint32_t)channels * (bits_per_sample / 8);
+		return true;
+	}
+
+	bool WavRecorder::write(int32_t stream, const void* frames, uint32_t num_frames) {
+		if (stream < 0 || stream >= AFE_WAV_STREAMS || 0 == frame_bytes[stream])
+			return false;
+
+		uint32_t bytes = num_frames * frame_bytes[stream];
+		const uint32_t records = (bytes + AFE_WAV_RECORD_BYTES - 1) / AFE_WAV_RECORD_BYTES;
+		//All of it or nothing, a file with a gap is worse than one a write short
+		if (ring.depth() + records + AFE_WAV_CONTROL_RECORDS > ring.capacity()) {
+			dropped_writes.fetch_add(1, std::memory_order_relaxed);
+			dropped_records.fetch_add(records, std::memory_order_relaxed);
+			return false;
+		}
+
+		const char* next = (const char*)frames;
+		staging.command = Command::Data;
+		staging.stream = (uint8_t)stream;
+		while (bytes > 0) {
+			staging.bytes = (bytes < AFE_WAV_RECORD_BYTES) ? bytes : AFE_WAV_RECORD_BYTES;
+			memcpy(staging.data, next, staging.bytes);
+			ring.push(staging);
+			next += staging.bytes;
+			bytes -= staging.bytes;
+		}
+		return true;
+	}
+
+	bool WavRecorder::close(int32_t stream) {
+		if (stream < 0 || stream >= AFE_WAV_STREAMS || 0 == frame_bytes[stream])
+			return false;
+
+		frame_bytes[stream] = 0;
+		staging.command = Command::Close;
+		staging.stream = (uint8_t)stream;
+		return pushControl(staging);
+	}
+
+	uint64_t WavRecorder::droppedWrites() const {
+		return dropped_writes.load(std::memory_order_relaxed);
+	}
+
+	uint64_t WavRecorder::droppedRecords() const {
+		return dropped_records.load(std::memory_order_relaxed);
+	}
+
+	void WavRecorder::run() {
+		//Disk I/O, SCHED_OTHER unless configured otherwise
+		applyThreadConfig("afe_wav", threadConfigFromConfig(thread_prefix));
+
+		rdsp_wav_file_t files[AFE_WAV_STREAMS];
+		std::string names[AFE_WAV_STREAMS];
+		uint64_t written[AFE_WAV_STREAMS];
+		uint32_t file_frame_bytes[AFE_WAV_STREAMS];
+		memset(files, 0, sizeof(files));
+
+		//Records are large, keep the one being written off the stack
+		record* item = new record;
+		while (true) {
+			ring.popWait(*item);
+			const int32_t stream = item->stream;
+
+			switch (item->command) {
+			case Command::Open:
+				files[stream] = rdsp_wav_write_open_buffered(item->data, item->sample_rate, item->channels, item->bits_per_sample,
+					item->format, AFE_WAV_FILE_BUFFER);
+				names[stream] = item->data;
+				written[stream] = 0;
+				file_frame_bytes[stream] = (uint32_t)item->channels * (item->bits_per_sample / 8);
+				break;
+
+			case Command::Data:
+				if (NULL != files[stream].fid)
+					written[stream] += fwrite(item->data, 1, item->bytes, files[stream].fid);
+				break;
+
+			case Command::Close:
+				if (NULL != files[stream].fid) {
+					//One header update per file instead of one per write
+					rdsp_wav_update_size((uint32_t)(written[stream] / file_frame_bytes[stream]), &files[stream]);
+					rdsp_wav_close(&files[stream]);
+					printf("Debug WAV %s: %llu frames\n", names[stream].c_str(),
+						(unsigned long long)(written[stream] / file_frame_bytes[stream]));
+				}
+				break;
+
+			case Command::Stop:
+				delete item;
+				return;
+			}
+		}
+	}
+}
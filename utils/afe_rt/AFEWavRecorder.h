@@ -0,0 +1,85 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include <AFESpscRing.h>
+#include <RdspWavfile.h>
+
+#define AFE_WAV_RECORD_BYTES 4096		// Payload of one ring record
+#define AFE_WAV_RECORDS 256				// Ring records, 1 MiB of audio (about 2 s of the AFE debug capture)
+#define AFE_WAV_STREAMS 4				// Files open at the same time
+#define AFE_WAV_NAME_MAX 256
+
+namespace AFERt
+{
+	/*
+	 * Writes WAV files for the audio thread on a background thread.
+	 *
+	 * open/write/close never block nor allocate: they queue records on a
+	 * bounded SPSC ring and the writer thread does the file I/O, buffered and
+	 * sequential. The WAV header is patched once, when the file is closed.
+	 * When the ring has no room for a write the whole write is dropped and
+	 * counted, the audio thread never waits for the disk. A few records stay
+	 * reserved for open/close so a file is always finalized.
+	 *
+	 * One producer thread (the audio thread, or any thread while the audio
+	 * thread is stopped).
+	 */
+	class WavRecorder
+	{
+		public:
+			WavRecorder();
+			~WavRecorder();
+
+			//Starts the writer thread, thread_prefix names the <prefix>Cpu/<prefix>Priority keys of Config.ini
+			int start(const char* thread_prefix);
+			//Closes the open files and stops the writer once everything queued is written
+			void stop();
+
+			//Producer side, false when the ring is full (counted) or the stream is out of range/not open.
+			//format: WAVE_FORMAT_PCM for integer samples, WAVE_FORMAT_IEEE_FLOAT for float ones
+			bool open(int32_t stream, const char* name, uint32_t sample_rate, uint16_t channels, uint16_t bits_per_sample, WaveFormat format);
+			bool write(int32_t stream, const void* frames, uint32_t num_frames);
+			bool close(int32_t stream);
+
+			//Writes and records lost because the ring was full
+			uint64_t droppedWrites() const;
+			uint64_t droppedRecords() const;
+
+		private:
+			enum class Command : uint8_t {
+				Open,
+				Data,
+				Close,
+				Stop
+			};
+
+			typedef struct record {
+				Command command;
+				uint8_t stream;
+				uint16_t channels;			// Open
+				uint16_t bits_per_sample;	// Open
+				WaveFormat format;			// Open
+				uint32_t sample_rate;		// Open
+				uint32_t bytes;				// Data
+				char data[AFE_WAV_RECORD_BYTES];	// Data, or the file name (Open)
+			} record;
+
+			bool pushControl(const record& item);
+			void run();
+
+			SpscRing<record, AFE_WAV_RECORDS> ring;
+			record staging;					// Producer side, avoids a record on the audio thread's stack
+			uint32_t frame_bytes[AFE_WAV_STREAMS];	// Producer side, 0 while the stream is closed
+			std::atomic<uint64_t> dropped_writes;
+			std::atomic<uint64_t> dropped_records;
+			std::thread writer;
+			const char* thread_prefix;
+	};
+}
@@ -15,8 +15,34 @@
 #ifndef RDSP_SYSDEFS_PARSER_H
 #define RDSP_SYSDEFS_PARSER_H
 
+#include <stdint.h>
+
 typedef struct RETUNE_VOICESEEKER_plugin_s RETUNE_VOICESEEKERLIGHT_plugin_t;
 
+#define RDSP_SYSDEFS_MAX_WORDS 16384	/* Words of records a user sysdefs file may hold */
+
+/*
+ * User sysdefs XML: the checksum of the sysdefs the file was made for
+ * (sysdefs_checksum of the plugin) and parameters by ID, e.g.
+ *
+ *   <sysdefs checksum="0x0B3307F8">
+ *     <param name="aec_mu" id="11065" length="1">0.35</param>
+ *     <param name="mic_mask" id="11066" length="1" type="int">15</param>
+ *   </sysdefs>
+ *
+ * Values are separated by spaces or commas, float unless type="int",
+ * 0x... is taken as the raw 32-bit word. Comments are skipped.
+ */
+
+/*
+ * Parses Auser_sysdefs_fn into records of 32-bit words, one per parameter in
+ * file order: id, length, then the length values. Achecksum receives the
+ * checksum of the file (0 when it has none).
+ * Returns the number of words written to Awords, -1 on an error (printed).
+ */
+int32_t parse_user_sysdefs_xml(const char* Auser_sysdefs_fn, uint32_t* Achecksum, uint32_t* Awords, int32_t Amax_words);
+
+/* Parses Auser_sysdefs_fn and sets its parameters, nothing is set when its checksum does not match the plugin's */
 void load_user_sysdefs_xml(RETUNE_VOICESEEKERLIGHT_plugin_t* APluginInit, const char* Auser_sysdefs_fn);
 
 #endif // RDSP_SYSDEFS_PARSER_H
@@ -12,6 +12,7 @@
  */
 
 #include "RdspAppUtilities.h"
+#include "RdspPcmConvert.h"
 
 #include <cstring>
 #include <errno.h>
@@ -43,50 +44,28 @@ int16_t float_to_int16_ext(float Ax)
 }
 
 
-void rdsp_float_to_pcm(char* tmp_buf_int, float** Abuffer, uint32_t Anum_samples, int32_t num_channels, int32_t sample_size) {
+uint32_t rdsp_float_to_pcm(char* tmp_buf_int, float** Abuffer, uint32_t Anum_samples, int32_t num_channels, int32_t sample_size) {
+
+	// 16 or 32 bit integer, saturating, interleaved by RdspPcmConvert
 	if (sample_size == 2) {
-		const float scale = float_to_float_ext(32768.0f); // buffer is 32 bit floating-point
-		int16_t* ptr = (int16_t*)tmp_buf_int;
-		for (uint32_t isample = 0; isample < Anum_samples; isample++) {
-			for (uint16_t ich = 0; ich < num_channels; ich++, ptr++) {
-				*ptr = float_to_int16_ext(Abuffer[ich][isample] * scale);
-			}
-		}
+		return rdsp_float_interleave_to_pcm(Abuffer, tmp_buf_int, Anum_samples, num_channels, RDSP_PCM_FORMAT_S16_LE);
 	}
 	else if (sample_size == 4) {
-		const float scale = float_to_float_ext(32768.0f * 65536.0f);
-		int32_t* ptr = (int32_t*)tmp_buf_int;
-		for (uint32_t isample = 0; isample < Anum_samples; isample++) {
-			for (uint16_t ich = 0; ich < num_channels; ich++, ptr++) {
-				*ptr = float_to_int32_ext(Abuffer[ich][isample] * scale);
-			}
-		}
-
+		return rdsp_float_interleave_to_pcm(Abuffer, tmp_buf_int, Anum_samples, num_channels, RDSP_PCM_FORMAT_S32_LE);
 	} else {
 		printf(" NO 16/32 bits on rdsp_float_to_pcm\n");
+		return 0;
 	}
 }
 
 void rdsp_pcm_to_float(const char* tmp_buf_int, float** Abuffer, uint32_t Anum_samples, int32_t num_channels, int32_t sample_size) {
 
-	// 16 bit integer wav file
+	// 16 or 32 bit integer, same scaling as before, deinterleaved by RdspPcmConvert
 	if (sample_size == 2) {
-		const float scale = float_to_float_ext(3.0517578125e-05f); // Convert to float
-		for (int32_t ich = 0; ich <num_channels; ich++) {
-			int16_t* ptr = (int16_t*)tmp_buf_int + ich;
-			for (uint32_t isample = 0; isample < Anum_samples; isample++, ptr += num_channels) {
-					Abuffer[ich][isample] = int_to_float_ext(*ptr) * scale;
-			}
-		}
+		rdsp_pcm_deinterleave_to_float(tmp_buf_int, Abuffer, Anum_samples, num_channels, RDSP_PCM_FORMAT_S16_LE);
 	}
 	else if (sample_size == 4) {
-		const float scale = float_to_float_ext(4.656612873077393e-10f);
-		for (int32_t ich = 0; ich <num_channels; ich++) {
-			int32_t* ptr = (int32_t*)tmp_buf_int + ich;
-			for (uint32_t isample = 0; isample < Anum_samples; isample++, ptr += num_channels) {
-					Abuffer[ich][isample] = int_to_float_ext(*ptr) * scale;
-			}
-		}
+		rdsp_pcm_deinterleave_to_float(tmp_buf_int, Abuffer, Anum_samples, num_channels, RDSP_PCM_FORMAT_S32_LE);
 	} else {
 		printf(" NO 16/32 bits on rdsp_pcm_to_float\n");
 	}
@@ -38,6 +38,7 @@
 
 	void rdsp_pcm_to_float(const char* tmp_buf_int, float** Abuffer, uint32_t Anum_samples, int32_t num_channels, int32_t sample_size);
 
-	void rdsp_float_to_pcm(char* tmp_buf_int, float** Abuffer, uint32_t Anum_samples, int32_t num_channels, int32_t sample_size);
+	/* Saturating, returns the number of clipped samples */
+	uint32_t rdsp_float_to_pcm(char* tmp_buf_int, float** Abuffer, uint32_t Anum_samples, int32_t num_channels, int32_t sample_size);
 
 #endif /* RDSP_VOICESEEKER_APP_UTILITIES_H */
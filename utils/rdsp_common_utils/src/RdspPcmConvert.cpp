@@ -0,0 +1,405 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+
+#include "RdspPcmConvert.h"
+
+#include <climits>
+#include <cstring>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define RDSP_PCM_CONVERT_NEON 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/* Powers of two, the scaling is exact and both kernels round only in the int to float conversion */
+static const float scaleS16 = 3.0517578125e-05f;		/* 2^-15 */
+static const float scaleS32 = 4.656612873077393e-10f;	/* 2^-31, also for S24 shifted to the top */
+
+/* Output scaling and ranges */
+static const float fullScaleS16 = 32768.0f;
+static const float fullScaleS24 = 8388608.0f;
+static const float fullScaleS32 = 2147483648.0f;
+
+rdsp_pcm_format rdsp_pcm_format_from_name(const char* name) {
+	if (!strcmp(name, "S16_LE"))
+		return RDSP_PCM_FORMAT_S16_LE;
+	if (!strcmp(name, "S24_LE"))
+		return RDSP_PCM_FORMAT_S24_LE;
+	if (!strcmp(name, "S24_3LE"))
+		return RDSP_PCM_FORMAT_S24_3LE;
+	if (!strcmp(name, "S32_LE"))
+		return RDSP_PCM_FORMAT_S32_LE;
+	if (!strcmp(name, "FLOAT_LE"))
+		return RDSP_PCM_FORMAT_FLOAT_LE;
+	return RDSP_PCM_FORMAT_UNKNOWN;
+}
+
+int32_t rdsp_pcm_format_size(rdsp_pcm_format format) {
+	switch (format) {
+	case RDSP_PCM_FORMAT_S16_LE:
+		return 2;
+	case RDSP_PCM_FORMAT_S24_3LE:
+		return 3;
+	case RDSP_PCM_FORMAT_UNKNOWN:
+		return 0;
+	default:
+		return 4;
+	}
+}
+
+/* One sample, the reference for the NEON kernels */
+static inline float sampleToFloat(const char* pcm, uint32_t index, rdsp_pcm_format format) {
+	switch (format) {
+	case RDSP_PCM_FORMAT_S16_LE:
+		return (float)((const int16_t*)pcm)[index] * scaleS16;
+	case RDSP_PCM_FORMAT_S24_LE:
+		return (float)(int32_t)((uint32_t)((const int32_t*)pcm)[index] << 8) * scaleS32;
+	case RDSP_PCM_FORMAT_S24_3LE: {
+		const uint8_t* bytes = (const uint8_t*)pcm + 3 * index;
+		return (float)(int32_t)(((uint32_t)bytes[0] << 8) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 24)) * scaleS32;
+	}
+	case RDSP_PCM_FORMAT_S32_LE:
+		return (float)((const int32_t*)pcm)[index] * scaleS32;
+	case RDSP_PCM_FORMAT_FLOAT_LE:
+		return ((const float*)pcm)[index];
+	default:
+		return 0.0f;
+	}
+}
+
+void rdsp_pcm_deinterleave_to_float_scalar(const char* pcm, float** planar, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format) {
+	for (int32_t ich = 0; ich < num_channels; ich++) {
+		float* out = planar[ich];
+		for (uint32_t isample = 0, index = ich; isample < num_samples; isample++, index += num_channels)
+			out[isample] = sampleToFloat(pcm, index, format);
+	}
+}
+
+/* float to int32 as FCVTZS does it: truncation toward zero, saturation, NaN to 0 */
+static inline int32_t truncateSaturate(float value) {
+	if (value >= fullScaleS32)
+		return INT32_MAX;
+	if (value < -fullScaleS32)
+		return INT32_MIN;
+	if (value != value)
+		return 0;
+	return (int32_t)value;
+}
+
+/* One sample, returns 1 when it was clipped. The reference for the NEON kernels */
+static inline uint32_t sampleFromFloat(float value, char* pcm, uint32_t index, rdsp_pcm_format format) {
+	int32_t sample;
+	uint32_t clipped = 0;
+
+	switch (format) {
+	case RDSP_PCM_FORMAT_S16_LE:
+		sample = truncateSaturate(value * fullScaleS16);
+		if (sample > INT16_MAX || sample < INT16_MIN) {
+			sample = (sample > 0) ? INT16_MAX : INT16_MIN;
+			clipped = 1;
+		}
+		((int16_t*)pcm)[index] = (int16_t)sample;
+		return clipped;
+	case RDSP_PCM_FORMAT_S24_LE:
+	case RDSP_PCM_FORMAT_S24_3LE:
+		sample = truncateSaturate(value * fullScaleS24);
+		if (sample > 0x7FFFFF || sample < -0x800000) {
+			sample = (sample > 0) ? 0x7FFFFF : -0x800000;
+			clipped = 1;
+		}
+		if (RDSP_PCM_FORMAT_S24_LE == format) {
+			((int32_t*)pcm)[index] = sample;
+		}
+		else {
+			uint8_t* bytes = (uint8_t*)pcm + 3 * index;
+			bytes[0] = (uint8_t)sample;
+			bytes[1] = (uint8_t)(sample >> 8);
+			bytes[2] = (uint8_t)(sample >> 16);
+		}
+		return clipped;
+	case RDSP_PCM_FORMAT_S32_LE:
+		value *= fullScaleS32;
+		((int32_t*)pcm)[index] = truncateSaturate(value);
+		return (value >= fullScaleS32 || value < -fullScaleS32) ? 1 : 0;
+	case RDSP_PCM_FORMAT_FLOAT_LE:
+		((float*)pcm)[index] = value;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+uint32_t rdsp_float_interleave_to_pcm_scalar(const float* const* planar, char* pcm, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format) {
+	uint32_t clipped = 0;
+	for (uint32_t isample = 0, index = 0; isample < num_samples; isample++)
+		for (int32_t ich = 0; ich < num_channels; ich++, index++)
+			clipped += sampleFromFloat(planar[ich][isample], pcm, index, format);
+	return clipped;
+}
+
+#if RDSP_PCM_CONVERT_NEON
+
+/* 4 consecutive interleaved samples to float */
+static inline float32x4_t load4(const char* pcm, uint32_t index, rdsp_pcm_format format) {
+	switch (format) {
+	case RDSP_PCM_FORMAT_S16_LE:
+		return vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16((const int16_t*)pcm + index))), scaleS16);
+	case RDSP_PCM_FORMAT_S24_LE:
+		return vmulq_n_f32(vcvtq_f32_s32(vshlq_n_s32(vld1q_s32((const int32_t*)pcm + index), 8)), scaleS32);
+	case RDSP_PCM_FORMAT_S32_LE:
+		return vmulq_n_f32(vcvtq_f32_s32(vld1q_s32((const int32_t*)pcm + index)), scaleS32);
+	default:
+		return vld1q_f32((const float*)pcm + index);
+	}
+}
+
+/*
+ * Four frames per step: the 4 * C interleaved samples are converted with
+ * contiguous loads into a block on the stack (L1), which vldN then splits into
+ * the channels. 6 and 8 channels are two vld3/vld4 unzipped, 5 and 7 are
+ * scattered. The frames left over are done by the scalar code.
+ */
+template <int C>
+static void deinterleaveNeon(const char* pcm, float** planar, uint32_t num_samples, rdsp_pcm_format format) {
+	float block[4 * C];
+	uint32_t isample = 0;
+
+	for (; isample + 4 <= num_samples; isample += 4) {
+		const uint32_t index = isample * C;
+		if (1 == C) {
+			vst1q_f32(planar[0] + isample, load4(pcm, index, format));
+			continue;
+		}
+		for (int i = 0; i < C; i++)
+			vst1q_f32(block + 4 * i, load4(pcm, index + 4 * i, format));
+
+		if (2 == C) {
+			float32x4x2_t v = vld2q_f32(block);
+			vst1q_f32(planar[0] + isample, v.val[0]);
+			vst1q_f32(planar[1] + isample, v.val[1]);
+		}
+		else if (3 == C) {
+			float32x4x3_t v = vld3q_f32(block);
+			for (int ich = 0; ich < 3; ich++)
+				vst1q_f32(planar[ich] + isample, v.val[ich]);
+		}
+		else if (4 == C) {
+			float32x4x4_t v = vld4q_f32(block);
+			for (int ich = 0; ich < 4; ich++)
+				vst1q_f32(planar[ich] + isample, v.val[ich]);
+		}
+		else if (6 == C) {
+			/* Frames 0-1 and 2-3, lanes hold channel k and k + 3 */
+			float32x4x3_t a = vld3q_f32(block);
+			float32x4x3_t b = vld3q_f32(block + 12);
+			for (int ich = 0; ich < 3; ich++) {
+				vst1q_f32(planar[ich] + isample, vuzp1q_f32(a.val[ich], b.val[ich]));
+				vst1q_f32(planar[ich + 3] + isample, vuzp2q_f32(a.val[ich], b.val[ich]));
+			}
+		}
+		else if (8 == C) {
+			float32x4x4_t a = vld4q_f32(block);
+			float32x4x4_t b = vld4q_f32(block + 16);
+			for (int ich = 0; ich < 4; ich++) {
+				vst1q_f32(planar[ich] + isample, vuzp1q_f32(a.val[ich], b.val[ich]));
+				vst1q_f32(planar[ich + 4] + isample, vuzp2q_f32(a.val[ich], b.val[ich]));
+			}
+		}
+		else {
+			for (int frame = 0; frame < 4; frame++)
+				for (int ich = 0; ich < C; ich++)
+					planar[ich][isample + frame] = block[frame * C + ich];
+		}
+	}
+
+	for (; isample < num_samples; isample++)
+		for (int ich = 0; ich < C; ich++)
+			planar[ich][isample] = sampleToFloat(pcm, isample * C + ich, format);
+}
+
+void rdsp_pcm_deinterleave_to_float_neon(const char* pcm, float** planar, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format) {
+	/* Packed 24 bits has no lane aligned load */
+	if (RDSP_PCM_FORMAT_S24_3LE == format) {
+		rdsp_pcm_deinterleave_to_float_scalar(pcm, planar, num_samples, num_channels, format);
+		return;
+	}
+	switch (num_channels) {
+	case 1: deinterleaveNeon<1>(pcm, planar, num_samples, format); break;
+	case 2: deinterleaveNeon<2>(pcm, planar, num_samples, format); break;
+	case 3: deinterleaveNeon<3>(pcm, planar, num_samples, format); break;
+	case 4: deinterleaveNeon<4>(pcm, planar, num_samples, format); break;
+	case 5: deinterleaveNeon<5>(pcm, planar, num_samples, format); break;
+	case 6: deinterleaveNeon<6>(pcm, planar, num_samples, format); break;
+	case 7: deinterleaveNeon<7>(pcm, planar, num_samples, format); break;
+	case 8: deinterleaveNeon<8>(pcm, planar, num_samples, format); break;
+	default: rdsp_pcm_deinterleave_to_float_scalar(pcm, planar, num_samples, num_channels, format); break;
+	}
+}
+
+/* 4 samples of one channel to PCM values in int32 lanes, FLOAT_LE passes the bits */
+static inline int32x4_t toPcm4(float32x4_t value, rdsp_pcm_format format, float full_scale, int32x4_t low, int32x4_t high, uint32x4_t& clipped) {
+	if (RDSP_PCM_FORMAT_FLOAT_LE == format)
+		return vreinterpretq_s32_f32(value);
+
+	float32x4_t scaled = vmulq_n_f32(value, full_scale);
+	int32x4_t sample = vcvtq_s32_f32(scaled);
+	if (RDSP_PCM_FORMAT_S32_LE == format) {
+		/* The conversion already saturates, only count */
+		uint32x4_t over = vorrq_u32(vcgeq_f32(scaled, vdupq_n_f32(fullScaleS32)), vcltq_f32(scaled, vdupq_n_f32(-fullScaleS32)));
+		clipped = vsubq_u32(clipped, over);
+		return sample;
+	}
+	clipped = vsubq_u32(clipped, vorrq_u32(vcgtq_s32(sample, high), vcltq_s32(sample, low)));
+	return vminq_s32(vmaxq_s32(sample, low), high);
+}
+
+/*
+ * Four frames per step, the mirror of deinterleaveNeon: every channel is
+ * converted and saturated in int32 lanes, vstN interleaves them into a block
+ * on the stack which is then narrowed to the sample size. S24_3LE is packed
+ * byte wise from the block.
+ */
+template <int C>
+static uint32_t interleaveNeon(const float* const* planar, char* pcm, uint32_t num_samples, rdsp_pcm_format format) {
+	int32_t block[4 * C];
+	int32x4_t sample[C];
+	uint32x4_t clipped = vdupq_n_u32(0);
+	float full_scale = (RDSP_PCM_FORMAT_S16_LE == format) ? fullScaleS16 : (RDSP_PCM_FORMAT_S32_LE == format) ? fullScaleS32 : fullScaleS24;
+	int32x4_t low = vdupq_n_s32((RDSP_PCM_FORMAT_S16_LE == format) ? INT16_MIN : -0x800000);
+	int32x4_t high = vdupq_n_s32((RDSP_PCM_FORMAT_S16_LE == format) ? INT16_MAX : 0x7FFFFF);
+	uint32_t isample = 0;
+
+	for (; isample + 4 <= num_samples; isample += 4) {
+		const uint32_t index = isample * C;
+		for (int ich = 0; ich < C; ich++)
+			sample[ich] = toPcm4(vld1q_f32(planar[ich] + isample), format, full_scale, low, high, clipped);
+
+		if (1 == C) {
+			vst1q_s32(block, sample[0]);
+		}
+		else if (2 == C) {
+			int32x4x2_t v = { { sample[0], sample[1] } };
+			vst2q_s32(block, v);
+		}
+		else if (3 == C) {
+			int32x4x3_t v = { { sample[0], sample[1], sample[2] } };
+			vst3q_s32(block, v);
+		}
+		else if (4 == C) {
+			int32x4x4_t v = { { sample[0], sample[1], sample[2], sample[3] } };
+			vst4q_s32(block, v);
+		}
+		else if (6 == C) {
+			/* Lanes hold channel k and k + 3 of frames 0-1, then of frames 2-3 */
+			int32x4x3_t a, b;
+			for (int ich = 0; ich < 3; ich++) {
+				a.val[ich] = vzip1q_s32(sample[ich], sample[ich + 3]);
+				b.val[ich] = vzip2q_s32(sample[ich], sample[ich + 3]);
+			}
+			vst3q_s32(block, a);
+			vst3q_s32(block + 12, b);
+		}
+		else if (8 == C) {
+			int32x4x4_t a, b;
+			for (int ich = 0; ich < 4; ich++) {
+				a.val[ich] = vzip1q_s32(sample[ich], sample[ich + 4]);
+				b.val[ich] = vzip2q_s32(sample[ich], sample[ich + 4]);
+			}
+			vst4q_s32(block, a);
+			vst4q_s32(block + 16, b);
+		}
+		else {
+			int32_t lanes[4 * C];
+			for (int ich = 0; ich < C; ich++)
+				vst1q_s32(lanes + 4 * ich, sample[ich]);
+			for (int frame = 0; frame < 4; frame++)
+				for (int ich = 0; ich < C; ich++)
+					block[frame * C + ich] = lanes[4 * ich + frame];
+		}
+
+		if (RDSP_PCM_FORMAT_S16_LE == format) {
+			for (int i = 0; i < C; i++)
+				vst1_s16((int16_t*)pcm + index + 4 * i, vmovn_s32(vld1q_s32(block + 4 * i)));
+		}
+		else if (RDSP_PCM_FORMAT_S24_3LE == format) {
+			uint8_t* bytes = (uint8_t*)pcm + 3 * index;
+			for (int i = 0; i < 4 * C; i++, bytes += 3) {
+				bytes[0] = (uint8_t)block[i];
+				bytes[1] = (uint8_t)(block[i] >> 8);
+				bytes[2] = (uint8_t)(block[i] >> 16);
+			}
+		}
+		else {
+			memcpy((int32_t*)pcm + index, block, sizeof(block));
+		}
+	}
+
+	uint32_t count = vaddvq_u32(clipped);
+	for (; isample < num_samples; isample++)
+		for (int ich = 0; ich < C; ich++)
+			count += sampleFromFloat(planar[ich][isample], pcm, isample * C + ich, format);
+	return count;
+}
+
+uint32_t rdsp_float_interleave_to_pcm_neon(const float* const* planar, char* pcm, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format) {
+	switch (num_channels) {
+	case 1: return interleaveNeon<1>(planar, pcm, num_samples, format);
+	case 2: return interleaveNeon<2>(planar, pcm, num_samples, format);
+	case 3: return interleaveNeon<3>(planar, pcm, num_samples, format);
+	case 4: return interleaveNeon<4>(planar, pcm, num_samples, format);
+	case 5: return interleaveNeon<5>(planar, pcm, num_samples, format);
+	case 6: return interleaveNeon<6>(planar, pcm, num_samples, format);
+	case 7: return interleaveNeon<7>(planar, pcm, num_samples, format);
+	case 8: return interleaveNeon<8>(planar, pcm, num_samples, format);
+	default: return rdsp_float_interleave_to_pcm_scalar(planar, pcm, num_samples, num_channels, format);
+	}
+}
+
+#else
+
+void rdsp_pcm_deinterleave_to_float_neon(const char* pcm, float** planar, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format) {
+	rdsp_pcm_deinterleave_to_float_scalar(pcm, planar, num_samples, num_channels, format);
+}
+
+uint32_t rdsp_float_interleave_to_pcm_neon(const float* const* planar, char* pcm, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format) {
+	return rdsp_float_interleave_to_pcm_scalar(planar, pcm, num_samples, num_channels, format);
+}
+
+#endif
+
+typedef void (*deinterleave_kernel)(const char*, float**, uint32_t, int32_t, rdsp_pcm_format);
+typedef uint32_t (*interleave_kernel)(const float* const*, char*, uint32_t, int32_t, rdsp_pcm_format);
+
+struct kernel_choice {
+	deinterleave_kernel deinterleave;
+	interleave_kernel interleave;
+	const char* name;
+};
+
+/* Picked once on first use, Advanced SIMD is optional on ARMv8-A */
+static const kernel_choice& selectKernel() {
+	static const kernel_choice choice = []() -> kernel_choice {
+#if RDSP_PCM_CONVERT_NEON
+		if (getauxval(AT_HWCAP) & HWCAP_ASIMD)
+			return { rdsp_pcm_deinterleave_to_float_neon, rdsp_float_interleave_to_pcm_neon, "neon" };
+#endif
+		return { rdsp_pcm_deinterleave_to_float_scalar, rdsp_float_interleave_to_pcm_scalar, "scalar" };
+	}();
+	return choice;
+}
+
+void rdsp_pcm_deinterleave_to_float(const char* pcm, float** planar, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format) {
+	selectKernel().deinterleave(pcm, planar, num_samples, num_channels, format);
+}
+
+uint32_t rdsp_float_interleave_to_pcm(const float* const* planar, char* pcm, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format) {
+	return selectKernel().interleave(planar, pcm, num_samples, num_channels, format);
+}
+
+const char* rdsp_pcm_convert_kernel() {
+	return selectKernel().name;
+}
@@ -0,0 +1,53 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+
+#ifndef RDSP_PCM_CONVERT_H
+#define RDSP_PCM_CONVERT_H
+
+#include <stdint.h>
+
+	/*
+	 * Interleaved PCM to planar float and back in one pass (deinterleave and
+	 * convert together), full scale is +-1.0. NEON kernels on aarch64, selected
+	 * at run time, and a scalar fallback giving bit identical results.
+	 */
+	typedef enum {
+		RDSP_PCM_FORMAT_UNKNOWN = -1,
+		RDSP_PCM_FORMAT_S16_LE,
+		RDSP_PCM_FORMAT_S24_LE,		/* 24 bits in the low 3 bytes of 32 */
+		RDSP_PCM_FORMAT_S24_3LE,	/* 24 bits packed in 3 bytes */
+		RDSP_PCM_FORMAT_S32_LE,
+		RDSP_PCM_FORMAT_FLOAT_LE,
+	} rdsp_pcm_format;
+
+#define RDSP_PCM_MAX_CHANNELS 8
+
+	/* Format from its ALSA name ("S32_LE", ...), RDSP_PCM_FORMAT_UNKNOWN when not supported */
+	rdsp_pcm_format rdsp_pcm_format_from_name(const char* name);
+
+	/* Bytes of one sample of one channel */
+	int32_t rdsp_pcm_format_size(rdsp_pcm_format format);
+
+	/* 1 to RDSP_PCM_MAX_CHANNELS channels, uses the best kernel of the CPU */
+	void rdsp_pcm_deinterleave_to_float(const char* pcm, float** planar, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format);
+
+	/* The two implementations, for tests and benchmarks. The NEON one is the scalar one unless built for aarch64. */
+	void rdsp_pcm_deinterleave_to_float_scalar(const char* pcm, float** planar, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format);
+	void rdsp_pcm_deinterleave_to_float_neon(const char* pcm, float** planar, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format);
+
+	/*
+	 * Planar float to interleaved PCM, saturating: samples out of the format's
+	 * range (after truncation toward zero) are clipped to it and counted.
+	 * Returns the number of clipped samples. FLOAT_LE is copied as is.
+	 */
+	uint32_t rdsp_float_interleave_to_pcm(const float* const* planar, char* pcm, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format);
+
+	uint32_t rdsp_float_interleave_to_pcm_scalar(const float* const* planar, char* pcm, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format);
+	uint32_t rdsp_float_interleave_to_pcm_neon(const float* const* planar, char* pcm, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format);
+
+	/* Name of the kernels the dispatching functions use: "neon" or "scalar" */
+	const char* rdsp_pcm_convert_kernel();
+
+#endif /* RDSP_PCM_CONVERT_H */
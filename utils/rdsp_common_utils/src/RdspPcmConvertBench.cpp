@@ -0,0 +1,277 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+/*
+ * Compares the PCM conversions of the AFE, input (interleaved PCM to planar
+ * float) and output (planar float to interleaved PCM):
+ *  - legacy: the former rdsp_pcm_to_float/rdsp_float_to_pcm loops (S16_LE and S32_LE only)
+ *  - scalar: the fallback of RdspPcmConvert
+ *  - neon:   the NEON kernels of RdspPcmConvert (scalar when not aarch64)
+ * for every format and 1 to 8 channels. Outputs and clip counts are checked
+ * bit exact against the scalar kernel, then cycles per sample are reported
+ * from the CPU cycle counter (perf_event_open), ns per sample when the counter
+ * is not available.
+ * Pin it to one core for stable numbers: taskset -c 2 pcm_convert_bench
+ *
+ * Usage: pcm_convert_bench [period_size] [iterations]
+ */
+#include "RdspPcmConvert.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Copy of the previous rdsp_pcm_to_float, out of line conversion included */
+float __attribute__((noinline)) legacy_int_to_float(int32_t x) {
+	return (float)x;
+}
+
+static void legacyPcmToFloat(const char* pcm, float** planar, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format) {
+	if (RDSP_PCM_FORMAT_S16_LE == format) {
+		const float scale = 3.0517578125e-05f;
+		for (int32_t ich = 0; ich < num_channels; ich++) {
+			int16_t* ptr = (int16_t*)pcm + ich;
+			for (uint32_t isample = 0; isample < num_samples; isample++, ptr += num_channels)
+				planar[ich][isample] = legacy_int_to_float(*ptr) * scale;
+		}
+	}
+	else {
+		const float scale = 4.656612873077393e-10f;
+		for (int32_t ich = 0; ich < num_channels; ich++) {
+			int32_t* ptr = (int32_t*)pcm + ich;
+			for (uint32_t isample = 0; isample < num_samples; isample++, ptr += num_channels)
+				planar[ich][isample] = legacy_int_to_float(*ptr) * scale;
+		}
+	}
+}
+
+/* Copy of the previous rdsp_float_to_pcm, not saturating */
+int32_t __attribute__((noinline)) legacy_float_to_int32(float x) {
+	return (int32_t)x;
+}
+
+int16_t __attribute__((noinline)) legacy_float_to_int16(float x) {
+	return (int16_t)x;
+}
+
+static uint32_t legacyFloatToPcm(const float* const* planar, char* pcm, uint32_t num_samples, int32_t num_channels, rdsp_pcm_format format) {
+	if (RDSP_PCM_FORMAT_S16_LE == format) {
+		const float scale = 32768.0f;
+		int16_t* ptr = (int16_t*)pcm;
+		for (uint32_t isample = 0; isample < num_samples; isample++)
+			for (int32_t ich = 0; ich < num_channels; ich++, ptr++)
+				*ptr = legacy_float_to_int16(planar[ich][isample] * scale);
+	}
+	else {
+		const float scale = 32768.0f * 65536.0f;
+		int32_t* ptr = (int32_t*)pcm;
+		for (uint32_t isample = 0; isample < num_samples; isample++)
+			for (int32_t ich = 0; ich < num_channels; ich++, ptr++)
+				*ptr = legacy_float_to_int32(planar[ich][isample] * scale);
+	}
+	return 0;
+}
+
+typedef void (*convert_kernel)(const char*, float**, uint32_t, int32_t, rdsp_pcm_format);
+typedef uint32_t (*output_kernel)(const float* const*, char*, uint32_t, int32_t, rdsp_pcm_format);
+
+static int openCycleCounter() {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Cost per converted sample (all channels counted), cycles when cycles_fd is valid */
+static double measure(convert_kernel kernel, int cycles_fd, const char* pcm, float** planar, uint32_t period_size, int32_t channels, rdsp_pcm_format format, int iterations) {
+	for (int i = 0; i < iterations / 10 + 1; i++)
+		kernel(pcm, planar, period_size, channels, format);
+
+	uint64_t start = nowNs();
+	if (cycles_fd >= 0) {
+		ioctl(cycles_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(cycles_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	for (int i = 0; i < iterations; i++)
+		kernel(pcm, planar, period_size, channels, format);
+	uint64_t elapsed = nowNs() - start;
+	if (cycles_fd >= 0) {
+		ioctl(cycles_fd, PERF_EVENT_IOC_DISABLE, 0);
+		uint64_t cycles = 0;
+		if (sizeof(cycles) == read(cycles_fd, &cycles, sizeof(cycles)))
+			elapsed = cycles;
+	}
+	return (double)elapsed / ((double)iterations * period_size * channels);
+}
+
+static double measureOutput(output_kernel kernel, int cycles_fd, float** planar, char* pcm, uint32_t period_size, int32_t channels, rdsp_pcm_format format, int iterations) {
+	for (int i = 0; i < iterations / 10 + 1; i++)
+		kernel(planar, pcm, period_size, channels, format);
+
+	uint64_t start = nowNs();
+	if (cycles_fd >= 0) {
+		ioctl(cycles_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(cycles_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	for (int i = 0; i < iterations; i++)
+		kernel(planar, pcm, period_size, channels, format);
+	uint64_t elapsed = nowNs() - start;
+	if (cycles_fd >= 0) {
+		ioctl(cycles_fd, PERF_EVENT_IOC_DISABLE, 0);
+		uint64_t cycles = 0;
+		if (sizeof(cycles) == read(cycles_fd, &cycles, sizeof(cycles)))
+			elapsed = cycles;
+	}
+	return (double)elapsed / ((double)iterations * period_size * channels);
+}
+
+static bool sameOutput(float** a, float** b, uint32_t period_size, int32_t channels) {
+	for (int32_t ich = 0; ich < channels; ich++)
+		if (memcmp(a[ich], b[ich], period_size * sizeof(float)))
+			return false;
+	return true;
+}
+
+int main(int argc, char** argv) {
+	uint32_t period_size = (argc > 1) ? atoi(argv[1]) : 2048;
+	int iterations = (argc > 2) ? atoi(argv[2]) : 2000;
+	const rdsp_pcm_format formats[] = { RDSP_PCM_FORMAT_S16_LE, RDSP_PCM_FORMAT_S24_LE, RDSP_PCM_FORMAT_S24_3LE, RDSP_PCM_FORMAT_S32_LE, RDSP_PCM_FORMAT_FLOAT_LE };
+	const char* format_names[] = { "S16_LE", "S24_LE", "S24_3LE", "S32_LE", "FLOAT_LE" };
+	const int format_count = sizeof(formats) / sizeof(formats[0]);
+
+	int cycles_fd = openCycleCounter();
+	printf("Period %u samples, %d iterations, dispatch uses the %s kernel, cost in %s per sample\n",
+		period_size, iterations, rdsp_pcm_convert_kernel(), (cycles_fd >= 0) ? "cycles" : "ns");
+
+	std::vector<char> pcm(period_size * RDSP_PCM_MAX_CHANNELS * 4);
+	srand(1);
+	for (size_t i = 0; i < pcm.size(); i++)
+		pcm[i] = (char)rand();
+
+	std::vector<float> storage[2];
+	float* planar[2][RDSP_PCM_MAX_CHANNELS];
+	for (int k = 0; k < 2; k++) {
+		storage[k].resize(period_size * RDSP_PCM_MAX_CHANNELS);
+		for (int ich = 0; ich < RDSP_PCM_MAX_CHANNELS; ich++)
+			planar[k][ich] = &storage[k][ich * period_size];
+	}
+
+	/* Random bytes give NaN and Inf for FLOAT_LE, make those samples plain floats */
+	std::vector<char> pcm_float(pcm.size());
+	for (size_t i = 0; i < pcm.size() / 4; i++) {
+		float value = (float)(rand() - RAND_MAX / 2) / RAND_MAX;
+		memcpy(&pcm_float[i * 4], &value, 4);
+	}
+
+	int failures = 0;
+	printf("Input, PCM to float\n%-9s %3s %9s %9s %9s %9s\n", "format", "ch", "legacy", "scalar", "neon", "speedup");
+	for (int f = 0; f < format_count; f++) {
+		const char* input = (RDSP_PCM_FORMAT_FLOAT_LE == formats[f]) ? pcm_float.data() : pcm.data();
+		const bool has_legacy = (RDSP_PCM_FORMAT_S16_LE == formats[f] || RDSP_PCM_FORMAT_S32_LE == formats[f]);
+		for (int32_t channels = 1; channels <= RDSP_PCM_MAX_CHANNELS; channels++) {
+			/* Odd sizes reach the tails of the NEON kernels */
+			for (uint32_t size = 1; size < 12; size++) {
+				rdsp_pcm_deinterleave_to_float_scalar(input, planar[0], size, channels, formats[f]);
+				rdsp_pcm_deinterleave_to_float_neon(input, planar[1], size, channels, formats[f]);
+				if (!sameOutput(planar[0], planar[1], size, channels))
+					failures++;
+			}
+			rdsp_pcm_deinterleave_to_float_scalar(input, planar[0], period_size, channels, formats[f]);
+			rdsp_pcm_deinterleave_to_float_neon(input, planar[1], period_size, channels, formats[f]);
+			bool exact = sameOutput(planar[0], planar[1], period_size, channels);
+			if (has_legacy) {
+				legacyPcmToFloat(input, planar[1], period_size, channels, formats[f]);
+				exact = exact && sameOutput(planar[0], planar[1], period_size, channels);
+			}
+			if (!exact)
+				failures++;
+
+			double legacy = has_legacy ? measure(legacyPcmToFloat, cycles_fd, input, planar[0], period_size, channels, formats[f], iterations) : 0.0;
+			double scalar = measure(rdsp_pcm_deinterleave_to_float_scalar, cycles_fd, input, planar[0], period_size, channels, formats[f], iterations);
+			double neon = measure(rdsp_pcm_deinterleave_to_float_neon, cycles_fd, input, planar[0], period_size, channels, formats[f], iterations);
+			if (has_legacy)
+				printf("%-9s %3d %9.3f %9.3f %9.3f %8.2fx%s\n", format_names[f], channels, legacy, scalar, neon, legacy / neon, exact ? "" : "  MISMATCH");
+			else
+				printf("%-9s %3d %9s %9.3f %9.3f %8.2fx%s\n", format_names[f], channels, "-", scalar, neon, scalar / neon, exact ? "" : "  MISMATCH");
+		}
+	}
+
+	/* Output: full scale sine like values, then the same with peaks over full scale */
+	std::vector<float> source(period_size * RDSP_PCM_MAX_CHANNELS);
+	std::vector<float> loud(source.size());
+	for (size_t i = 0; i < source.size(); i++) {
+		source[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+		loud[i] = source[i] * 1.25f;
+	}
+	loud[0] = 1.0f;
+	loud[1] = -1.0f;
+	loud[2] = 1e10f;
+	loud[3] = -1e10f;
+	float* source_planar[RDSP_PCM_MAX_CHANNELS];
+	float* loud_planar[RDSP_PCM_MAX_CHANNELS];
+	for (int ich = 0; ich < RDSP_PCM_MAX_CHANNELS; ich++) {
+		source_planar[ich] = &source[ich * period_size];
+		loud_planar[ich] = &loud[ich * period_size];
+	}
+	std::vector<char> out[2];
+	for (int k = 0; k < 2; k++)
+		out[k].resize(period_size * RDSP_PCM_MAX_CHANNELS * 4);
+
+	printf("Output, float to PCM (saturating)\n%-9s %3s %9s %9s %9s %9s %9s\n", "format", "ch", "legacy", "scalar", "neon", "speedup", "clipped");
+	for (int f = 0; f < format_count; f++) {
+		const bool has_legacy = (RDSP_PCM_FORMAT_S16_LE == formats[f] || RDSP_PCM_FORMAT_S32_LE == formats[f]);
+		for (int32_t channels = 1; channels <= RDSP_PCM_MAX_CHANNELS; channels++) {
+			const size_t bytes = (size_t)period_size * channels * rdsp_pcm_format_size(formats[f]);
+			bool exact = true;
+			uint32_t clipped = 0;
+			for (uint32_t size = 1; size < 12; size++) {
+				uint32_t a = rdsp_float_interleave_to_pcm_scalar(loud_planar, out[0].data(), size, channels, formats[f]);
+				uint32_t b = rdsp_float_interleave_to_pcm_neon(loud_planar, out[1].data(), size, channels, formats[f]);
+				exact = exact && (a == b) && !memcmp(out[0].data(), out[1].data(), (size_t)size * channels * rdsp_pcm_format_size(formats[f]));
+			}
+			clipped = rdsp_float_interleave_to_pcm_scalar(loud_planar, out[0].data(), period_size, channels, formats[f]);
+			exact = exact && (clipped == rdsp_float_interleave_to_pcm_neon(loud_planar, out[1].data(), period_size, channels, formats[f]));
+			exact = exact && !memcmp(out[0].data(), out[1].data(), bytes);
+
+			/* Below full scale the saturating kernels match the former loop */
+			rdsp_float_interleave_to_pcm_neon(source_planar, out[0].data(), period_size, channels, formats[f]);
+			if (has_legacy) {
+				legacyFloatToPcm(source_planar, out[1].data(), period_size, channels, formats[f]);
+				exact = exact && !memcmp(out[0].data(), out[1].data(), bytes);
+			}
+			if (!exact)
+				failures++;
+
+			double legacy = has_legacy ? measureOutput(legacyFloatToPcm, cycles_fd, source_planar, out[0].data(), period_size, channels, formats[f], iterations) : 0.0;
+			double scalar = measureOutput(rdsp_float_interleave_to_pcm_scalar, cycles_fd, source_planar, out[0].data(), period_size, channels, formats[f], iterations);
+			double neon = measureOutput(rdsp_float_interleave_to_pcm_neon, cycles_fd, source_planar, out[0].data(), period_size, channels, formats[f], iterations);
+			if (has_legacy)
+				printf("%-9s %3d %9.3f %9.3f %9.3f %8.2fx %9u%s\n", format_names[f], channels, legacy, scalar, neon, legacy / neon, clipped, exact ? "" : "  MISMATCH");
+			else
+				printf("%-9s %3d %9s %9.3f %9.3f %8.2fx %9u%s\n", format_names[f], channels, "-", scalar, neon, scalar / neon, clipped, exact ? "" : "  MISMATCH");
+		}
+	}
+
+	if (cycles_fd >= 0)
+		close(cycles_fd);
+	printf("%s\n", failures ? "Outputs differ" : "All outputs bit exact");
+	return failures ? 1 : 0;
+}
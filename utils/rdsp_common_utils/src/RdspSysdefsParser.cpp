@@ -0,0 +1,166 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+
+#include "RdspSysdefsParser.h"
+#include "libVoiceSeekerLight.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/* Value of attribute Aname in the tag [Atag, Aend), false when the tag has none */
+static bool sysdefs_attribute(const std::string& Atext, size_t Atag, size_t Aend, const char* Aname, std::string& Avalue) {
+	const std::string key = std::string(Aname) + "=\"";
+	size_t start = Atag;
+	do {
+		start = Atext.find(key, start + 1);
+		if (std::string::npos == start || start >= Aend)
+			return false;
+	} while (NULL == strchr(" \t\r\n", Atext[start - 1]));
+	const size_t first = start + key.size();
+	const size_t last = Atext.find('"', first);
+	if (std::string::npos == last || last > Aend)
+		return false;
+	Avalue = Atext.substr(first, last - first);
+	return true;
+}
+
+/* Whole string as an unsigned number (decimal or 0x...) */
+static bool sysdefs_number(const std::string& Avalue, uint32_t* Anumber) {
+	char* end = NULL;
+	const unsigned long number = strtoul(Avalue.c_str(), &end, 0);
+	if (Avalue.empty() || '\0' != *end)
+		return false;
+	*Anumber = (uint32_t)number;
+	return true;
+}
+
+/* Next tag named Aname from Apos on, comments are skipped. npos when there is none. */
+static size_t sysdefs_find_tag(const std::string& Atext, size_t Apos, const char* Aname) {
+	const std::string open = std::string("<") + Aname;
+	while (true) {
+		const size_t tag = Atext.find(open, Apos);
+		const size_t comment = Atext.find("<!--", Apos);
+		if (std::string::npos == comment || tag < comment)
+			return tag;
+		Apos = Atext.find("-->", comment);
+		if (std::string::npos == Apos)
+			return std::string::npos;
+		Apos += 3;
+	}
+}
+
+int32_t parse_user_sysdefs_xml(const char* Auser_sysdefs_fn, uint32_t* Achecksum, uint32_t* Awords, int32_t Amax_words) {
+	FILE* file = fopen(Auser_sysdefs_fn, "rb");
+	if (file == NULL) {
+		printf("Error: cannot open sysdefs file %s\n", Auser_sysdefs_fn);
+		return -1;
+	}
+	std::string text;
+	char chunk[4096];
+	size_t count;
+	while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		text.append(chunk, count);
+	fclose(file);
+
+	*Achecksum = 0;
+	const size_t root = sysdefs_find_tag(text, 0, "sysdefs");
+	if (std::string::npos == root) {
+		printf("Error: %s has no <sysdefs> element\n", Auser_sysdefs_fn);
+		return -1;
+	}
+	std::string value;
+	const size_t root_end = text.find('>', root);
+	if (sysdefs_attribute(text, root, root_end, "checksum", value) && !sysdefs_number(value, Achecksum)) {
+		printf("Error: %s: invalid checksum \"%s\"\n", Auser_sysdefs_fn, value.c_str());
+		return -1;
+	}
+
+	int32_t words = 0;
+	size_t pos = root_end;
+	while (std::string::npos != (pos = sysdefs_find_tag(text, pos, "param"))) {
+		const size_t tag_end = text.find('>', pos);
+		const size_t close = (std::string::npos != tag_end) ? text.find("</param>", tag_end) : std::string::npos;
+		if (std::string::npos == close) {
+			printf("Error: %s: unterminated <param> at byte %zu\n", Auser_sysdefs_fn, pos);
+			return -1;
+		}
+
+		std::string name = "?";
+		sysdefs_attribute(text, pos, tag_end, "name", name);
+		uint32_t id = 0;
+		uint32_t length = 0;
+		if (!sysdefs_attribute(text, pos, tag_end, "id", value) || !sysdefs_number(value, &id) ||
+			!sysdefs_attribute(text, pos, tag_end, "length", value) || !sysdefs_number(value, &length) || 0 == length) {
+			printf("Error: %s: parameter %s needs an id and a length\n", Auser_sysdefs_fn, name.c_str());
+			return -1;
+		}
+		const bool integer = sysdefs_attribute(text, pos, tag_end, "type", value) && value == "int";
+		if ((int64_t)words + 2 + length > Amax_words) {
+			printf("Error: %s: more than %d words of parameters\n", Auser_sysdefs_fn, Amax_words);
+			return -1;
+		}
+		Awords[words++] = id;
+		Awords[words++] = length;
+
+		/* Values up to the closing tag */
+		uint32_t values = 0;
+		const std::string content = text.substr(tag_end + 1, close - tag_end - 1);
+		const char* next = content.c_str();
+		while (true) {
+			next += strspn(next, " \t\r\n,");
+			if ('\0' == *next)
+				break;
+			char* end = NULL;
+			uint32_t word;
+			if ('0' == next[0] && ('x' == next[1] || 'X' == next[1]))
+				word = (uint32_t)strtoul(next, &end, 16);
+			else if (integer)
+				word = (uint32_t)(int32_t)strtol(next, &end, 10);
+			else {
+				const float number = strtof(next, &end);
+				memcpy(&word, &number, sizeof(word));
+			}
+			if (end == next || ('\0' != *end && NULL == strchr(" \t\r\n,", *end))) {
+				printf("Error: %s: parameter %s has an invalid value\n", Auser_sysdefs_fn, name.c_str());
+				return -1;
+			}
+			if (values < length)
+				Awords[words + values] = word;
+			values++;
+			next = end;
+		}
+		if (values != length) {
+			printf("Error: %s: parameter %s has %u values, its length is %u\n", Auser_sysdefs_fn, name.c_str(), values, length);
+			return -1;
+		}
+		words += length;
+		pos = close;
+	}
+	return words;
+}
+
+void load_user_sysdefs_xml(RETUNE_VOICESEEKERLIGHT_plugin_t* APluginInit, const char* Auser_sysdefs_fn) {
+	std::vector<uint32_t> words(RDSP_SYSDEFS_MAX_WORDS);
+	uint32_t checksum = 0;
+	const int32_t count = parse_user_sysdefs_xml(Auser_sysdefs_fn, &checksum, words.data(), (int32_t)words.size());
+	if (count < 0)
+		return;
+	if (checksum != APluginInit->sysdefs_checksum) {
+		printf("Error: %s was made for sysdefs 0x%08X, the library has 0x%08X\n", Auser_sysdefs_fn, checksum, APluginInit->sysdefs_checksum);
+		return;
+	}
+
+	uint32_t parameters = 0;
+	for (int32_t i = 0; i < count; i += 2 + words[i + 1]) {
+		if (OK != VoiceSeekerLight_SetParameterID(APluginInit, words[i], words[i + 1], &words[i + 2]))
+			printf("Error: %s: unknown parameter id %u\n", Auser_sysdefs_fn, words[i]);
+		else
+			parameters++;
+	}
+	printf("User sysdefs %s: %u parameters set\n", Auser_sysdefs_fn, parameters);
+}
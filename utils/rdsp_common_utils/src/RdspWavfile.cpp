@@ -257,6 +257,10 @@ RDSP_STATIC size_t rdsp_wav_read_float(float** Abuffer, uint32_t Anum_samples, r
 }
 
 RDSP_STATIC rdsp_wav_file_t rdsp_wav_write_open(const char* Afilename, uint32_t Asample_rate, uint16_t Anum_channels, uint16_t Abit_depth, WaveFormat Aformat) {
+	return rdsp_wav_write_open_buffered(Afilename, Asample_rate, Anum_channels, Abit_depth, Aformat, 0);
+}
+
+RDSP_STATIC rdsp_wav_file_t rdsp_wav_write_open_buffered(const char* Afilename, uint32_t Asample_rate, uint16_t Anum_channels, uint16_t Abit_depth, WaveFormat Aformat, size_t Abuffer_size) {
 	if ((Aformat != WAVE_FORMAT_PCM) && (Aformat != WAVE_FORMAT_IEEE_FLOAT)) {
 		printf("Only 16/32 bit integer wav files and 32 bit float wav files are supported.\n");
 	}
@@ -264,6 +268,9 @@ RDSP_STATIC rdsp_wav_file_t rdsp_wav_write_open(const char* Afilename, uint32_t
 	rdsp_wav_file_t wav_file = { 0 };
 	FILE* fid = fopen(Afilename, "wb+");
 	if (fid) {
+		// The buffer must be set before the first write, the header is written below
+		if (Abuffer_size > 0)
+			setvbuf(fid, NULL, _IOFBF, Abuffer_size);
 		wav_file.fid = fid;
 		wav_file.num_read = 0;
 
@@ -381,6 +388,11 @@ RDSP_STATIC void update_chunk_size(uint32_t Anum_samples, rdsp_wav_file_t* Awav_
 	fseek(fid, 0L, SEEK_END);
 }
 
+RDSP_STATIC void rdsp_wav_update_size(uint32_t Anum_samples, rdsp_wav_file_t* Awav_file) {
+	if (Awav_file->fid != NULL && Anum_samples > 0)
+		update_chunk_size(Anum_samples, Awav_file);
+}
+
 
 RDSP_STATIC size_t rdsp_wav_write_int16(int16_t** Abuffer, uint32_t Anum_samples, rdsp_wav_file_t* Awav_file) {
 	if (Anum_samples <= 0)
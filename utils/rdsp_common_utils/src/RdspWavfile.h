@@ -99,6 +99,8 @@ RDSP_STATIC size_t rdsp_wav_read_int32(int32_t** Abuffer, uint32_t Anum_samples,
 RDSP_STATIC size_t rdsp_wav_read_float(float** Abuffer, uint32_t Anum_samples, rdsp_wav_file_t* Awav_file);
 
 RDSP_STATIC rdsp_wav_file_t rdsp_wav_write_open(const char* Afilename, uint32_t Asample_rate, uint16_t Anum_channels, uint16_t Abit_depth, WaveFormat Aformat);
+// As rdsp_wav_write_open, with a stdio buffer of Abuffer_size bytes (0 = stdio default)
+RDSP_STATIC rdsp_wav_file_t rdsp_wav_write_open_buffered(const char* Afilename, uint32_t Asample_rate, uint16_t Anum_channels, uint16_t Abit_depth, WaveFormat Aformat, size_t Abuffer_size);
 RDSP_STATIC size_t rdsp_wav_write_int16(int16_t** Abuffer, uint32_t Anum_samples, rdsp_wav_file_t* Awav_file);
 RDSP_STATIC size_t rdsp_wav_write_int32(int32_t** Abuffer, uint32_t Anum_samples, rdsp_wav_file_t* Awav_file);
 RDSP_STATIC size_t rdsp_wav_write_interleaved_int32(
@@ -106,6 +108,8 @@ RDSP_STATIC size_t rdsp_wav_write_interleaved_int32(
     uint32_t Anum_samples,
     rdsp_wav_file_t* Awav_file);
 RDSP_STATIC size_t rdsp_wav_write_float(float** Abuffer, uint32_t Anum_samples, rdsp_wav_file_t* Awav_file);
+// Adds Anum_samples to the sizes in the header, for writers appending to fid themselves and patching the header once
+RDSP_STATIC void rdsp_wav_update_size(uint32_t Anum_samples, rdsp_wav_file_t* Awav_file);
 
 RDSP_STATIC void rdsp_wav_close(rdsp_wav_file_t* Awav_file);
 
@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include <vector>
 #include <cstdint>
+#include <cstddef>
 
 #ifndef __SignalProcessor__SignalProcessorImplementation_h__
 #define __SignalProcessor__SignalProcessorImplementation_h__
@@ -16,6 +17,32 @@ namespace SignalProcessor
     #define GET_MINOR_VERSION(version)      (uint32_t)((0x00FF0000u & version) >> 16u)
     #define GET_PATCH_VERSION(version)      (uint32_t)((0x0000FF00u & version) >> 8u)
 
+    #define SIGNAL_PROCESSOR_INTERFACE_VERSION      2           //Version of this interface, see getInterfaceVersion
+
+    #define SIGNAL_PROCESSOR_CAP_PCM_INTERLEAVED    (1u << 0)   //processSignal
+    #define SIGNAL_PROCESSOR_CAP_PCM_HOP            (1u << 1)   //processHop
+    #define SIGNAL_PROCESSOR_CAP_FLOAT_PLANAR       (1u << 2)   //processSignalFloat
+    #define SIGNAL_PROCESSOR_CAP_FLOAT_HOP          (1u << 3)   //processHopFloat
+
+    /**
+     * @brief Non-interleaved float samples of an input, one pointer per channel.
+     * @details Samples are full scale at -1.0 .. 1.0, every channel holds frames samples.
+     */
+    typedef struct const_float_span {
+        const float* const* channels;
+        size_t channelsCount;
+        size_t frames;
+    } const_float_span;
+
+    /**
+     * @brief Non-interleaved float samples of an output, one pointer per channel.
+     */
+    typedef struct float_span {
+        float* const* channels;
+        size_t channelsCount;
+        size_t frames;
+    } float_span;
+
     class SignalProcessorImplementation
     {
         public:
@@ -172,6 +199,105 @@ namespace SignalProcessor
              *  @details A default settings should be set with this function.
              */
             virtual void setDefaultSettings(void) = 0;
+
+        public:
+            //Added after version 1: appended, so the vtable slots of the functions above stay where they were
+            /**
+             * @brief This function should return the number of frames processHop consumes and produces.
+             *
+             * @retval Hop size in frames.
+             * @retval -1 = processHop is not supported
+             */
+            virtual int
+            getHopSize(void) const { return -1; };
+            /**
+             * @details Streaming alternative to processSignal for hosts running their own scheduler.
+             * Consumes exactly one hop (getHopSize() frames) of microphone and reference signal and
+             * provides one hop of clean microphone signal, without waiting for the rest of a period.\n
+             * The first call of processSignal or processHop after openProcessor selects the entry
+             * point, the other one returns error until the signal processor is reopened.
+             *
+             * @param[in] nChannelMicHop Array of N-channels microphone signal, one hop. The sample format depends on the underlying implementation.
+             * @param[in] micHopSize Microphone array size in bytes
+             * @param[in] nChannelRefHop Array of N-channels reference signal, one hop. The sample format depends on the underlying implementation.
+             * @param[in] refHopSize Reference array size in bytes
+             * @param[out] cleanMicHop Array of samples representing a filtered single microphone channel, one hop.
+             * @param[in] cleanMicHopSize Microphone output array size in bytes.
+             *
+             * @retval 0 = ok
+             * @retval negative = error, or processHop is not supported
+             */
+            virtual int
+            processHop(
+                const char* nChannelMicHop, size_t micHopSize,
+                const char* nChannelRefHop, size_t refHopSize,
+                char* cleanMicHop, size_t cleanMicHopSize) { return -1; };
+            /**
+             * @brief This function should return the latency the signal processor adds to the clean microphone signal.
+             * @details Output sample n of the entry point in use (processHop once it was called, processSignal
+             * otherwise) corresponds to input sample n - latency, not counting the processing delay of the
+             * algorithm itself.
+             *
+             * @retval Latency in frames.
+             * @retval -1 = unknown
+             *
+             * @warning The function should be invoked after the signal processor has been opened.
+             */
+            virtual int
+            getLatency(void) const { return -1; };
+            //Added with interface version 2, after the functions above for the same reason
+            /**
+             * @brief This function should return the version of this interface the signal processor implements.
+             * @details Version 1 has the interleaved sample format entry points only (processSignal, processHop).
+             * Version 2 adds the float entry points, which of them are supported is told by getCapabilities.\n
+             * The JSON configuration of a version 2 implementation holds the same as "interface_version" and
+             * "capabilities", so a host can negotiate before loading more than the description.
+             *
+             * @retval Interface version, 1 or SIGNAL_PROCESSOR_INTERFACE_VERSION
+             */
+            virtual int
+            getInterfaceVersion(void) const { return 1; };
+            /**
+             * @brief This function should return the entry points the signal processor supports.
+             *
+             * @retval SIGNAL_PROCESSOR_CAP_* flags
+             */
+            virtual uint32_t
+            getCapabilities(void) const { return SIGNAL_PROCESSOR_CAP_PCM_INTERLEAVED; };
+            /**
+             * @details Float alternative to processSignal for hosts which already have non-interleaved
+             * float samples (other float DSP before or after the signal processor): the buffers are
+             * used as they are, nothing is converted from or to the sample format.\n
+             * The signal processor must have been opened with "interface_version" 2 in its settings, it
+             * then takes the float entry points only. As for processSignal and processHop, the first call
+             * selects processSignalFloat or processHopFloat until the signal processor is reopened.
+             *
+             * @param[in] nChannelMic Microphone channels, getPeriodSize() frames each
+             * @param[in] nChannelRef Reference channels, getPeriodSize() frames each
+             * @param[out] cleanMic One channel of filtered microphone signal, as many frames as processSignal provides
+             *
+             * @retval 0 = ok
+             * @retval negative = error, or the float entry points are not supported
+             */
+            virtual int
+            processSignalFloat(
+                const const_float_span& nChannelMic,
+                const const_float_span& nChannelRef,
+                const float_span& cleanMic) { return -1; };
+            /**
+             * @details Float alternative to processHop, one hop (getHopSize() frames) of microphone and
+             * reference signal in, one hop of clean microphone signal out.
+             *
+             * @see processSignalFloat
+             *
+             * @retval 0 = ok
+             * @retval negative = error, or the float entry points are not supported
+             */
+            virtual int
+            processHopFloat(
+                const const_float_span& nChannelMicHop,
+                const const_float_span& nChannelRefHop,
+                const float_span& cleanMicHop) { return -1; };
     };
 }
 #endif
@@ -42,20 +42,31 @@
 #include <stdio.h>
 #endif
 
-static uint32_t extmem_analysis_mode_flag = 0;
-
-static void* ext_mem_baseptr;
-static void* ext_mem_nextptr;
-static size_t ext_mem_size_bytes;
-static size_t ext_mem_bytes_left;
-static size_t ext_mem_bytes_used;
-
-static void* ext_mem_scratch_baseptr;
-static void* ext_mem_scratch_nextptr;
-static size_t ext_mem_scratch_size_bytes;
-static size_t ext_mem_scratch_bytes_left;
-static size_t ext_mem_scratch_bytes_used;
-static size_t ext_mem_scratch_max_bytes_used;
+/*
+ * The allocator state is per thread: several plugin instances may run on
+ * different threads, each one points the scratch at its own memory
+ * (rdsp_plugin_scratch_init) before it processes.
+ */
+#ifdef _WIN32
+#define RDSP_MEMORY_UTILS_THREAD_LOCAL __declspec(thread)
+#else
+#define RDSP_MEMORY_UTILS_THREAD_LOCAL __thread
+#endif
+
+static RDSP_MEMORY_UTILS_THREAD_LOCAL uint32_t extmem_analysis_mode_flag = 0;
+
+static RDSP_MEMORY_UTILS_THREAD_LOCAL void* ext_mem_baseptr;
+static RDSP_MEMORY_UTILS_THREAD_LOCAL void* ext_mem_nextptr;
+static RDSP_MEMORY_UTILS_THREAD_LOCAL size_t ext_mem_size_bytes;
+static RDSP_MEMORY_UTILS_THREAD_LOCAL size_t ext_mem_bytes_left;
+static RDSP_MEMORY_UTILS_THREAD_LOCAL size_t ext_mem_bytes_used;
+
+static RDSP_MEMORY_UTILS_THREAD_LOCAL void* ext_mem_scratch_baseptr;
+static RDSP_MEMORY_UTILS_THREAD_LOCAL void* ext_mem_scratch_nextptr;
+static RDSP_MEMORY_UTILS_THREAD_LOCAL size_t ext_mem_scratch_size_bytes;
+static RDSP_MEMORY_UTILS_THREAD_LOCAL size_t ext_mem_scratch_bytes_left;
+static RDSP_MEMORY_UTILS_THREAD_LOCAL size_t ext_mem_scratch_bytes_used;
+static RDSP_MEMORY_UTILS_THREAD_LOCAL size_t ext_mem_scratch_max_bytes_used;
 
 uint32_t rdsp_plugin_get_heapmem_analysis_flag(void) {
 	return extmem_analysis_mode_flag;
@@ -0,0 +1,195 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include "ReferenceDelayTracker.h"
+
+#include <AFERtThread.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace SignalProcessor {
+
+	ReferenceDelayTracker::ReferenceDelayTracker() : config{ 0 }, staging_fill{ 0 }, capture_on{ false }, overrun{ false },
+		target{ 0 }, latest_delay{ -1 }, latest_confidence{ 0.0f }, stopping{ false }, candidate{ -1 } {
+	}
+
+	ReferenceDelayTracker::~ReferenceDelayTracker() {
+		stop();
+	}
+
+	int32_t ReferenceDelayTracker::start(const delay_tracker_config& config, int32_t initial_delay) {
+		stop();
+
+		if (0 != aligner.init(config.max_delay)) {
+			printf("Reference delay tracker: cannot allocate the aligner for %d samples\n", config.max_delay);
+			return -1;
+		}
+
+		this->config = config;
+		staging_fill = 0;
+		capture_on.store(false);
+		overrun.store(false);
+		target.store(initial_delay);
+		latest_delay.store(-1);
+		latest_confidence.store(0.0f);
+		candidate = -1;
+		stopping = false;
+		worker = std::thread(&ReferenceDelayTracker::run, this);
+		return 0;
+	}
+
+	void ReferenceDelayTracker::stop() {
+		if (!worker.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+		capture_on.store(false);
+		aligner.destroy();
+	}
+
+	bool ReferenceDelayTracker::running() const {
+		return worker.joinable();
+	}
+
+	bool ReferenceDelayTracker::capturing() const {
+		return capture_on.load(std::memory_order_relaxed);
+	}
+
+	void ReferenceDelayTracker::feed(const float* reference, const float* capture, int32_t length) {
+		if (!capture_on.load(std::memory_order_acquire)) {
+			staging_fill = 0;
+			return;
+		}
+
+		while (length > 0) {
+			int32_t count = REF_DELAY_TRACKER_BLOCK - staging_fill;
+			if (count > length)
+				count = length;
+			memcpy(staging.reference + staging_fill, reference, sizeof(float) * count);
+			memcpy(staging.capture + staging_fill, capture, sizeof(float) * count);
+			staging_fill += count;
+			reference += count;
+			capture += count;
+			length -= count;
+
+			if (REF_DELAY_TRACKER_BLOCK == staging_fill) {
+				//The streams lost samples, the tracker starts the measurement over
+				if (!queue.push(staging))
+					overrun.store(true);
+				staging_fill = 0;
+			}
+		}
+	}
+
+	int32_t ReferenceDelayTracker::targetDelay() const {
+		return target.load(std::memory_order_relaxed);
+	}
+
+	int32_t ReferenceDelayTracker::estimate() const {
+		return latest_delay.load();
+	}
+
+	float ReferenceDelayTracker::confidence() const {
+		return latest_confidence.load();
+	}
+
+	//Sleeps ms unless stopped, returns false when stopped
+	bool ReferenceDelayTracker::waitInterval(uint32_t ms) {
+		std::unique_lock<std::mutex> guard(lock);
+		return !wake.wait_for(guard, std::chrono::milliseconds(ms), [this] { return stopping; });
+	}
+
+	void ReferenceDelayTracker::run() {
+		//A background job, SCHED_OTHER unless configured otherwise
+		AFERt::applyThreadConfig("afe_delay", AFERt::threadConfigFromConfig("RefDelayTracker"));
+
+		while (waitInterval(config.interval_ms)) {
+			int32_t delay;
+			float confidence;
+			if (measure(delay, confidence))
+				decide(delay, confidence);
+			else
+				printf("Reference delay tracker: no estimate (silent reference or low confidence), keeping %d samples\n", target.load());
+		}
+	}
+
+	//One burst, true when two consecutive estimates agreed with enough confidence
+	bool ReferenceDelayTracker::measure(int32_t& delay, float& confidence) {
+		block item;
+		int32_t stable = 0;
+
+		delay = 0;
+		confidence = 0.0f;
+		aligner.reset();
+		while (queue.pop(item))
+			;
+		overrun.store(false);
+		capture_on.store(true, std::memory_order_release);
+
+		const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(config.burst_ms);
+		while (std::chrono::steady_clock::now() < end) {
+			if (!queue.pop(item)) {
+				if (!waitInterval(10))
+					break;
+				continue;
+			}
+
+			if (overrun.exchange(false)) {
+				aligner.reset();
+				stable = 0;
+			}
+
+			if (!aligner.process(item.reference, item.capture, REF_DELAY_TRACKER_BLOCK))
+				continue;
+
+			const AFERt::alignment_estimate& e = aligner.estimate();
+			if (e.confidence < config.min_confidence) {
+				stable = 0;
+				continue;
+			}
+			stable = (stable > 0 && abs(e.delay - delay) <= 1) ? stable + 1 : 1;
+			delay = e.delay;
+			confidence = e.confidence;
+		}
+
+		capture_on.store(false);
+		return stable >= 2;
+	}
+
+	void ReferenceDelayTracker::decide(int32_t delay, float confidence) {
+		latest_delay.store(delay);
+		latest_confidence.store(confidence);
+
+		int32_t wanted = delay - config.margin;
+		if (wanted < 0)
+			wanted = 0;
+		if (wanted > config.max_delay)
+			wanted = config.max_delay;
+
+		const int32_t applied = target.load();
+		if (abs(wanted - applied) <= config.hysteresis) {
+			candidate = -1;
+			printf("Reference delay tracker: estimate %d samples (confidence %.2f), keeping %d samples\n", delay, confidence, applied);
+			return;
+		}
+
+		if (candidate >= 0 && abs(wanted - candidate) <= REF_DELAY_TRACKER_CONFIRM) {
+			target.store(wanted);
+			candidate = -1;
+			printf("Reference delay tracker: estimate %d samples (confidence %.2f), retuning %d -> %d samples\n", delay, confidence, applied, wanted);
+			return;
+		}
+
+		candidate = wanted;
+		printf("Reference delay tracker: estimate %d samples (confidence %.2f), %d samples waits for confirmation\n", delay, confidence, wanted);
+	}
+}
@@ -0,0 +1,97 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#ifndef __ReferenceDelayTracker_h__
+#define __ReferenceDelayTracker_h__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <AFESpscRing.h>
+#include <AFEStreamAligner.h>
+
+#define REF_DELAY_TRACKER_BLOCK 256			// Samples per block handed from the audio thread
+#define REF_DELAY_TRACKER_QUEUE 64			// Blocks queued to the tracker thread (1 s at 16 kHz)
+#define REF_DELAY_TRACKER_CONFIRM 2			// Samples two measurements may differ by to confirm a retune
+
+namespace SignalProcessor {
+
+	typedef struct delay_tracker_config {
+		int32_t max_delay;			// Largest delay measured and applied, in samples
+		uint32_t interval_ms;		// Time between the starts of two measurements
+		uint32_t burst_ms;			// Length of one measurement
+		int32_t hysteresis;			// Samples an estimate must differ from the applied delay by to be applied
+		float min_confidence;		// Normalized correlation an estimate needs (0..1)
+		int32_t margin;				// Samples the applied delay stays below the estimate, the reference leads the echo
+	} delay_tracker_config;
+
+	/*
+	 * Measures the delay of the echo in the mic signal behind the reference
+	 * and decides the delay of the AFE reference delay line.
+	 *
+	 * Every interval_ms the tracker thread asks the audio thread for burst_ms
+	 * of the undelayed reference and of one mic, and runs the GCC-PHAT
+	 * StreamAligner over them. A measurement counts when two consecutive
+	 * estimates of the burst agree and are confident. A new delay is only
+	 * applied when it differs from the applied one by more than the
+	 * hysteresis and the next measurement confirms it. The audio thread polls
+	 * targetDelay() and retunes the delay line itself.
+	 */
+	class ReferenceDelayTracker {
+
+		typedef struct block {
+			float reference[REF_DELAY_TRACKER_BLOCK];
+			float capture[REF_DELAY_TRACKER_BLOCK];
+		} block;
+
+		delay_tracker_config config;
+		AFERt::StreamAligner aligner;
+		AFERt::SpscRing<block, REF_DELAY_TRACKER_QUEUE> queue;
+
+		//Audio thread only
+		block staging;
+		int32_t staging_fill;
+
+		std::atomic<bool> capture_on;			// Set by the tracker thread while it measures
+		std::atomic<bool> overrun;				// Set by the audio thread when a block did not fit
+		std::atomic<int32_t> target;
+		std::atomic<int32_t> latest_delay;		// Latest measurement, -1 before the first one
+		std::atomic<float> latest_confidence;
+
+		std::thread worker;
+		std::mutex lock;
+		std::condition_variable wake;
+		bool stopping;							// Guarded by lock
+		int32_t candidate;						// Delay waiting for its confirmation, -1 when none
+
+		void run();
+		bool waitInterval(uint32_t ms);
+		bool measure(int32_t& delay, float& confidence);
+		void decide(int32_t delay, float confidence);
+
+	public:
+		ReferenceDelayTracker();
+		~ReferenceDelayTracker();
+
+		//Allocates the aligner and starts the tracker thread, initial_delay is the delay applied now
+		int32_t start(const delay_tracker_config& config, int32_t initial_delay);
+		void stop();
+		bool running() const;
+
+		//Audio thread, whether feed() takes samples now
+		bool capturing() const;
+		//Audio thread, same number of samples of the undelayed reference and of a mic. Never blocks nor allocates.
+		void feed(const float* reference, const float* capture, int32_t length);
+		//Audio thread, delay the reference delay line should have
+		int32_t targetDelay() const;
+
+		//Latest measurement, -1 and 0 before the first one
+		int32_t estimate() const;
+		float confidence() const;
+	};
+}
+
+#endif
@@ -20,9 +20,17 @@ namespace SignalProcessor {
 
 	const uint32_t delaySamples = 3211;
 
+	static_assert(AFE_IPC_HOP_SAMPLES == VOICESEEKER_OUT_NHOP, "IPC hop size must match VoiceSeekerLight output hop");
+
+	std::atomic<bool> SignalProcessor_VoiceSeekerLight::resamplersTaken{ false };
+	std::atomic<bool> SignalProcessor_VoiceSeekerLight::tuningTaken{ false };
+
 	const std::string SignalProcessor_VoiceSeekerLight::_jsonConfigDescription =
 		"{\n\
+            \"interface_version\" : 2,\n\
+            \"capabilities\" : [\"pcm_interleaved\", \"pcm_hop\", \"float_planar\", \"float_hop\"],\n\
             \"default_config\" : {\n\
+            \"interface_version\" : 1,\n\
             \"sample_rate\" : -1,\n\
             \"sample_format\" : S32_LE,\n\
             \"period_size\" : 800,\n\
@@ -31,17 +39,29 @@ namespace SignalProcessor {
             \"channel2output\" : 0\n\
         },\n\
         \"valid_options\" : {\n\
-            \"sample_format\" : [\"string\", \"enum\", [\"S8\", \"U8\", \"S16_LE\", \"S16_BE\", \"U16_LE\", \"U16_BE\", \"S24_LE\", \"S24_BE\", \"U24_LE\", \"U24_BE\", \"S32_LE\", \"S32_BE\", \"U32_LE\", \"U32_BE\", \"FLOAT_LE\", \"FLOAT_BE\", \"FLOAT64_LE\", \"FLOAT64_BE\"]],\n\
-            \"period_size\" : [\"int\", \"range\", 0, 4096,\n\
+            \"sample_format\" : [\"string\", \"enum\", [\"S16_LE\", \"S24_LE\", \"S24_3LE\", \"S32_LE\", \"FLOAT_LE\"]],\n\
+            \"period_size\" : [\"int\", \"range\", 1, 4096],\n\
             \"input_channels\" : [\"int\", \"range\", 1, 1024],\n\
+            \"interface_version\" : [\"int\", \"enum\", [1, 2]],\n\
             \"channel2output\" : [\"int\", \"range\", 0, \"input_channels_max\"]\n\
         }\n}";
 
 	//Construtor, initializes internal resources
 	SignalProcessor_VoiceSeekerLight::SignalProcessor_VoiceSeekerLight() : _state(VoiceSeekerLightSignalProcessorState::closed),
-		sizeBuffDelay{ 128000 }, iteration{ 0 }, heap_size{ 512000 }, scratch_size{ 5120 }, heap_memory{nullptr},
-		scratch_memory{ nullptr }, ref_in{ nullptr }, mic_in{ nullptr }, vsl{ 0 }, vsl_config{ 0 }, disable_trigger_frame_counter{0},
-		num_delay_files{ 0 }, fid_delay_files_open{false}, debugEnable{ false }{
+		iteration{ 0 }, heap_size{ 512000 }, scratch_size{ 5120 }, heap_memory{nullptr},
+		scratch_memory{ nullptr }, memoryHugePages{ false }, memoryLock{ true }, ref_in{ nullptr }, mic_in{ nullptr }, trackerRef_in{ nullptr }, fadeRef_in{ nullptr },
+		refDelayPlanes{ nullptr }, refDelayed{ nullptr }, refFaded{ nullptr }, floatInterface{ false }, outputSampleSize{ 4 },
+		delayTracking{ false }, delayTrackerConfig{ 0 }, vsl{ 0 }, vsl_config{ 0 }, disable_trigger_frame_counter{0},
+		num_delay_files{ 0 }, fid_delay_files_open{false}, debugRecorder{ nullptr }, debugEnable{ false }, vadGate{ false }, payloadExport{ false }, outputSampleIndex{ 0 },
+		clippedSamples{ 0 }, clipReported{ 0 }, clipReportSampleIndex{ 0 },
+		triggersApplied{ 0 }, triggersOverBudget{ 0 }, triggerLatenessTotal{ 0 }, triggerLatenessMax{ 0 },
+		ipcOverflowPolicy{ AFEIpc::OverflowPolicy::DropOldest }, ipcBlockTimeoutMs{ 0 }, ipcReported{ 0 }, ipcReportSampleIndex{ 0 },
+		ipcBatchHops{ false }, wakeWordHopCount{ 0 }, workingBytes{ 0 }, outputHopBuffer{ nullptr },
+		micAccumulator{ nullptr }, refAccumulator{ nullptr }, accumulatorCapacity{ 0 }, accumulatorFill{ 0 },
+		outputLatencySamples{ 0 }, hopLatencySamples{ 0 }, entryPoint{ EntryPoint::none }, outputUnderruns{ 0 },
+		instanceIndex{ 0 }, instanceWakeWord{ true }, resampleFactor{ 1 }, resampleOutput{ true }, outputFactor{ 1 }, ownsResamplers{ false },
+		upsampleAccumulator{ nullptr }, upsampleFill{ 0 }, upsampleFrame{ nullptr }, upsampleOutputBuffer{ nullptr },
+		resampleNs{ 0 }, processNs{ 0 }, resampleReportSampleIndex{ 0 }, tuningPollMs{ 1000 }, ownsTuning{ false }{
 
 		printf("VoiceSeekerLight App v%i.%i.%i\n", RDSP_VOICESEEKER_LIGHT_APP_VERSION_MAJOR, RDSP_VOICESEEKER_LIGHT_APP_VERSION_MINOR, RDSP_VOICESEEKER_LIGHT_APP_VERSION_PATCH);
 
@@ -97,35 +117,11 @@ namespace SignalProcessor {
 			vsl_config.mic_xyz_mm[3][2] = this->mic[3].z;
 		}
 
-		//Allocate memory
-		uint32_t heap_req_bytes = VoiceSeekerLight_GetRequiredHeapMemoryBytes(&vsl, &vsl_config) + 200000;
-		void* heap_memory = malloc(heap_req_bytes);
-		if (heap_memory == NULL) {
-			printf("VoiceSeekerLight_Create: failed to allocate for heap_memory\n");
-			return;
-		}
+		//Plan the memory: a probe instance measures the heap and scratch VoiceSeekerLight uses,
+		//openProcessor creates it again in the arena with exactly these sizes
+		if (0 != planMemory())
+			throw -1;
 
-		void* scratch_memory = malloc(scratch_size);
-		if (scratch_memory == NULL) {
-			printf("VoiceSeekerLight_Create: failed to allocate for scratch_memory\n");
-			return;
-		}
-
-		vsl.mem.pPrivateDataBase = heap_memory;
-		vsl.mem.pPrivateDataNext = heap_memory;
-		vsl.mem.FreePrivateDataSize = heap_req_bytes;
-		vsl.mem.pScratchDataBase = scratch_memory;
-		vsl.mem.pScratchDataNext = scratch_memory;
-		vsl.mem.FreeScratchDataSize = scratch_size;
-
-		//VoiceSeekerLight creation
-		RdspStatus voiceseeker_status = VoiceSeekerLight_Create(&vsl, &vsl_config);
-		if (voiceseeker_status != OK) {
-			printf("VoiceSeekerLight_Create: voiceseeker_status = %d\n", voiceseeker_status);
-            throw -1;
-		}
-
-		VoiceSeekerLight_Init(&vsl);					//VoiceSeekerLight initialization
 		VoiceSeekerLight_GetConfig(&vsl, &vsl_config);	//Retrieve VoiceSeekerLight configuration
 
 		VoiceSeekerLight_GetConstants(&vsl_constants);
@@ -140,32 +136,23 @@ namespace SignalProcessor {
 		rdsp_voiceseekerlight_ver_struct_t vsl_version;
 		VoiceSeekerLight_GetLibVersion(&vsl, &vsl_version);
 		printf("VoiceSeekerLight_GetLibVersion: v%i.%i.%i\n", vsl_version.major, vsl_version.minor, vsl_version.patch);
-		VoiceSeekerLight_PrintConfig(&vsl); //Print VoiceSeekerLight configuration
-		VoiceSeekerLight_PrintMemOverview(&vsl); //Print VoiceSeekerLight memory overview
 
-		//Map mic_in pointers to mic buffer
+		//The mic/ref buffers are mapped in openProcessor, once the channel counts are final
 		framesize_in_mic = framesize_in;
-		float* mic_buffer = (float*)malloc(sizeof(float) * framesize_in_mic * this->_inputChannelsCount);
-		mic_in = (float**)malloc(sizeof(float*) * this->_inputChannelsCount);
-		for (int32_t imic = 0; imic < this->_inputChannelsCount; imic++) {
-			mic_in[imic] = mic_buffer + imic * framesize_in_mic;
-		}
-
-		//Map ref_in pointers to ref buffer
 		framesize_in_ref = framesize_in;
-		float* ref_buffer = (float*)malloc(sizeof(float) * framesize_in_ref * this->_referenceChannelsCount);
-		ref_in = (float**)malloc(sizeof(float*) * this->_referenceChannelsCount);
-		for (int32_t ispk = 0; ispk < this->_referenceChannelsCount; ispk++) {
-			ref_in[ispk] = ref_buffer + ispk * framesize_in_ref;
-		}
-
-		//Initialize buffer for delay
-		initQueue(&circularBuffDelay, this->delaySamples, sizeBuffDelay);
 
 		if(this->debugEnable)
 			std::cout << "->SAVING AUDIO FILES FOR DELAY DEBUG ACTIVATED<-" << std::endl;
 	}
 
+	SignalProcessor_VoiceSeekerLight::~SignalProcessor_VoiceSeekerLight() {
+		if (VoiceSeekerLightSignalProcessorState::closed != this->_state)
+			closeProcessor();
+
+		// Free microphone geometry
+		free(vsl_config.mic_xyz_mm);
+	}
+
 	int32_t SignalProcessor_VoiceSeekerLight::openProcessor(const std::unordered_map<std::string, std::string>* settings) {
 
 		if (VoiceSeekerLightSignalProcessorState::closed != this->_state) {
@@ -177,19 +164,36 @@ namespace SignalProcessor {
 		if (nullptr != settings) {
 			std::string format = settings->at("sample_format");
 			snd_pcm_format_t formatValue = snd_pcm_format_value(format.c_str());
-			if (SND_PCM_FORMAT_UNKNOWN != formatValue) {
+			/* The conversions support S16_LE, S24_LE, S24_3LE, S32_LE and FLOAT_LE */
+			rdsp_pcm_format pcmFormat = (SND_PCM_FORMAT_UNKNOWN != formatValue) ? rdsp_pcm_format_from_name(snd_pcm_format_name(formatValue)) : RDSP_PCM_FORMAT_UNKNOWN;
+			if (RDSP_PCM_FORMAT_UNKNOWN != pcmFormat) {
 				this->_sampleFormat = formatValue;
+				this->_pcmFormat = pcmFormat;
 				/* Get the size of bytes for one sample for given format */
 				this->_sampleSize = snd_pcm_format_size(this->_sampleFormat, 1);
 			}
 			else {
-				closeProcessor();
-				throw; /* TODO throw some meaningful exception */
+				std::cout << "Sample format " << format << " not supported, use S16_LE, S24_LE, S24_3LE, S32_LE or FLOAT_LE" << std::endl;
+				return -1;
 			}
 
 			this->_channel2output = stoi(settings->at("channel2output"));
 			this->_inputChannelsCount = stoi(settings->at("input_channels"));
 			this->_periodSize = stoi(settings->at("period_size"));
+			//Optional, the capture runs at 16 kHz without it
+			auto sampleRate = settings->find("sample_rate");
+			if (settings->end() != sampleRate && stoi(sampleRate->second) > 0)
+				this->_sampleRate = stoi(sampleRate->second);
+			//Optional, version 2 hosts hand over float samples (processSignalFloat, processHopFloat)
+			auto interfaceVersion = settings->find("interface_version");
+			if (settings->end() != interfaceVersion) {
+				const int32_t version = stoi(interfaceVersion->second);
+				if (version < 1 || version > SIGNAL_PROCESSOR_INTERFACE_VERSION) {
+					std::cout << "Interface version " << version << " not supported, use 1 or 2" << std::endl;
+					return -1;
+				}
+				this->floatInterface = (2 == version);
+			}
 
 			vsl_config.num_mics = this->_inputChannelsCount;
 			VoiceSeekerLight_GetConfig(&vsl, &vsl_config);	//Retrieve VoiceSeekerLight configuration
@@ -203,6 +207,101 @@ namespace SignalProcessor {
 		if (this->_channel2output >= this->_inputChannelsCount)
 			throw; /* TODO throw some meaningful exception */
 
+		// Any period size works, frames left over are kept for the next period
+		if (this->_periodSize <= 0) {
+			std::cout << "Period size " << this->_periodSize << " not supported, use 1 to 4096 frames" << std::endl;
+			return -1;
+		}
+
+		// 32 and 48 kHz captures are decimated by the library's resamplers, whole frames at a time
+		const int32_t vslRate = (int32_t)vsl_constants.samplerate;
+		resampleFactor = this->_sampleRate / vslRate;
+		if (0 != this->_sampleRate % vslRate || resampleFactor < 1 || resampleFactor > VSL_RESAMPLE_MAX_FACTOR) {
+			std::cout << "Sample rate " << this->_sampleRate << " not supported, use 16000, 32000 or 48000" << std::endl;
+			return -1;
+		}
+		if (0 != this->_periodSize % resampleFactor) {
+			std::cout << "Period size " << this->_periodSize << " is not a multiple of " << resampleFactor << " at " << this->_sampleRate << " Hz" << std::endl;
+			return -1;
+		}
+		// The library has one mic and one speaker resampler per process
+		if (resampleFactor > 1) {
+			if (resamplersTaken.exchange(true)) {
+				std::cout << "Another VoiceSeekerLight instance of this process resamples already, only one can" << std::endl;
+				return -1;
+			}
+			ownsResamplers = true;
+			printf("Capture at %d Hz, resampled to %d Hz, clean output at %d Hz\n", this->_sampleRate, vslRate,
+				resampleOutput ? this->_sampleRate : vslRate);
+		}
+		outputFactor = resampleOutput ? resampleFactor : 1;
+		// RefSignalDelay and the RefDelay* samples are 16 kHz samples, the delay line runs at the capture rate
+		refDelayFrames = this->delaySamples * resampleFactor;
+		outputSampleSize = this->floatInterface ? sizeof(float) : this->_sampleSize;
+		framesize_in_mic = framesize_in * resampleFactor;
+		framesize_in_ref = framesize_in * resampleFactor;
+
+		// Debug WAV files are written by a background thread, the audio thread never waits for the disk
+		if (this->debugEnable) {
+			debugRecorder = new AFERt::WavRecorder();
+			debugRecorder->start("DebugWavWriter");
+		}
+
+		// Only one instance of a pool feeds the wake word engine
+		if (!instanceWakeWord)
+			this->_WWDetection = false;
+
+		// Every buffer processSignal works on is allocated here, once
+		if (0 != allocateWorkingBuffers()) {
+			std::cout << "Cannot allocate the working buffers" << std::endl;
+			if (ownsResamplers)
+				resamplersTaken.store(false);
+			ownsResamplers = false;
+			return -1;
+		}
+
+		// The tracker pairs reference and mic frames sample by sample
+		if (this->delayTracking && framesize_in_ref != framesize_in_mic) {
+			std::cout << "Reference delay tracking needs the same frame size for mic and reference, disabled" << std::endl;
+			this->delayTracking = false;
+		}
+		delay_tracker_config trackerConfig = delayTrackerConfig;
+		trackerConfig.max_delay *= resampleFactor;
+		trackerConfig.hysteresis *= resampleFactor;
+		trackerConfig.margin *= resampleFactor;
+		if (this->delayTracking && 0 == delayTracker.start(trackerConfig, refDelayFrames))
+			printf("Reference delay tracking: %u ms every %u ms, up to %d samples at %d Hz\n",
+				trackerConfig.burst_ms, trackerConfig.interval_ms, trackerConfig.max_delay, this->_sampleRate);
+
+		// The library keeps one set of parameters per process, one instance tunes it
+		if ((!tuningDir.empty() || !tuningFile.empty()) && tuningTaken.exchange(true))
+			std::cout << "Tuning: another VoiceSeekerLight instance of this process applies the tuning" << std::endl;
+		else if (!tuningDir.empty() || !tuningFile.empty()) {
+			ownsTuning = true;
+			// Tuning of these sysdefs, compiled once and mapped by the following starts
+			const int32_t stored = tuningDir.empty() ? 1 :
+				tuningStore.load(tuningDir, tuningCacheDir.empty() ? tuningDir : tuningCacheDir, vsl.sysdefs_checksum);
+			if (0 == stored) {
+				const uint32_t rejected = tuningStore.apply(&vsl);
+				printf("Tuning: %u parameters of sysdefs 0x%08X applied, %u unknown to VoiceSeekerLight\n",
+					tuningStore.parameterCount() - rejected, vsl.sysdefs_checksum, rejected);
+				tuningStore.unload();
+			}
+			else if (!tuningDir.empty() && 1 == stored)
+				printf("Tuning: no tuning of sysdefs 0x%08X in %s, library defaults\n", vsl.sysdefs_checksum, tuningDir.c_str());
+			// Tuning file: set now and again whenever it changes, VoiceSeekerLight is not created again for it
+			if (!tuningFile.empty() && 0 == tuning.start(tuningFile, vsl.sysdefs_checksum, tuningPollMs))
+				tuning.apply(&vsl, outputSampleIndex);
+		}
+
+		// One slot per output hop of a period (and of the frames carried over), allocated here to keep processSignal free of allocations
+		wakeWordHops.resize(ipcBatchHops ? (this->_periodSize + framesize_in_mic) / VOICESEEKER_OUT_NHOP + 1 : 1);
+		wakeWordHopCount = 0;
+
+		// The channel stays open for the whole session. If voice_ui_app is not running yet it is attached later.
+		if (this->_WWDetection && 0 != wakeWordChannel.open(ipcTransport, ipcOverflowPolicy, ipcBlockTimeoutMs))
+			std::cout << "Wake word engine not running yet, waiting for it" << std::endl;
+
 		// To avoid opening the signal processor multiple times, we set a "state"
 		this->_state = VoiceSeekerLightSignalProcessorState::opened;
 
@@ -211,27 +310,34 @@ namespace SignalProcessor {
 
 	int32_t SignalProcessor_VoiceSeekerLight::closeProcessor() {
 
-		//Close files for delay debug
-		if(this->debugEnable)
-		{
-			if (fid_delay_files_open) {
-				rdsp_wav_close(&fid_mic_delay);
-				rdsp_wav_close(&fid_ref_delay);
-				rdsp_wav_close(&fid_mic_out);
+		if (VoiceSeekerLightSignalProcessorState::filtering != this->_state) {
+			//The tracker thread goes first, the audio path is not running any more
+			delayTracker.stop();
+			tuning.stop();
+			if (ownsTuning)
+				tuningTaken.store(false);
+			ownsTuning = false;
+			//Close files for delay debug, the writer finishes what is queued
+			if (nullptr != debugRecorder) {
+				debugRecorder->stop();
+				if (0 != debugRecorder->droppedWrites())
+					printf("Debug WAV capture: %llu writes (%llu records) dropped, the disk did not keep up\n",
+						(unsigned long long)debugRecorder->droppedWrites(), (unsigned long long)debugRecorder->droppedRecords());
+				delete debugRecorder;
+				debugRecorder = nullptr;
 				fid_delay_files_open = false;
 			}
-		}
-
-		if (VoiceSeekerLightSignalProcessorState::filtering != this->_state) {
-			queueDestroy(&circularBuffDelay); //Destroy circular buffer
-
-			//Deallocate internal resources
-			free(heap_memory);
-			free(scratch_memory);
-			free(mic_in);
-			free(ref_in);
-			// Free microphone geometry
-			free(vsl_config.mic_xyz_mm);
+			//Unmap the arena, VoiceSeekerLight is created again by the next openProcessor
+			freeWorkingBuffers();
+			if (wakeWordChannel.isOpen())
+				reportChannelStatistics(true);
+			if (clippedSamples != clipReported)
+				reportClipping(true);
+			reportResampling(true);
+			if (ownsResamplers)
+				resamplersTaken.store(false);
+			ownsResamplers = false;
+			wakeWordChannel.close();
 			setDefaultSettings();
 			this->_state = VoiceSeekerLightSignalProcessorState::closed;
 			return 0;
@@ -244,6 +350,8 @@ namespace SignalProcessor {
 		const char* nChannelRefBuffer, size_t refBufferSize,
 		char* cleanMicBuffer, size_t cleanMicBufferSize) {
 
+		AFERt::AllocationGuard allocationGuard("processSignal");
+
 		//Lets check that the size of buffer matches the input settings. Provided size must match the configured
 		size_t expectedBufferSize = this->_inputChannelsCount * this->_periodSize * this->_sampleSize;
 		if (micBufferSize != expectedBufferSize) {
@@ -257,69 +365,333 @@ namespace SignalProcessor {
 			return -2;
 		}
 
-		expectedBufferSize = this->_periodSize * this->_sampleSize;
+		//The capture rate, or the VoiceSeekerLight rate when the output is not upsampled
+		expectedBufferSize = this->_periodSize / resampleFactor * outputFactor * this->_sampleSize;
 		if (cleanMicBufferSize != expectedBufferSize) {
 			std::cout << "output buffer size doesn't match" << std::endl;
 			return -3;
 		}
 
+		if (!selectEntryPoint(EntryPoint::period, false))
+			return -1;
+
+		//The debug files cover one minute every MINUTE_INTERVAL_WAV_FILE minutes, counted in periods
+		const int32_t periodsPerMinute = 60 * this->_sampleRate / this->_periodSize;
 		if(this->debugEnable)
 		{
 			//Open file for saving audios
-			if (!fid_delay_files_open && (num_delay_files * 1200 * MINUTE_INTERVAL_WAV_FILE == iteration)) {
+			if (!fid_delay_files_open && (num_delay_files * periodsPerMinute * MINUTE_INTERVAL_WAV_FILE == iteration)) {
 				fid_delay_files_open = true;
-				int start_min = iteration / 1200;
-				int end_min = (iteration + 1200) / 1200;
-				std::string refDelayName = "/tmp/ref_in_delay_S" + std::to_string(start_min) + "_E" + std::to_string(end_min) + ".wav";
-				std::string micDelayName = "/tmp/mic_in_delay_S" + std::to_string(start_min) + "_E" + std::to_string(end_min) + ".wav";
-				std::string micOutName = "/tmp/mic_out_S" + std::to_string(start_min) + "_E" + std::to_string(end_min) + ".wav";
-
-				fid_ref_delay = rdsp_wav_write_open(refDelayName.c_str(), vsl_constants.samplerate, this->_referenceChannelsCount, this->_sampleSize * 8, WAVE_FORMAT_PCM);
-				fid_mic_delay = rdsp_wav_write_open(micDelayName.c_str(), vsl_constants.samplerate, this->_inputChannelsCount, this->_sampleSize * 8, WAVE_FORMAT_PCM);
-				fid_mic_out = rdsp_wav_write_open(micOutName.c_str(), vsl_constants.samplerate, 1, this->_sampleSize * 8, WAVE_FORMAT_PCM);
+				int start_min = iteration / periodsPerMinute;
+				int end_min = (iteration + periodsPerMinute) / periodsPerMinute;
+				//Instances of a pool other than the first one prefix their files
+				char dir[32];
+				char name[AFE_WAV_NAME_MAX];
+				if (0 == instanceIndex)
+					snprintf(dir, sizeof(dir), "/tmp/");
+				else
+					snprintf(dir, sizeof(dir), "/tmp/vsl%d_", instanceIndex);
+
+				//Opened by the writer thread, the audio thread only queues the request.
+				//The files hold the samples as they come in and go out, FLOAT_LE ones need a float header.
+				const WaveFormat wavFormat = (RDSP_PCM_FORMAT_FLOAT_LE == this->_pcmFormat) ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+				snprintf(name, sizeof(name), "%sref_in_delay_S%d_E%d.wav", dir, start_min, end_min);
+				debugRecorder->open(DEBUG_WAV_REF_IN, name, this->_sampleRate, this->_referenceChannelsCount, this->_sampleSize * 8, wavFormat);
+				snprintf(name, sizeof(name), "%smic_in_delay_S%d_E%d.wav", dir, start_min, end_min);
+				debugRecorder->open(DEBUG_WAV_MIC_IN, name, this->_sampleRate, this->_inputChannelsCount, this->_sampleSize * 8, wavFormat);
+				snprintf(name, sizeof(name), "%smic_out_S%d_E%d.wav", dir, start_min, end_min);
+				debugRecorder->open(DEBUG_WAV_MIC_OUT, name, vsl_constants.samplerate, 1, this->_sampleSize * 8, wavFormat);
 			}
 		}
 
 		iteration++;
 
-		const int32_t framerate_out = this->_sampleRate / framesize_out;
+		int32_t ret = processBlock(nChannelMicBuffer, nChannelRefBuffer, this->_periodSize, cleanMicBuffer);
+
+		if(this->debugEnable)
+		{
+			if (fid_delay_files_open && ((num_delay_files * periodsPerMinute * MINUTE_INTERVAL_WAV_FILE) + periodsPerMinute == iteration)) {
+				debugRecorder->close(DEBUG_WAV_MIC_IN);
+				debugRecorder->close(DEBUG_WAV_REF_IN);
+				debugRecorder->close(DEBUG_WAV_MIC_OUT);
+				fid_delay_files_open = false;
+				num_delay_files++;
+			}
+		}
+
+		return ret;
+	}
+
+	int32_t SignalProcessor_VoiceSeekerLight::processHop(const char* nChannelMicHop, size_t micHopSize,
+		const char* nChannelRefHop, size_t refHopSize,
+		char* cleanMicHop, size_t cleanMicHopSize) {
 
-		//Check if triggering is allowed
-		int32_t enable_triggering = 1;
-		if (disable_trigger_frame_counter > 0)
-			enable_triggering = 0;
-		--disable_trigger_frame_counter;
+		AFERt::AllocationGuard allocationGuard("processHop");
+
+		//A hop of VoiceSeekerLight output, captured at resampleFactor times its rate
+		const int32_t hopFrames = VOICESEEKER_OUT_NHOP * resampleFactor;
+		size_t expectedBufferSize = this->_inputChannelsCount * hopFrames * this->_sampleSize;
+		if (micHopSize != expectedBufferSize) {
+			std::cout << "Input hop size doesn't match. Expected: " << expectedBufferSize << "; Got: " << micHopSize << std::endl;
+			return -1;
+		}
+
+		expectedBufferSize = this->_referenceChannelsCount * hopFrames * this->_sampleSize;
+		if (refHopSize != expectedBufferSize) {
+			std::cout << "Reference hop size doesn't match. Expected: " << expectedBufferSize << "; Got: " << refHopSize << std::endl;
+			return -2;
+		}
+
+		expectedBufferSize = VOICESEEKER_OUT_NHOP * outputFactor * this->_sampleSize;
+		if (cleanMicHopSize != expectedBufferSize) {
+			std::cout << "output hop size doesn't match" << std::endl;
+			return -3;
+		}
+
+		if (!selectEntryPoint(EntryPoint::hop, false))
+			return -1;
+
+		//Debug WAV files follow the periods of processSignal, they are not written per hop
+		iteration++;
+
+		return processBlock(nChannelMicHop, nChannelRefHop, hopFrames, cleanMicHop);
+	}
+
+	int32_t SignalProcessor_VoiceSeekerLight::processSignalFloat(const const_float_span& nChannelMic, const const_float_span& nChannelRef,
+		const float_span& cleanMic) {
+
+		AFERt::AllocationGuard allocationGuard("processSignalFloat");
+
+		if (nChannelMic.channelsCount != (size_t)this->_inputChannelsCount || nChannelMic.frames != (size_t)this->_periodSize) {
+			std::cout << "Input span doesn't match. Expected: " << this->_inputChannelsCount << " x " << this->_periodSize
+				<< "; Got: " << nChannelMic.channelsCount << " x " << nChannelMic.frames << std::endl;
+			return -1;
+		}
+
+		if (nChannelRef.channelsCount != (size_t)this->_referenceChannelsCount || nChannelRef.frames != (size_t)this->_periodSize) {
+			std::cout << "Reference span doesn't match. Expected: " << this->_referenceChannelsCount << " x " << this->_periodSize
+				<< "; Got: " << nChannelRef.channelsCount << " x " << nChannelRef.frames << std::endl;
+			return -2;
+		}
+
+		if (1 != cleanMic.channelsCount || cleanMic.frames != (size_t)(this->_periodSize / resampleFactor * outputFactor)) {
+			std::cout << "output span doesn't match" << std::endl;
+			return -3;
+		}
+
+		if (!selectEntryPoint(EntryPoint::period, true))
+			return -1;
+
+		//The debug WAV files hold the sample format, processSignal writes them
+		iteration++;
+
+		return processBlockFloat(nChannelMic.channels, nChannelRef.channels, this->_periodSize, cleanMic.channels[0]);
+	}
+
+	int32_t SignalProcessor_VoiceSeekerLight::processHopFloat(const const_float_span& nChannelMicHop, const const_float_span& nChannelRefHop,
+		const float_span& cleanMicHop) {
+
+		AFERt::AllocationGuard allocationGuard("processHopFloat");
+
+		const size_t hopFrames = (size_t)VOICESEEKER_OUT_NHOP * resampleFactor;
+		if (nChannelMicHop.channelsCount != (size_t)this->_inputChannelsCount || nChannelMicHop.frames != hopFrames) {
+			std::cout << "Input hop span doesn't match. Expected: " << this->_inputChannelsCount << " x " << hopFrames
+				<< "; Got: " << nChannelMicHop.channelsCount << " x " << nChannelMicHop.frames << std::endl;
+			return -1;
+		}
+
+		if (nChannelRefHop.channelsCount != (size_t)this->_referenceChannelsCount || nChannelRefHop.frames != hopFrames) {
+			std::cout << "Reference hop span doesn't match. Expected: " << this->_referenceChannelsCount << " x " << hopFrames
+				<< "; Got: " << nChannelRefHop.channelsCount << " x " << nChannelRefHop.frames << std::endl;
+			return -2;
+		}
+
+		if (1 != cleanMicHop.channelsCount || cleanMicHop.frames != (size_t)VOICESEEKER_OUT_NHOP * outputFactor) {
+			std::cout << "output hop span doesn't match" << std::endl;
+			return -3;
+		}
+
+		if (!selectEntryPoint(EntryPoint::hop, true))
+			return -1;
+
+		iteration++;
+
+		return processBlockFloat(nChannelMicHop.channels, nChannelRefHop.channels, (int32_t)hopFrames, cleanMicHop.channels[0]);
+	}
+
+	//The first call after openProcessor picks processSignal or processHop (or their float versions) for the session
+	bool SignalProcessor_VoiceSeekerLight::selectEntryPoint(EntryPoint wanted, bool floatSamples) {
+		//The lines were created for the samples of the interface version opened
+		if (floatSamples != this->floatInterface) {
+			std::cout << (this->floatInterface ? "Opened with interface_version 2, use processSignalFloat or processHopFloat" :
+				"processSignalFloat and processHopFloat need interface_version 2 in the settings of openProcessor") << std::endl;
+			return false;
+		}
+
+		if (wanted == entryPoint)
+			return true;
+
+		if (EntryPoint::none != entryPoint) {
+			std::cout << "processSignal and processHop cannot be mixed, reopen the signal processor to switch" << std::endl;
+			return false;
+		}
+
+		//The output line was primed for periods, a hop needs less (none when the frame divides the hop)
+		if (EntryPoint::hop == wanted &&
+			!outputLine.seek((ptrdiff_t)(outputLatencySamples - hopLatencySamples) * (ptrdiff_t)outputSampleSize)) {
+			std::cout << "Output line error" << std::endl;
+			return false;
+		}
+
+		entryPoint = wanted;
+		return true;
+	}
+
+	//Processes frames of mic and reference samples and fills frames of clean mic output, delayed by the latency of the entry point
+	int32_t SignalProcessor_VoiceSeekerLight::processBlock(const char* nChannelMicBuffer, const char* nChannelRefBuffer,
+		int32_t frames, char* cleanMicBuffer) {
+
+		const size_t refBufferSize = (size_t)this->_referenceChannelsCount * frames * this->_sampleSize;
+		const size_t cleanMicBufferSize = (size_t)(frames / resampleFactor) * outputFactor * this->_sampleSize;
+		const uint64_t block_start_ns = AFEIpc::monotonicTimeNs();
 
 		// Let's process the signal - meaning copy the selected channel to output.
 		this->_state = VoiceSeekerLightSignalProcessorState::filtering;
-		int32_t shift = this->_inputChannelsCount * this->_sampleSize;
 
-		char* pcleanMicBuffer = cleanMicBuffer;
-		const char* pnChannelMicBuffer = nChannelMicBuffer;
-		const char* pnChannelRefBuffer = nChannelRefBuffer;
+		//Copy nChannelRefBuffer to the delay line, the delayed block is read in place (contiguous, no wrap)
+		const char* pdelayedRefBuffer = nullptr;
+		if (refDelayLine.write(nChannelRefBuffer, refBufferSize))
+			pdelayedRefBuffer = refDelayLine.read(refBufferSize);
+		if (nullptr == pdelayedRefBuffer) {
+			std::cout << "Reference delay line error" << std::endl;
+			this->_state = VoiceSeekerLightSignalProcessorState::opened;
+			return -2;
+		}
+		//The tracker asked for another delay: the block at the old delay fades out while the one at the new delay fades in
+		const char* pfadeRefBuffer = this->delayTracking ? retuneDelayLine(&pdelayedRefBuffer, refBufferSize) : nullptr;
+
+		/*
+		 * The block needs not be a multiple of the VoiceSeekerLight frame.
+		 * It is appended to the accumulators behind the samples left over from
+		 * the previous block, every whole frame is processed and the rest is
+		 * kept for the next block.
+		 */
+		const int32_t carry = accumulatorFill;
+		for (int32_t imic = 0; imic < this->_inputChannelsCount; imic++)
+			mic_in[imic] = micAccumulator[imic] + carry;
+		for (int32_t ispk = 0; ispk < this->_referenceChannelsCount; ispk++)
+			ref_in[ispk] = refAccumulator[ispk] + carry;
+
+		rdsp_pcm_deinterleave_to_float(nChannelMicBuffer, mic_in, frames, this->_inputChannelsCount, this->_pcmFormat);
+		rdsp_pcm_deinterleave_to_float(pdelayedRefBuffer, ref_in, frames, this->_referenceChannelsCount, this->_pcmFormat);
+
+		if (nullptr != pfadeRefBuffer) {
+			rdsp_pcm_deinterleave_to_float(pfadeRefBuffer, fadeRef_in, frames, this->_referenceChannelsCount, this->_pcmFormat);
+			const float step = 1.0f / frames;
+			for (int32_t ispk = 0; ispk < this->_referenceChannelsCount; ispk++) {
+				for (int32_t i = 0; i < frames; i++) {
+					const float gain = (float)(i + 1) * step;
+					ref_in[ispk][i] = fadeRef_in[ispk][i] + gain * (ref_in[ispk][i] - fadeRef_in[ispk][i]);
+				}
+			}
+		}
+
+		//Only while the tracker measures, a few seconds per interval
+		if (this->delayTracking && delayTracker.capturing()) {
+			rdsp_pcm_deinterleave_to_float(nChannelRefBuffer, trackerRef_in, frames, this->_referenceChannelsCount, this->_pcmFormat);
+			delayTracker.feed(trackerRef_in[0], mic_in[0], frames);
+		}
 
-		//Copy pnChannelRefBuffer to circularBuffDelay
-		enqueue(&circularBuffDelay, pnChannelRefBuffer, refBufferSize);
+		//Write to file for delay debug for 1 minute
+		if(this->debugEnable)
+		{
+			if (fid_delay_files_open) {
+				debugRecorder->write(DEBUG_WAV_MIC_IN, nChannelMicBuffer, frames);
+				debugRecorder->write(DEBUG_WAV_REF_IN, pdelayedRefBuffer, frames);
+			}
+		}
 
-		//Get samples from circularBuffDelay which has the delayed samples
-		char* tmp_delayedRefBuffer = (char*)malloc(refBufferSize);
-		char* delayedRefBuffer = tmp_delayedRefBuffer;
-		dequeue(&circularBuffDelay, delayedRefBuffer, refBufferSize);
+		return processFrames(frames, block_start_ns, cleanMicBuffer, cleanMicBufferSize);
+	}
 
-		char* tmp_buf = (char*)malloc(VOICESEEKER_OUT_NHOP * this->_sampleSize);
+	//Same as processBlock on float samples: nothing is converted, the reference goes through one delay line per channel
+	int32_t SignalProcessor_VoiceSeekerLight::processBlockFloat(const float* const* micChannels, const float* const* refChannels,
+		int32_t frames, float* cleanMic) {
 
-		for (int32_t j = 0; j < this->_periodSize / framesize_in_mic; j++) {
+		const size_t channelBytes = sizeof(float) * frames;
+		const uint64_t block_start_ns = AFEIpc::monotonicTimeNs();
 
-			rdsp_pcm_to_float(delayedRefBuffer, ref_in, framesize_in_ref, this->_referenceChannelsCount, this->_sampleSize);
-			rdsp_pcm_to_float(pnChannelMicBuffer, mic_in, framesize_in_mic, this->_inputChannelsCount, this->_sampleSize);
+		this->_state = VoiceSeekerLightSignalProcessorState::filtering;
 
-			//Write to file for delay debug for 1 minute
-			if(this->debugEnable)
-			{
-				if (fid_delay_files_open) {
-					rdsp_wav_write_interleaved_int32((int32_t *)pnChannelMicBuffer, vsl_constants.framesize_in, &fid_mic_delay);
-					rdsp_wav_write_interleaved_int32((int32_t *)delayedRefBuffer, vsl_constants.framesize_in, &fid_ref_delay);
-				}
+		for (int32_t ispk = 0; ispk < this->_referenceChannelsCount; ispk++) {
+			refDelayed[ispk] = refDelayPlanes[ispk].write(refChannels[ispk], channelBytes) ?
+				(const float*)refDelayPlanes[ispk].read(channelBytes) : nullptr;
+			if (nullptr == refDelayed[ispk]) {
+				std::cout << "Reference delay line error" << std::endl;
+				this->_state = VoiceSeekerLightSignalProcessorState::opened;
+				return -2;
+			}
+		}
+		const bool fading = this->delayTracking && retuneDelayPlanes(channelBytes);
+
+		//Appended to the accumulators as processBlock does, the copy is the only pass over the input
+		const int32_t carry = accumulatorFill;
+		for (int32_t imic = 0; imic < this->_inputChannelsCount; imic++)
+			memcpy(micAccumulator[imic] + carry, micChannels[imic], channelBytes);
+		const float step = 1.0f / frames;
+		for (int32_t ispk = 0; ispk < this->_referenceChannelsCount; ispk++) {
+			float* ref = refAccumulator[ispk] + carry;
+			if (!fading) {
+				memcpy(ref, refDelayed[ispk], channelBytes);
+				continue;
+			}
+			//The block at the old delay fades out while the one at the new delay fades in
+			const float* delayed = refDelayed[ispk];
+			const float* faded = refFaded[ispk];
+			for (int32_t i = 0; i < frames; i++)
+				ref[i] = faded[i] + (float)(i + 1) * step * (delayed[i] - faded[i]);
+		}
+
+		if (this->delayTracking && delayTracker.capturing())
+			delayTracker.feed(refChannels[0], micAccumulator[0] + carry, frames);
+
+		return processFrames(frames, block_start_ns, (char*)cleanMic, (size_t)(frames / resampleFactor) * outputFactor * sizeof(float));
+	}
+
+	//Runs VoiceSeekerLight on the whole frames accumulated, frames of them just appended, and fills the clean mic block from the output line
+	int32_t SignalProcessor_VoiceSeekerLight::processFrames(int32_t frames, uint64_t block_start_ns, char* cleanMicBuffer, size_t cleanMicBufferSize) {
+
+		/*
+		 * The block was handed over right after its last sample was captured.
+		 * The interface carries no ALSA timestamps, so the capture time of every
+		 * hop is derived from the arrival of the block.
+		 */
+		const uint64_t period_capture_time_ns = block_start_ns - (uint64_t)frames * 1000000000ull / this->_sampleRate;
+
+		const int32_t framerate_out = (int32_t)vsl_constants.samplerate / framesize_out;
+
+		//The memory utils of the library keep the scratch per thread, point it at this instance's
+		//(a pool worker processes several instances one after the other)
+		rdsp_plugin_scratch_init(scratch_memory, scratch_memory, scratch_size);
+
+		const int32_t carry = accumulatorFill;
+		accumulatorFill += frames;
+		char* tmp_buf = this->outputHopBuffer;
+		int32_t offset = 0;
+
+		for (; accumulatorFill - offset >= framesize_in_mic; offset += framesize_in_mic) {
+
+			for (int32_t imic = 0; imic < this->_inputChannelsCount; imic++)
+				mic_in[imic] = micAccumulator[imic] + offset;
+			for (int32_t ispk = 0; ispk < this->_referenceChannelsCount; ispk++)
+				ref_in[ispk] = refAccumulator[ispk] + offset;
+
+			//A frame at the capture rate is decimated in place to one VoiceSeekerLight frame
+			if (resampleFactor > 1) {
+				const uint64_t resample_start_ns = AFEIpc::monotonicTimeNs();
+				VoiceSeekerLight_MicResample_Downsample_Process(mic_in, this->_inputChannelsCount);
+				VoiceSeekerLight_SpkResample_Downsample_Process(ref_in, this->_referenceChannelsCount);
+				resampleNs += AFEIpc::monotonicTimeNs() - resample_start_ns;
 			}
 
 			/*
@@ -334,45 +706,89 @@ namespace SignalProcessor {
 
 			// Check for output
 			if (vsl_out != NULL) {
-				rdsp_float_to_pcm(tmp_buf, &vsl_out, VOICESEEKER_OUT_NHOP, 1, this->_sampleSize);
-				memcpy(pcleanMicBuffer, tmp_buf, this->_sampleSize * VOICESEEKER_OUT_NHOP);
+				//Upsampled, the output line takes the capture rate. The debug file keeps the VoiceSeekerLight rate.
+				if (1 == outputFactor && this->floatInterface)
+					outputLine.write(vsl_out, sizeof(float) * VOICESEEKER_OUT_NHOP);
+				else if (1 == outputFactor) {
+					clippedSamples += rdsp_float_interleave_to_pcm(&vsl_out, tmp_buf, VOICESEEKER_OUT_NHOP, 1, this->_pcmFormat);
+					outputLine.write(tmp_buf, this->_sampleSize * VOICESEEKER_OUT_NHOP);
+				}
+				else
+					upsampleToOutput(vsl_out);
 
 				if(this->debugEnable)
 				{
 					if (fid_delay_files_open) {
-						rdsp_wav_write_interleaved_int32((int32_t *)tmp_buf, VOICESEEKER_OUT_NHOP, &fid_mic_out);
+						if (1 != outputFactor)
+							rdsp_float_interleave_to_pcm(&vsl_out, tmp_buf, VOICESEEKER_OUT_NHOP, 1, this->_pcmFormat);
+						debugRecorder->write(DEBUG_WAV_MIC_OUT, tmp_buf, VOICESEEKER_OUT_NHOP);
 					}
 				}
 
-				pcleanMicBuffer += (VOICESEEKER_OUT_NHOP * this->_sampleSize);
-				if (this->_WWDetection) {
-					sendBufferToWakeWordEngine(vsl_out, VOICESEEKER_OUT_NHOP * sizeof(float), iteration, enable_triggering);
-					int32_t keyword_start_offset_samples = getKeyWordOffsetFromWakeWordEngine();
-					if (keyword_start_offset_samples) {
-						VoiceSeekerLight_TriggerFound(&vsl, keyword_start_offset_samples);
+				//Check if triggering is allowed
+				int32_t enable_triggering = 1;
+				if (disable_trigger_frame_counter > 0)
+					enable_triggering = 0;
+				--disable_trigger_frame_counter;
+
+				//voice_ui_app skips the wake word engine while the VAD hears no speech
+				uint32_t hopFlags = 0;
+#if RDSP_ENABLE_VAD
+				if (this->vadGate && this->_WWDetection)
+					hopFlags = AFE_IPC_HOP_VAD | ((0 != VoiceSeekerLight_Vad_Process(&vsl, vsl_out)) ? AFE_IPC_HOP_SPEECH : 0);
+#endif
 
-						//Don't allow re-triggering immediately after a trigger
-						disable_trigger_frame_counter = RDSP_DISABLE_TRIGGER_TIMEOUT_SEC * framerate_out;
-					}
+#if RDSP_ENABLE_PAYLOAD_BUFFER
+				//The hop is in the ring before voice_ui_app hears of it
+				if (payloadWriter.isPublished())
+					payloadWriter.write(vsl_out, VOICESEEKER_OUT_NHOP);
+#endif
+
+				//Frames left over from the previous block were captured before this one, offset - carry is negative for them
+				if (this->_WWDetection)
+					sendBufferToWakeWordEngine(vsl_out, VOICESEEKER_OUT_NHOP * sizeof(float), iteration, enable_triggering,
+						period_capture_time_ns + (int64_t)(offset - carry) * 1000000000ll / this->_sampleRate, hopFlags);
+				outputSampleIndex += VOICESEEKER_OUT_NHOP;
+
+				//Apply whatever the wake word engine found so far, never wait for it
+				if (this->_WWDetection && applyPendingTriggers()) {
+					//Don't allow re-triggering immediately after a trigger
+					disable_trigger_frame_counter = RDSP_DISABLE_TRIGGER_TIMEOUT_SEC * framerate_out;
 				}
+
+				//A changed tuning file takes effect from the next hop on, the AEC keeps converging
+				if (ownsTuning)
+					tuning.apply(&vsl, outputSampleIndex);
 			}
+		}
 
-			pnChannelMicBuffer += (this->_channel2output + vsl_constants.framesize_in * shift);
-			delayedRefBuffer += (vsl_constants.framesize_in * this->_referenceChannelsCount * this->_sampleSize);
+		//Keep the part of a frame not processed yet
+		accumulatorFill -= offset;
+		if (accumulatorFill > 0 && offset > 0) {
+			for (int32_t imic = 0; imic < this->_inputChannelsCount; imic++)
+				memmove(micAccumulator[imic], micAccumulator[imic] + offset, sizeof(float) * accumulatorFill);
+			for (int32_t ispk = 0; ispk < this->_referenceChannelsCount; ispk++)
+				memmove(refAccumulator[ispk], refAccumulator[ispk] + offset, sizeof(float) * accumulatorFill);
 		}
 
-		free(tmp_buf);
-		free(tmp_delayedRefBuffer);
+		//The output line was primed with the latency of the entry point, a block is always there
+		const char* pcleanMicBuffer = outputLine.read(cleanMicBufferSize);
+		if (nullptr != pcleanMicBuffer) {
+			memcpy(cleanMicBuffer, pcleanMicBuffer, cleanMicBufferSize);
+		}
+		else {
+			memset(cleanMicBuffer, 0, cleanMicBufferSize);
+			if (0 == outputUnderruns++)
+				printf("Clean mic output underrun, %zu bytes queued\n", outputLine.fill());
+		}
 
-		if(this->debugEnable)
-		{
-			if (fid_delay_files_open && ((num_delay_files * 1200 * MINUTE_INTERVAL_WAV_FILE) + 1200 == iteration)) {
-				rdsp_wav_close(&fid_mic_delay);
-				rdsp_wav_close(&fid_ref_delay);
-				rdsp_wav_close(&fid_mic_out);
-				fid_delay_files_open = false;
-				num_delay_files++;
-			}
+		// Publish what is left of the block (all hops when batching)
+		if (this->_WWDetection)
+			flushWakeWordHops();
+		reportClipping(false);
+		if (resampleFactor > 1) {
+			processNs += AFEIpc::monotonicTimeNs() - block_start_ns;
+			reportResampling(false);
 		}
 
 		this->_state = VoiceSeekerLightSignalProcessorState::opened;
@@ -387,6 +803,10 @@ namespace SignalProcessor {
 		return this->_sampleRate;
 	}
 
+	int32_t SignalProcessor_VoiceSeekerLight::getOutputSampleRate() const {
+		return this->_sampleRate / resampleFactor * outputFactor;
+	}
+
 	const char* SignalProcessor_VoiceSeekerLight::getSampleFormat() const {
 		return snd_pcm_format_name(this->_sampleFormat);
 	}
@@ -411,6 +831,7 @@ namespace SignalProcessor {
 	void SignalProcessor_VoiceSeekerLight::setDefaultSettings() {
 		this->_sampleRate = 16000;
 		this->_sampleFormat = SND_PCM_FORMAT_S32_LE; //Number should correspond to ALSA formats
+		this->_pcmFormat = RDSP_PCM_FORMAT_S32_LE;
 		this->_periodSize = 800;
 		this->_inputChannelsCount = 4; //Number of mic channels
 		this->_referenceChannelsCount = 2; //Number of reference channels (speakers)
@@ -420,7 +841,41 @@ namespace SignalProcessor {
 		AFEConfigState configState;
 		this->_WWDetection = (configState.isConfigurationEnable("WWDectionDisable", 0) == 1)? false : true;
 		this->delaySamples = configState.isConfigurationEnable("RefSignalDelay", delaySamples);
+		this->refDelayFrames = this->delaySamples;
 		this->debugEnable = (configState.isConfigurationEnable("DebugEnable", 0) == 1)? true : false;
+		this->vadGate = (configState.isConfigurationEnable("VadGate", 0) == 1) ? true : false;
+		this->payloadExport = (configState.isConfigurationEnable("PayloadExport", 0) == 1) ? true : false;
+		this->memoryHugePages = (configState.isConfigurationEnable("MemoryHugePages", 0) == 1) ? true : false;
+		this->memoryLock = (configState.isConfigurationEnable("MemoryLock", 1) == 1) ? true : false;
+		this->delayTracking = (configState.isConfigurationEnable("RefDelayTracking", 0) == 1) ? true : false;
+		this->delayTrackerConfig.max_delay = configState.isConfigurationEnable("RefDelayMaxSamples", 8000);
+		this->delayTrackerConfig.interval_ms = configState.isConfigurationEnable("RefDelayTrackingIntervalMs", 30000);
+		this->delayTrackerConfig.burst_ms = configState.isConfigurationEnable("RefDelayTrackingBurstMs", 4000);
+		this->delayTrackerConfig.hysteresis = configState.isConfigurationEnable("RefDelayHysteresis", 16);
+		this->delayTrackerConfig.min_confidence = configState.isConfigurationEnable("RefDelayMinConfidence", 30) / 100.0f;
+		this->delayTrackerConfig.margin = configState.isConfigurationEnable("RefDelayMargin", 0);
+		this->ipcTransport = AFEIpc::transportFromConfig();
+		this->ipcOverflowPolicy = AFEIpc::overflowPolicyFromConfig();
+		this->ipcBlockTimeoutMs = configState.isConfigurationEnable("IpcBlockTimeoutMs", 5);
+		this->ipcBatchHops = (configState.isConfigurationEnable("IpcBatchHops", 0) == 1) ? true : false;
+		this->ipcReported = { 0 };
+		this->ipcReportSampleIndex = 0;
+		this->clippedSamples = 0;
+		this->clipReported = 0;
+		this->clipReportSampleIndex = 0;
+		this->outputUnderruns = 0;
+		this->floatInterface = false;
+		this->resampleOutput = (configState.isConfigurationEnable("ResampleOutput", 1) == 1) ? true : false;
+		this->tuningDir = configState.isConfigurationEnable("TuningDir", "");
+		this->tuningCacheDir = configState.isConfigurationEnable("TuningCacheDir", "");
+		this->tuningFile = configState.isConfigurationEnable("TuningFile", "");
+		this->tuningPollMs = configState.isConfigurationEnable("TuningPollMs", 1000);
+		this->resampleFactor = 1;
+		this->outputFactor = 1;
+		this->resampleNs = 0;
+		this->processNs = 0;
+		this->resampleReportSampleIndex = 0;
+		this->triggerLatencyBudget = configState.isConfigurationEnable("TriggerLatencyBudgetMs", 100) * (this->_sampleRate / 1000);
 		/*
 			mic0 = 35.0, 15.15, 0.0
 			mic1 = 17.5, -15.15, 0.0
@@ -462,109 +917,530 @@ namespace SignalProcessor {
 			<< std::endl;
 	}
 
-	void SignalProcessor_VoiceSeekerLight::initQueue(queue* q, size_t samples_delay, size_t maxSize) {
-		q->size = maxSize;
-		q->samples = (char*)malloc(q->size);
-		q->num_entries = samples_delay * this->_referenceChannelsCount * this->_sampleSize;
-		q->head = 0;
-		q->tail = samples_delay * this->_referenceChannelsCount * this->_sampleSize;
+	//Greatest common divisor, for the output latency
+	static int64_t gcd(int64_t a, int64_t b) {
+		while (0 != b) {
+			int64_t t = a % b;
+			a = b;
+			b = t;
+		}
+		return a;
+	}
 
-		//Initialize buffer to zeros
-		memset(q->samples, 0, q->size);
+	/*
+	 * Silence queued in front of the output so every period can be filled.
+	 * After k periods VoiceSeekerLight processed the whole frames of k * period
+	 * input samples and emitted one hop per hop samples of them, the output
+	 * lags by the deficit. The pattern repeats every lcm(period, frame, hop)
+	 * samples, the latency is its largest deficit. When the frame divides the
+	 * period and the hop this is hop - gcd(period, hop).
+	 * Upsampled, the output goes out in whole chunks of the emitted samples
+	 * (1 otherwise). Everything is counted at the VoiceSeekerLight rate.
+	 */
+	static int32_t outputLatency(int32_t period, int32_t frame, int32_t hop, int32_t chunk) {
+		int64_t cycle = (int64_t)period * frame / gcd(period, frame);
+		cycle = cycle * hop / gcd(cycle, hop);
+		cycle = cycle * chunk / gcd(cycle, chunk);
+
+		int64_t latency = 0;
+		for (int64_t k = 1; k * period <= cycle; k++) {
+			const int64_t processed = (k * period / frame) * frame;
+			const int64_t emitted = (processed / hop) * hop;
+			const int64_t deficit = k * period - (emitted / chunk) * chunk;
+			latency = std::max(latency, deficit);
+		}
+		return (int32_t)latency;
 	}
 
-	void SignalProcessor_VoiceSeekerLight::queueDestroy(queue* q) {
-		free(q->samples);
+	int32_t SignalProcessor_VoiceSeekerLight::createVoiceSeekerLight(bool vad, int32_t resample) {
+		vsl.mem.pPrivateDataBase = heap_memory;
+		vsl.mem.pPrivateDataNext = heap_memory;
+		vsl.mem.FreePrivateDataSize = heap_size;
+		vsl.mem.pScratchDataBase = scratch_memory;
+		vsl.mem.pScratchDataNext = scratch_memory;
+		vsl.mem.FreeScratchDataSize = scratch_size;
+
+		//VoiceSeekerLight creation
+		RdspStatus voiceseeker_status = VoiceSeekerLight_Create(&vsl, &vsl_config);
+		if (voiceseeker_status != OK) {
+			printf("VoiceSeekerLight_Create: voiceseeker_status = %d\n", voiceseeker_status);
+			return -1;
+		}
+
+		VoiceSeekerLight_Init(&vsl);					//VoiceSeekerLight initialization
+
+#if RDSP_ENABLE_VAD
+		if (vad) {
+			voiceseeker_status = VoiceSeekerLight_Vad_Create(&vsl);
+			if (voiceseeker_status != OK) {
+				printf("VoiceSeekerLight_Vad_Create: voiceseeker_status = %d\n", voiceseeker_status);
+				return -1;
+			}
+			VoiceSeekerLight_Vad_Init(&vsl);
+		}
+#endif
+
+		//One mic and one speaker resampler per process, only the instance owning them creates them outside the probe
+		if (resample > 1) {
+			voiceseeker_status = VoiceSeekerLight_MicResample_Create(&vsl, resample);
+			if (voiceseeker_status != OK) {
+				printf("VoiceSeekerLight_MicResample_Create: voiceseeker_status = %d\n", voiceseeker_status);
+				return -1;
+			}
+			VoiceSeekerLight_MicResample_Init(&vsl);
+			voiceseeker_status = VoiceSeekerLight_SpkResample_Create(&vsl, resample);
+			if (voiceseeker_status != OK) {
+				printf("VoiceSeekerLight_SpkResample_Create: voiceseeker_status = %d\n", voiceseeker_status);
+				return -1;
+			}
+			VoiceSeekerLight_SpkResample_Init(&vsl);
+		}
+		return 0;
 	}
 
-	void SignalProcessor_VoiceSeekerLight::enqueue(queue* q, const char* samples_ref, size_t sizeBuff) {
-		int32_t avail_bytes = q->size - q->tail;
+	int32_t SignalProcessor_VoiceSeekerLight::planMemory() {
+		//The probe gets the old fixed margin on top of what the library asks for, the plan gets what it used
+		const uint32_t required = VoiceSeekerLight_GetRequiredHeapMemoryBytes(&vsl, &vsl_config);
+		heap_size = required + VSL_PROBE_HEAP_MARGIN;
+		scratch_size = VSL_PROBE_SCRATCH_BYTES;
+		if (0 != posix_memalign(&heap_memory, 64, heap_size))
+			heap_memory = NULL;
+		if (0 != posix_memalign(&scratch_memory, 64, scratch_size))
+			scratch_memory = NULL;
+		if (heap_memory == NULL || scratch_memory == NULL) {
+			printf("VoiceSeekerLight_Create: failed to allocate the probe heap and scratch\n");
+			free(heap_memory);
+			free(scratch_memory);
+			return -1;
+		}
 
-		if ((q->size - q->num_entries) < sizeBuff) {
-			std::cout << "enqueue error" << std::endl;
-			return;
+		//With the VAD and the resamplers of a 48 kHz capture, the plan holds whatever VadGate and the
+		//settings say when the processor is opened.
+		//Resamplers owned by another instance are left alone, this one cannot resample then.
+		int32_t ret = createVoiceSeekerLight(true, resamplersTaken.load() ? 1 : VSL_RESAMPLE_MAX_FACTOR);
+		if (0 == ret) {
+			//Process silence until the first hop comes out, the scratch peak is reached by then
+			rdsp_voiceseekerlight_constants_t constants;
+			VoiceSeekerLight_GetConstants(&constants);
+			const int32_t channels = std::max((int32_t)(vsl_config.num_mics + vsl_config.num_spks), 1);
+			std::vector<float> silence((size_t)channels * constants.framesize_in, 0.0f);
+			std::vector<float*> mic(std::max((int32_t)vsl_config.num_mics, 1), silence.data());
+			std::vector<float*> ref(std::max((int32_t)vsl_config.num_spks, 1), silence.data());
+			for (uint32_t i = 0; i < mic.size(); i++)
+				mic[i] = silence.data() + i * constants.framesize_in;
+			for (uint32_t i = 0; i < vsl_config.num_spks; i++)
+				ref[i] = silence.data() + (vsl_config.num_mics + i) * constants.framesize_in;
+
+			const uint32_t frames = vsl_config.framesize_out / constants.framesize_in + 1;
+			float* vsl_out = NULL;
+			for (uint32_t i = 0; i < 2 * frames && vsl_out == NULL; i++) {
+				if (OK != VoiceSeekerLight_Process(&vsl, mic.data(), ref.data(), &vsl_out)) {
+					printf("VoiceSeekerLight_Process: probe failed\n");
+					ret = -1;
+					break;
+				}
+			}
 		}
 
-		if (avail_bytes >= sizeBuff) {
-			memcpy(q->samples + q->tail, (char*)samples_ref, sizeBuff);
-			q->tail = (q->tail + sizeBuff) % q->size;
-			q->num_entries += sizeBuff;
+		if (0 == ret) {
+			const uint32_t persistent = VoiceSeekerLightGetPersistantMemUsage(&vsl);
+			const uint32_t scratch = VoiceSeekerLightGetScratchMemUsage(&vsl);
+			heap_size = (uint32_t)AFERt::MemoryArena::alignedSize(std::max(required, persistent));
+			scratch_size = (uint32_t)AFERt::MemoryArena::alignedSize(std::max(scratch, 1u));
+			printf("VoiceSeekerLight memory plan: heap %u bytes (%u required, %u used), scratch %u bytes\n",
+				heap_size, required, persistent, scratch_size);
 		}
-		else {
-			memcpy((q->samples) + q->tail, (char*)samples_ref, avail_bytes);
-			q->tail = 0;
-			int32_t rest_of_samples = sizeBuff - avail_bytes;
-			memcpy((q->samples) + q->tail, (char*)samples_ref + avail_bytes, rest_of_samples);
-			q->tail = (q->tail + rest_of_samples) % q->size;
-			q->num_entries += sizeBuff;
+
+		free(heap_memory);
+		free(scratch_memory);
+		heap_memory = nullptr;
+		scratch_memory = nullptr;
+		memset(&vsl.mem, 0, sizeof(vsl.mem));
+		return ret;
+	}
+
+	int32_t SignalProcessor_VoiceSeekerLight::allocateWorkingBuffers() {
+		// Each buffer and each channel starts on its own cache line
+		auto carve = [](size_t bytes) { return (bytes + 63) & ~(size_t)63; };
+		// A block (period or hop, whichever entry point is used) plus the part of a frame left over from the previous one
+		const int32_t blockSize = std::max(this->_periodSize, (int32_t)VOICESEEKER_OUT_NHOP * resampleFactor);
+		accumulatorCapacity = framesize_in_mic - 1 + blockSize;
+		const size_t accumulatorChannelBytes = carve(sizeof(float) * accumulatorCapacity);
+		const size_t periodChannelBytes = carve(sizeof(float) * blockSize);
+		const size_t micPointerBytes = carve(sizeof(float*) * this->_inputChannelsCount);
+		const size_t refPointerBytes = carve(sizeof(float*) * this->_referenceChannelsCount);
+		const size_t outputHopBytes = carve(VOICESEEKER_OUT_NHOP * this->_sampleSize);
+		//Float entry points: the delayed and old reference blocks of every channel
+		const size_t delayPlaneBytes = this->floatInterface ? 2 * refPointerBytes : 0;
+		//Upsampling the output: the samples short of a frame, one frame upsampled in place and in the sample format
+		const size_t upsampleBytes = (outputFactor > 1) ? carve(sizeof(float) * (framesize_in - 1 + VOICESEEKER_OUT_NHOP)) +
+			carve(sizeof(float) * framesize_in * outputFactor) + carve((size_t)framesize_in * outputFactor * this->_sampleSize) : 0;
+		//Two more reference blocks (undelayed for the tracker, old delay while retuning) when tracking, the float entry points read both in place
+		const size_t trackingBytes = (this->delayTracking && !this->floatInterface) ? 2 * (this->_referenceChannelsCount * periodChannelBytes + refPointerBytes) : 0;
+
+		workingBytes = (this->_inputChannelsCount + this->_referenceChannelsCount) * accumulatorChannelBytes +
+			2 * (micPointerBytes + refPointerBytes) + outputHopBytes + upsampleBytes + trackingBytes + delayPlaneBytes;
+
+		//One mapping for VoiceSeekerLight and the working buffers, faulted in (and locked) before the audio runs
+		const size_t vslBytes = AFERt::MemoryArena::alignedSize(heap_size) + AFERt::MemoryArena::alignedSize(scratch_size);
+		if (0 != arena.create(vslBytes + workingBytes, memoryHugePages, memoryLock))
+			return -1;
+		heap_memory = arena.carve(heap_size);
+		scratch_memory = arena.carve(scratch_size);
+		char* next = (char*)arena.carve(workingBytes);
+		if (0 != createVoiceSeekerLight(this->vadGate && this->_WWDetection, resampleFactor)) {
+			freeWorkingBuffers();
+			return -1;
 		}
+#if RDSP_ENABLE_PAYLOAD_BUFFER
+		//Only the wake word instance exports, a ring of RDSP_BUFFER_LENGTH_SEC of output; the heap and the working
+		//buffers stay private. It holds the hops from now on, sample index outputSampleIndex at its start.
+		//Not exported is not an error.
+		if (this->payloadExport && this->_WWDetection) {
+			const uint32_t ringSamples = (uint32_t)(RDSP_BUFFER_LENGTH_SEC * vsl_constants.samplerate);
+			const std::string payloadName = AFEIpc::objectName(AFE_PAYLOAD_SHM_NAME);
+			if (0 == payloadWriter.publish(payloadName.c_str(), ringSamples, outputSampleIndex, memoryLock))
+				printf("Payload export: %s, %u samples (%.2f s) of output\n", payloadName.c_str(),
+					ringSamples, (float)ringSamples / vsl_constants.samplerate);
+		}
+#endif
+		VoiceSeekerLight_PrintConfig(&vsl); //Print VoiceSeekerLight configuration
+		VoiceSeekerLight_PrintMemOverview(&vsl); //Print VoiceSeekerLight memory overview
+
+		micAccumulator = (float**)next;
+		next += micPointerBytes;
+		refAccumulator = (float**)next;
+		next += refPointerBytes;
+		mic_in = (float**)next;
+		next += micPointerBytes;
+		ref_in = (float**)next;
+		next += refPointerBytes;
+		for (int32_t imic = 0; imic < this->_inputChannelsCount; imic++) {
+			micAccumulator[imic] = (float*)next;
+			next += accumulatorChannelBytes;
+		}
+		for (int32_t ispk = 0; ispk < this->_referenceChannelsCount; ispk++) {
+			refAccumulator[ispk] = (float*)next;
+			next += accumulatorChannelBytes;
+		}
+		outputHopBuffer = next;
+		next += outputHopBytes;
+		accumulatorFill = 0;
+		if (outputFactor > 1) {
+			upsampleAccumulator = (float*)next;
+			next += carve(sizeof(float) * (framesize_in - 1 + VOICESEEKER_OUT_NHOP));
+			upsampleFrame = (float*)next;
+			next += carve(sizeof(float) * framesize_in * outputFactor);
+			upsampleOutputBuffer = next;
+			next += carve((size_t)framesize_in * outputFactor * this->_sampleSize);
+		}
+		upsampleFill = 0;
+
+		if (this->delayTracking && !this->floatInterface) {
+			float** planar[2];
+			for (int32_t k = 0; k < 2; k++) {
+				planar[k] = (float**)next;
+				next += refPointerBytes;
+				for (int32_t ispk = 0; ispk < this->_referenceChannelsCount; ispk++) {
+					planar[k][ispk] = (float*)next;
+					next += periodChannelBytes;
+				}
+			}
+			trackerRef_in = planar[0];
+			fadeRef_in = planar[1];
+		}
+		if (this->floatInterface) {
+			refDelayed = (const float**)next;
+			next += refPointerBytes;
+			refFaded = (const float**)next;
+			next += refPointerBytes;
+		}
+
+		//Reference delay line: the delay plus the block written before the delayed one is read.
+		//When tracking, any delay up to the tracker's maximum, the retune moves the read position only.
+		const size_t frameBytes = (size_t)this->_referenceChannelsCount * this->_sampleSize;
+		const size_t maxDelay = this->delayTracking ? std::max(refDelayFrames, delayTrackerConfig.max_delay * resampleFactor) : refDelayFrames;
+		if (!this->floatInterface && 0 != refDelayLine.create(frameBytes * (maxDelay + blockSize), frameBytes * refDelayFrames)) {
+			freeWorkingBuffers();
+			return -1;
+		}
+		//The float entry points take the reference channel by channel, each gets its own line
+		if (this->floatInterface) {
+			refDelayPlanes = new AFERt::MirrorRing[this->_referenceChannelsCount];
+			for (int32_t ispk = 0; ispk < this->_referenceChannelsCount; ispk++) {
+				if (0 != refDelayPlanes[ispk].create(sizeof(float) * (maxDelay + blockSize), sizeof(float) * refDelayFrames)) {
+					freeWorkingBuffers();
+					return -1;
+				}
+			}
+		}
+
+		//Output line: hops go in as VoiceSeekerLight emits them, periods come out, primed with the latency.
+		//processHop drops the part of the priming a hop does not need.
+		//The latency is worked out at the VoiceSeekerLight rate, the line holds samples at the output rate.
+		const int32_t chunk = (outputFactor > 1) ? framesize_in : 1;
+		const int32_t periodOut = this->_periodSize / resampleFactor * outputFactor;
+		const int32_t hopOut = VOICESEEKER_OUT_NHOP * outputFactor;
+		outputLatencySamples = outputLatency(this->_periodSize / resampleFactor, framesize_in, VOICESEEKER_OUT_NHOP, chunk) * outputFactor;
+		hopLatencySamples = outputLatency(VOICESEEKER_OUT_NHOP, framesize_in, VOICESEEKER_OUT_NHOP, chunk) * outputFactor;
+		entryPoint = EntryPoint::none;
+		if (0 != outputLine.create(outputSampleSize * (std::max(outputLatencySamples + periodOut, hopLatencySamples + hopOut) + hopOut + chunk * outputFactor),
+			outputSampleSize * outputLatencySamples)) {
+			freeWorkingBuffers();
+			return -1;
+		}
+
+		printf("VoiceSeekerLight memory: %zu bytes arena on %s pages%s (heap %u, scratch %u, working buffers %zu bytes), "
+			"reference delay line %zu bytes, output latency %d samples\n",
+			arena.capacity(), arena.hugePages() ? "huge" : "4 KiB", arena.locked() ? ", locked" : "",
+			heap_size, scratch_size, workingBytes,
+			this->floatInterface ? this->_referenceChannelsCount * refDelayPlanes[0].capacity() : refDelayLine.capacity(), outputLatencySamples);
+		return 0;
+	}
+
+	void SignalProcessor_VoiceSeekerLight::freeWorkingBuffers() {
+		//Readers of the exported output drop the ring, its object is unlinked
+		payloadWriter.withdraw();
+		arena.destroy();
+		workingBytes = 0;
+		heap_memory = nullptr;
+		scratch_memory = nullptr;
+		memset(&vsl.mem, 0, sizeof(vsl.mem));
+		micAccumulator = nullptr;
+		refAccumulator = nullptr;
+		accumulatorFill = 0;
+		mic_in = nullptr;
+		ref_in = nullptr;
+		trackerRef_in = nullptr;
+		fadeRef_in = nullptr;
+		outputHopBuffer = nullptr;
+		upsampleAccumulator = nullptr;
+		upsampleFrame = nullptr;
+		upsampleOutputBuffer = nullptr;
+		upsampleFill = 0;
+		refDelayLine.destroy();
+		delete[] refDelayPlanes;
+		refDelayPlanes = nullptr;
+		refDelayed = nullptr;
+		refFaded = nullptr;
+		outputLine.destroy();
+	}
+
+	int32_t SignalProcessor_VoiceSeekerLight::sendBufferToWakeWordEngine(void* buffer, int32_t length, int32_t iteration, int32_t enable_triggering, uint64_t capture_time_ns, uint32_t flags) {
+		AFEIpc::hop_record& hop = wakeWordHops[wakeWordHopCount++];
+		// Stamped, voice_ui_app computes keyword offsets from the sample index and needs no capture of its own
+		hop.sample_index = outputSampleIndex;
+		hop.capture_time_ns = capture_time_ns;
+		hop.flags = AFE_IPC_HOP_STAMPED | flags;
+		hop.reserved = 0;
+		hop.iteration = iteration;
+		hop.enable_triggering = enable_triggering;
+		memcpy(hop.samples, buffer, length);
+
+		// Batched, the hops are published at the end of the period
+		if (wakeWordHopCount < wakeWordHops.size())
+			return 0;
+
+		return flushWakeWordHops();
+	}
+
+	int32_t SignalProcessor_VoiceSeekerLight::flushWakeWordHops() {
+		if (0 == wakeWordHopCount)
+			return 0;
+
+		// One record per hop, carrying frame, iteration and trigger flag together.
+		// A dropped hop is counted by the channel, the AFE keeps running.
+		int32_t ret = wakeWordChannel.sendHops(wakeWordHops.data(), wakeWordHopCount);
+		wakeWordHopCount = 0;
+		reportChannelStatistics(false);
+
+		return ret;
+	}
+
+	void SignalProcessor_VoiceSeekerLight::reportChannelStatistics(bool force) {
+		const AFEIpc::producer_stats& stats = wakeWordChannel.statistics();
+
+		// At most once per second, and only when something was lost
+		if (!force && (outputSampleIndex - ipcReportSampleIndex < (uint64_t)vsl_constants.samplerate ||
+			(stats.dropped_hops == ipcReported.dropped_hops && stats.reconnects == ipcReported.reconnects)))
+			return;
+
+		printf("Wake word channel: %llu hops sent, %llu dropped (+%llu), %u reconnects\n",
+			(unsigned long long)stats.sent_hops, (unsigned long long)stats.dropped_hops,
+			(unsigned long long)(stats.dropped_hops - ipcReported.dropped_hops), stats.reconnects);
+		ipcReported = stats;
+		ipcReportSampleIndex = outputSampleIndex;
 	}
 
-	void SignalProcessor_VoiceSeekerLight::dequeue(queue* q, char * samples, size_t sizeBuff) {
+	void SignalProcessor_VoiceSeekerLight::reportClipping(bool force) {
+		// At most once per second, and only when the output clipped again
+		if (!force && (outputSampleIndex - clipReportSampleIndex < (uint64_t)vsl_constants.samplerate || clippedSamples == clipReported))
+			return;
 
-		if (sizeBuff > q->num_entries) {
-			memset(samples, 0, sizeBuff);
-			std::cout << "dequeue error" << std::endl;
+		printf("Clean mic output: %llu samples clipped (+%llu)\n",
+			(unsigned long long)clippedSamples, (unsigned long long)(clippedSamples - clipReported));
+		clipReported = clippedSamples;
+		clipReportSampleIndex = outputSampleIndex;
+	}
+
+	//CPU time of the resamplers, the figure to set against ALSA's plug resampling the capture instead
+	void SignalProcessor_VoiceSeekerLight::reportResampling(bool force) {
+		if (resampleFactor < 2 || outputSampleIndex == resampleReportSampleIndex)
+			return;
+		// Every VSL_RESAMPLE_REPORT_SEC seconds of output
+		if (!force && outputSampleIndex - resampleReportSampleIndex < (uint64_t)(VSL_RESAMPLE_REPORT_SEC * vsl_constants.samplerate))
 			return;
+
+		const double audio_ms = (outputSampleIndex - resampleReportSampleIndex) * 1000.0 / vsl_constants.samplerate;
+		const double resample_ms = resampleNs / 1e6;
+		printf("Resampling %d Hz: %.3f ms per second of audio (%.2f%% of one core), %.1f%% of the processing time\n",
+			this->_sampleRate, resample_ms * 1000.0 / audio_ms, 100.0 * resample_ms / audio_ms,
+			(0 != processNs) ? 100.0 * resampleNs / processNs : 0.0);
+		resampleNs = 0;
+		processNs = 0;
+		resampleReportSampleIndex = outputSampleIndex;
+	}
+
+	//Upsamples an output hop to the capture rate, whole frames at a time, the rest waits for the next hop
+	void SignalProcessor_VoiceSeekerLight::upsampleToOutput(const float* hop) {
+		const uint64_t resample_start_ns = AFEIpc::monotonicTimeNs();
+		memcpy(upsampleAccumulator + upsampleFill, hop, sizeof(float) * VOICESEEKER_OUT_NHOP);
+		upsampleFill += VOICESEEKER_OUT_NHOP;
+
+		int32_t offset = 0;
+		for (; upsampleFill - offset >= framesize_in; offset += framesize_in) {
+			memcpy(upsampleFrame, upsampleAccumulator + offset, sizeof(float) * framesize_in);
+			VoiceSeekerLight_MicResample_Upsample_Process(&upsampleFrame, 1);
+			if (this->floatInterface)
+				outputLine.write(upsampleFrame, sizeof(float) * framesize_in * outputFactor);
+			else {
+				clippedSamples += rdsp_float_interleave_to_pcm(&upsampleFrame, upsampleOutputBuffer, framesize_in * outputFactor, 1, this->_pcmFormat);
+				outputLine.write(upsampleOutputBuffer, (size_t)this->_sampleSize * framesize_in * outputFactor);
+			}
 		}
 
-		if ((q->size - q->head) >= sizeBuff) {
-			memcpy(samples, q->samples + q->head, sizeBuff);
-			q->head = (q->head + sizeBuff) % q->size;
-			q->num_entries -= sizeBuff;
-		} else {
-			int32_t avail_bytes = (q->size - q->head);
-			memcpy(samples, q->samples + q->head, avail_bytes);
-			q->head = 0;
-			int32_t rest_of_samples = sizeBuff - avail_bytes;
-			memcpy(samples + avail_bytes, (q->samples) + q->head, rest_of_samples);
-			q->head = rest_of_samples;
-			q->num_entries -= sizeBuff;
-		}
-	}
-
-	int32_t SignalProcessor_VoiceSeekerLight::sendBufferToWakeWordEngine(void* buffer, int32_t length, int32_t iteration, int32_t enable_triggering) {
-		mqd_t mq;
-		mqd_t iter;
-		mqd_t trigg;
-
-		// Open the mail queue
-		mq = mq_open("/voicespot_vslout", O_WRONLY);
-		iter = mq_open("/voiceseeker_iterations", O_WRONLY);
-		trigg = mq_open("/voiceseeker_trigger", O_WRONLY);
-		CHECK((mqd_t)-1 != mq);
-		CHECK((mqd_t)-1 != iter);
-		CHECK((mqd_t)-1 != trigg);
-
-		// End the message
-		CHECK(0 <= mq_send(mq, (char*)buffer, length, 0));
-		CHECK(0 <= mq_send(iter, (char*)&iteration, sizeof(int32_t), 0));
-		CHECK(0 <= mq_send(trigg, (char*)&enable_triggering, sizeof(int32_t), 0));
-
-		// Cleanup
-		mq_close(mq);
-		mq_close(iter);
-		mq_close(trigg);
+		upsampleFill -= offset;
+		if (upsampleFill > 0 && offset > 0)
+			memmove(upsampleAccumulator, upsampleAccumulator + offset, sizeof(float) * upsampleFill);
+		resampleNs += AFEIpc::monotonicTimeNs() - resample_start_ns;
+	}
 
-		return 0;
+	void SignalProcessor_VoiceSeekerLight::setInstance(int32_t index, bool wakeWord) {
+		instanceIndex = index;
+		instanceWakeWord = wakeWord;
+	}
+
+	//Frames of capture a hop consumes, it produces as many unless the output stays at the VoiceSeekerLight rate (ResampleOutput = 0)
+	int32_t SignalProcessor_VoiceSeekerLight::getHopSize() const {
+		return VOICESEEKER_OUT_NHOP * resampleFactor;
+	}
+
+	int32_t SignalProcessor_VoiceSeekerLight::getLatency() const {
+		return (EntryPoint::hop == entryPoint) ? hopLatencySamples : outputLatencySamples;
+	}
+
+	int32_t SignalProcessor_VoiceSeekerLight::getInterfaceVersion() const {
+		return SIGNAL_PROCESSOR_INTERFACE_VERSION;
+	}
+
+	uint32_t SignalProcessor_VoiceSeekerLight::getCapabilities() const {
+		return SIGNAL_PROCESSOR_CAP_PCM_INTERLEAVED | SIGNAL_PROCESSOR_CAP_PCM_HOP | SIGNAL_PROCESSOR_CAP_FLOAT_PLANAR | SIGNAL_PROCESSOR_CAP_FLOAT_HOP;
 	}
 
-	int32_t SignalProcessor_VoiceSeekerLight::getKeyWordOffsetFromWakeWordEngine() {
-		mqd_t mq;
-		int32_t offset;
-		int32_t bytes_read;
+	uint64_t SignalProcessor_VoiceSeekerLight::getClippedSamples() const {
+		return clippedSamples;
+	}
+
+	//Moves the read position of the delay line to the tracker's delay and re-reads the period there.
+	//Returns the period at the old delay, nullptr when the delay did not change.
+	const char* SignalProcessor_VoiceSeekerLight::retuneDelayLine(const char** delayed, size_t periodBytes) {
+		const int32_t newDelay = delayTracker.targetDelay();
+		if (newDelay == refDelayFrames)
+			return nullptr;
+
+		//The bytes between the two read positions are still in the ring, it holds the maximum delay plus a period
+		const ptrdiff_t frameBytes = (ptrdiff_t)this->_referenceChannelsCount * this->_sampleSize;
+		const char* old = *delayed;
+		if (!refDelayLine.seek((ptrdiff_t)(refDelayFrames - newDelay) * frameBytes - (ptrdiff_t)periodBytes))
+			return nullptr;
+		*delayed = refDelayLine.read(periodBytes);
+
+		refDelayFrames = newDelay;
+		return old;
+	}
+
+	//retuneDelayLine for the delay lines of the float entry points, refFaded gets the blocks at the old delay
+	bool SignalProcessor_VoiceSeekerLight::retuneDelayPlanes(size_t channelBytes) {
+		const int32_t newDelay = delayTracker.targetDelay();
+		if (newDelay == refDelayFrames)
+			return false;
+
+		//All lines hold as many samples, a seek out of range fails on the first one
+		for (int32_t ispk = 0; ispk < this->_referenceChannelsCount; ispk++) {
+			if (!refDelayPlanes[ispk].seek((ptrdiff_t)(refDelayFrames - newDelay) * (ptrdiff_t)sizeof(float) - (ptrdiff_t)channelBytes))
+				return false;
+			refFaded[ispk] = refDelayed[ispk];
+			refDelayed[ispk] = (const float*)refDelayPlanes[ispk].read(channelBytes);
+		}
+
+		refDelayFrames = newDelay;
+		return true;
+	}
+
+	int32_t SignalProcessor_VoiceSeekerLight::getReferenceDelay() const {
+		return refDelayFrames;
+	}
+
+	int32_t SignalProcessor_VoiceSeekerLight::getDelayEstimate() const {
+		return this->delayTracking ? delayTracker.estimate() : -1;
+	}
+
+	float SignalProcessor_VoiceSeekerLight::getDelayConfidence() const {
+		return this->delayTracking ? delayTracker.confidence() : 0.0f;
+	}
 
-		// Open the mail queue
-		mq = mq_open("/voicespot_offset", O_RDONLY);
-		CHECK((mqd_t)-1 != mq);
+	uint64_t SignalProcessor_VoiceSeekerLight::getDroppedHops() const {
+		return wakeWordChannel.statistics().dropped_hops;
+	}
 
-		// Send the message
-		bytes_read = mq_receive(mq, (char*)&offset, sizeof(int32_t), NULL);
+	uint32_t SignalProcessor_VoiceSeekerLight::getReconnects() const {
+		return wakeWordChannel.statistics().reconnects;
+	}
 
-		// Cleanup
-		mq_close(mq);
+	int32_t SignalProcessor_VoiceSeekerLight::applyPendingTriggers() {
+		AFEIpc::trigger_record trigger;
+		int32_t applied = 0;
+		const uint64_t windback_samples = (uint64_t)(RDSP_BUFFER_LENGTH_SEC * vsl_constants.samplerate);
+
+		while (wakeWordChannel.pollTrigger(trigger)) {
+			//The wake word engine runs behind the AFE, rebase its offset to the latest processed sample
+			uint64_t lateness = (outputSampleIndex > trigger.sample_index) ? outputSampleIndex - trigger.sample_index : 0;
+			uint64_t offset = (uint64_t)trigger.offset + lateness;
+
+			triggerLatenessTotal += lateness;
+			if (lateness > triggerLatenessMax)
+				triggerLatenessMax = lateness;
+			if (lateness > triggerLatencyBudget)
+				triggersOverBudget++;
+			triggersApplied++;
+
+			const float samples_per_ms = vsl_constants.samplerate / 1000.0f;
+			printf("Trigger applied %.1f ms late (delivery %.2f ms), mean %.1f ms, max %.1f ms, over budget %u/%u\n",
+				lateness / samples_per_ms, (AFEIpc::monotonicTimeNs() - trigger.detect_time_ns) / 1e6f,
+				triggerLatenessTotal / samples_per_ms / triggersApplied, triggerLatenessMax / samples_per_ms,
+				triggersOverBudget, triggersApplied);
+
+			if (offset > windback_samples) {
+				printf("Trigger dropped, keyword start is %llu samples back, buffer holds %llu\n",
+					(unsigned long long)offset, (unsigned long long)windback_samples);
+				continue;
+			}
+
+			VoiceSeekerLight_TriggerFound(&vsl, (uint32_t)offset);
+			applied++;
+		}
 
-		return offset;
+		return applied;
 	}
 
 	MachineInfo SignalProcessor_VoiceSeekerLight::getMachineInfo() {
@@ -21,13 +21,25 @@
 #include <string>
 #include <alsa/asoundlib.h>
 #include <vector>
+#include <atomic>
+#include <algorithm>
 #include <exception>
 #include <mqueue.h>
 
 #include <RdspAppUtilities.h>
+#include <RdspPcmConvert.h>
 #include <RdspWavfile.h>
 #include <RdspCycleCounter.h>
 #include <AFEConfigState.h>
+#include <AFEIpcChannel.h>
+#include <AFEPayload.h>
+#include <AFEAllocCheck.h>
+#include <AFEMemoryArena.h>
+#include <AFEMirrorRing.h>
+#include <AFEWavRecorder.h>
+#include "ReferenceDelayTracker.h"
+#include "TuningStore.h"
+#include "TuningWatcher.h"
 
 #define MAXSTR 1023
 
@@ -35,14 +47,14 @@
 #define	RDSP_VOICESEEKER_LIGHT_APP_VERSION_MINOR	2 // Minor version the app
 #define	RDSP_VOICESEEKER_LIGHT_APP_VERSION_PATCH	8 // Patch version the app
 
-#define RDSP_ENABLE_VAD 0
+#define RDSP_ENABLE_VAD 1 // Built in, runs with VadGate = 1 (Config.ini)
 #ifdef AEC
 #define RDSP_ENABLE_AEC 1
 #else
 #define RDSP_ENABLE_AEC 0
 #endif // AEC
 #define RDSP_ENABLE_VOICESPOT 1
-#define RDSP_ENABLE_PAYLOAD_BUFFER 1
+#define RDSP_ENABLE_PAYLOAD_BUFFER 1 // Built in, exported with PayloadExport = 1 (Config.ini), RDSP_BUFFER_LENGTH_SEC long
 #define RDSP_ENABLE_AGC 0
 #define RDSP_BUFFER_LENGTH_SEC 1.5f
 #define RDSP_AEC_FILTER_LENGTH_MS 150 // TODO: can AEC filter length be reduced?
@@ -50,6 +62,12 @@
 
 #define VOICESEEKER_OUT_NHOP 200
 
+#define VSL_PROBE_HEAP_MARGIN 200000	//Heap on top of VoiceSeekerLight_GetRequiredHeapMemoryBytes for the probe instance only
+#define VSL_PROBE_SCRATCH_BYTES 65536	//Scratch of the probe instance, the plan keeps what it used
+
+#define VSL_RESAMPLE_MAX_FACTOR 3		//48 kHz capture, the memory plan holds the resamplers for it
+#define VSL_RESAMPLE_REPORT_SEC 10		//Interval of the resampling CPU report
+
 #define MINUTE_INTERVAL_WAV_FILE 3		//Interval of minutes for saving audio files for delay analysis (Saves files every 3 minutes)
 
 #define CHECK(x) \
@@ -81,19 +99,13 @@ namespace SignalProcessor {
 			filtering
 		};
 
-		//Define structure for circular buffer
-		typedef struct {
-			char* samples;
-			int32_t head, tail;
-			size_t size, num_entries;
-		} queue;
-
 		//Signal processor customization, we "need" these for the implementation
 		static const std::string _jsonConfigDescription; //JSON configuration
 		VoiceSeekerLightSignalProcessorState _state; //State identifier
 		size_t _sampleSize; //Size of samples in bytes. Parameter derived out of _sampleFormat variable
 		int32_t _sampleRate; //Selected sample rate.
 		snd_pcm_format_t _sampleFormat = SND_PCM_FORMAT_S32_LE; //Selected sample format. The number should correspond to ALSA formats
+		rdsp_pcm_format _pcmFormat = RDSP_PCM_FORMAT_S32_LE; //_sampleFormat for the PCM conversions
 		int32_t _periodSize; //Selected period size
 		int32_t _inputChannelsCount; //Selected input channels count
 		int32_t _referenceChannelsCount; //Selected reference channels count
@@ -106,26 +118,125 @@ namespace SignalProcessor {
 		int32_t framesize_in_mic;
 		int32_t framesize_in_ref;
 
+		//32/48 kHz capture: whole frames are decimated in place by the library's mic and speaker resamplers
+		int32_t resampleFactor; //Capture rate over the VoiceSeekerLight rate, 1 to VSL_RESAMPLE_MAX_FACTOR
+		bool resampleOutput; //Clean output upsampled back to the capture rate (ResampleOutput), VoiceSeekerLight rate otherwise
+		int32_t outputFactor; //resampleFactor when the output is upsampled, 1 otherwise
+		bool ownsResamplers;
+		static std::atomic<bool> resamplersTaken; //The library has one mic and one speaker resampler per process
+		float* upsampleAccumulator; //Output samples not upsampled yet, the upsampler takes whole frames
+		int32_t upsampleFill;
+		float* upsampleFrame; //One frame upsampled in place
+		char* upsampleOutputBuffer; //The same in the sample format
+		uint64_t resampleNs; //Time spent resampling and processing in total since the last report
+		uint64_t processNs;
+		uint64_t resampleReportSampleIndex;
+
+		//Measured in the constructor on a probe instance, carved out of the arena in openProcessor
 		uint32_t heap_size;
 		void* heap_memory;
 		uint32_t scratch_size;
 		void* scratch_memory;
+		bool memoryHugePages;
+		bool memoryLock;
+
+		int32_t delaySamples;  //Delay in number of samples at 16 kHz (RefSignalDelay)
+		int32_t refDelayFrames; //Delay applied in capture frames, delaySamples * resampleFactor at open, then retuned by the tracker
+		AFERt::MirrorRing refDelayLine; //Reference delay line, sized in openProcessor from refDelayFrames (or the tracker's maximum) and the period
+		AFERt::MirrorRing* refDelayPlanes; //Float entry points: one delay line of float samples per reference channel instead
+		const float** refDelayed; //Delayed block of every reference channel, read in place
+		const float** refFaded; //Same at the previous delay while retuning
 
-		int32_t sizeBuffDelay; //Number of bytes should be changed carefully depending on delay samples
-		int32_t delaySamples;  //Delay in number of samples
-		queue circularBuffDelay; //Circular buffer for delay
+		//Opened with "interface_version" 2: the float entry points take and return float samples, the PCM ones are refused
+		bool floatInterface;
+		size_t outputSampleSize; //Bytes of a sample in the output line, _sampleSize or a float
+
+		//Reference delay tracking: a background thread measures the delay, processSignal retunes refDelayLine
+		bool delayTracking;
+		delay_tracker_config delayTrackerConfig;
+		ReferenceDelayTracker delayTracker;
+
+		//Tuning of the library's sysdefs at open (TuningDir), then a user sysdefs file applied at runtime (TuningFile).
+		//The library's parameters are process wide.
+		std::string tuningDir;
+		std::string tuningCacheDir;
+		std::string tuningFile;
+		uint32_t tuningPollMs;
+		bool ownsTuning;
+		static std::atomic<bool> tuningTaken;
+		TuningStore tuningStore;
+		TuningWatcher tuning;
 		bool debugEnable;
+		bool vadGate; //VAD on every output hop, voice_ui_app skips the wake word engine on the hops without speech
+		bool payloadExport; //Output hops copied to a shared ring, voice_ui_app reads the VIT pre-roll from it
+		AFEIpc::PayloadWriter payloadWriter; //The shared ring, published while the hops are written to it
 
 		float** ref_in; //Input reference buffer
 		float** mic_in; //Input mic buffer
+		float** trackerRef_in; //Undelayed reference frame for the delay tracker
+		float** fadeRef_in; //Reference frame at the previous delay while retuning
+
+		//VoiceSeekerLight heap and scratch and the working buffers of processSignal, carved out of one arena mapped in openProcessor
+		AFERt::MemoryArena arena;
+		size_t workingBytes;
+		char* outputHopBuffer; //One VoiceSeekerLight output hop in the sample format
+
+		//Any period size: planar input accumulators of whole VoiceSeekerLight frames, and the hops queued for the output periods
+		float** micAccumulator;
+		float** refAccumulator;
+		int32_t accumulatorCapacity; //Samples per channel, a period plus the rest of a frame
+		int32_t accumulatorFill; //Samples per channel not processed yet
+		AFERt::MirrorRing outputLine;
+		int32_t outputLatencySamples; //Silence queued in front of the output, 0 when the period is a multiple of the hop
+		int32_t hopLatencySamples; //Same for processHop, 0 when the frame divides the hop
+
+		//Entry point used since openProcessor, processSignal and processHop are not mixed
+		enum class EntryPoint {
+			none,
+			period,
+			hop
+		};
+		EntryPoint entryPoint;
+		uint64_t outputUnderruns;
 
 		int32_t iteration;
 		int32_t disable_trigger_frame_counter;
 
+		//Channel carrying VoiceSeekerLight output to the wake word engine (voice_ui_app)
+		AFEIpc::Transport ipcTransport;
+		AFEIpc::OverflowPolicy ipcOverflowPolicy;
+		int32_t ipcBlockTimeoutMs;
+		AFEIpc::producer_stats ipcReported; //Counters at the last report
+		uint64_t ipcReportSampleIndex; //outputSampleIndex at the last report
+		AFEIpc::HopProducer wakeWordChannel;
+		bool ipcBatchHops; //Publish all hops of a period at once instead of after each hop
+		std::vector<AFEIpc::hop_record> wakeWordHops; //Hops of the current period not yet published
+		uint32_t wakeWordHopCount;
+		uint64_t outputSampleIndex; //Index of the next VoiceSeekerLight output sample
+
+		//Clean mic output samples saturated in the conversion to the sample format
+		uint64_t clippedSamples;
+		uint64_t clipReported; //clippedSamples at the last report
+		uint64_t clipReportSampleIndex; //outputSampleIndex at the last report
+
+		//Latency budget of the asynchronous trigger path, lateness is counted in output samples
+		uint32_t triggerLatencyBudget;
+		uint32_t triggersApplied;
+		uint32_t triggersOverBudget;
+		uint64_t triggerLatenessTotal;
+		uint64_t triggerLatenessMax;
+
+		//Position in a VoiceSeekerLightPool, set before openProcessor
+		int32_t instanceIndex;
+		bool instanceWakeWord; //false keeps the instance off the wake word channel
+
 		//Create audio files for delay debuggin
-		rdsp_wav_file_t fid_mic_delay;
-		rdsp_wav_file_t fid_ref_delay;
-		rdsp_wav_file_t fid_mic_out;
+		enum {
+			DEBUG_WAV_MIC_IN,
+			DEBUG_WAV_REF_IN,
+			DEBUG_WAV_MIC_OUT
+		};
+		AFERt::WavRecorder* debugRecorder; //Created in openProcessor while DebugEnable = 1
 		bool fid_delay_files_open;
 		int32_t num_delay_files;
 		// Specify mic geometry
@@ -134,31 +245,62 @@ namespace SignalProcessor {
 
 		void setDefaultSettings(); //Sets the signal processors settings to default values.
 
-		//Functions for delay buffer
-		void initQueue(queue* q, size_t samples_delay, size_t maxSize);
-		void queueDestroy(queue* q);
-		void enqueue(queue* q, const char* samples_ref, size_t sizeBuff);
-		void dequeue(queue* q, char* samples, size_t sizeBuff);
+		//Heap and scratch sizes of a VoiceSeekerLight instance, measured on a probe instance
+		int32_t planMemory();
+		//Creates VoiceSeekerLight (and its VAD and resamplers for a capture rate of resample times its own) in heap_memory/scratch_memory
+		int32_t createVoiceSeekerLight(bool vad, int32_t resample);
+		//Working buffers, the audio path never touches the heap
+		int32_t allocateWorkingBuffers();
+		void freeWorkingBuffers();
+		const char* retuneDelayLine(const char** delayed, size_t periodBytes);
+		bool retuneDelayPlanes(size_t channelBytes);
+		bool selectEntryPoint(EntryPoint wanted, bool floatSamples);
+		int32_t processBlock(const char* nChannelMicBuffer, const char* nChannelRefBuffer, int32_t frames, char* cleanMicBuffer);
+		int32_t processBlockFloat(const float* const* micChannels, const float* const* refChannels, int32_t frames, float* cleanMic);
+		int32_t processFrames(int32_t frames, uint64_t block_start_ns, char* cleanMicBuffer, size_t cleanMicBufferSize);
+		void upsampleToOutput(const float* hop);
 
-		int32_t sendBufferToWakeWordEngine(void* buffer, int32_t length, int32_t iteration, int32_t enable_triggering);
-		int32_t getKeyWordOffsetFromWakeWordEngine();
+		int32_t sendBufferToWakeWordEngine(void* buffer, int32_t length, int32_t iteration, int32_t enable_triggering, uint64_t capture_time_ns, uint32_t flags);
+		int32_t flushWakeWordHops();
+		int32_t applyPendingTriggers();
+		void reportChannelStatistics(bool force);
+		void reportClipping(bool force);
+		void reportResampling(bool force);
 
 	public:
 		//Construtor, initializes internal resources
 		SignalProcessor_VoiceSeekerLight();
+		~SignalProcessor_VoiceSeekerLight();
 
 		//This set of functions come from the base class and we need to implement them all
 		int32_t openProcessor(const std::unordered_map<std::string, std::string>* settings = nullptr);
 		int32_t closeProcessor();
+		//No heap allocation once opened, DebugEnable = 1 included (WAV files written on a background thread), build with ALLOC_CHECK=1 to verify it
 		int32_t processSignal(const char* nChannelMicBuffer, size_t micBufferSize,
 			const char* nChannelRefBuffer, size_t refBufferSize,
 			char* cleanMicBuffer, size_t cleanMicBufferSize);
+		//One VOICESEEKER_OUT_NHOP hop in, one out, instead of processSignal
+		int32_t processHop(const char* nChannelMicHop, size_t micHopSize,
+			const char* nChannelRefHop, size_t refHopSize,
+			char* cleanMicHop, size_t cleanMicHopSize) override;
+		int32_t getHopSize() const override;
+		int32_t getLatency() const override;
+		//Version 2: the same entry points on non-interleaved float samples, after opening with "interface_version" 2
+		int32_t processSignalFloat(const const_float_span& nChannelMic, const const_float_span& nChannelRef,
+			const float_span& cleanMic) override;
+		int32_t processHopFloat(const const_float_span& nChannelMicHop, const const_float_span& nChannelRefHop,
+			const float_span& cleanMicHop) override;
+		int32_t getInterfaceVersion() const override;
+		uint32_t getCapabilities() const override;
 
 		//Returns the complete configuration space in JSON fromat
 		const std::string& getJsonConfigurations() const override;
 
 		//Set of functions returning the basic features supported by the signal processor.
+		//The capture rate, 16, 32 or 48 kHz ("sample_rate" of the settings)
 		int32_t getSampleRate() const override;
+		//Rate of the clean output: the capture rate, or 16 kHz with ResampleOutput = 0
+		int32_t getOutputSampleRate() const;
 		int32_t getPeriodSize() const override;
 		int32_t getInputChannelsCount() const override;
 		int32_t getReferenceChannelsCount() const override;
@@ -166,6 +308,19 @@ namespace SignalProcessor {
 
 		uint32_t getVersionNumber() const override;
 		MachineInfo getMachineInfo();
+
+		//Instance index in a VoiceSeekerLightPool (debug file names) and whether it feeds the wake word engine, before openProcessor
+		void setInstance(int32_t index, bool wakeWord);
+
+		//Wake word channel counters, hops lost to overflow/missing voice_ui_app and re-attachments after its restart
+		uint64_t getDroppedHops() const;
+		uint32_t getReconnects() const;
+		//Clean mic output samples clipped since openProcessor
+		uint64_t getClippedSamples() const;
+		//Reference delay applied now, and the tracker's latest measurement (-1 and 0 before the first one or without tracking), in capture frames
+		int32_t getReferenceDelay() const;
+		int32_t getDelayEstimate() const;
+		float getDelayConfidence() const;
 	};
 
 }
@@ -0,0 +1,166 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include "TuningStore.h"
+
+#include <RdspSysdefsParser.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace SignalProcessor {
+
+	static uint32_t recordsHash(const uint32_t* words, size_t count) {
+		uint32_t hash = 2166136261u;
+		const uint8_t* bytes = (const uint8_t*)words;
+		for (size_t i = 0; i < count * sizeof(uint32_t); i++)
+			hash = (hash ^ bytes[i]) * 16777619u;
+		return hash;
+	}
+
+	static int64_t mtimeNs(const struct stat& info) {
+		return (int64_t)info.st_mtim.tv_sec * 1000000000ll + info.st_mtim.tv_nsec;
+	}
+
+	TuningStore::TuningStore() : mapping{ nullptr }, size{ 0 }, words{ nullptr }, count{ 0 }, parameters{ 0 } {
+	}
+
+	TuningStore::~TuningStore() {
+		unload();
+	}
+
+	int32_t TuningStore::load(const std::string& tuning_dir, const std::string& cache_dir, uint32_t checksum) {
+		unload();
+
+		char name[32];
+		snprintf(name, sizeof(name), "vsl_tuning_%08X", checksum);
+		const std::string xml = tuning_dir + "/" + name + ".xml";
+		const std::string image = cache_dir + "/" + name + ".bin";
+
+		struct stat source;
+		const bool has_source = (0 == stat(xml.c_str(), &source));
+		if (0 == map(image, checksum, has_source ? &source : nullptr))
+			return 0;
+		if (!has_source)
+			return 1;
+
+		//First start with this XML (or it changed): compile, then use the image like any later start
+		if (0 != compile(xml, image, checksum, source))
+			return -1;
+		return map(image, checksum, &source);
+	}
+
+	//The image of checksum, compiled from source when given. -1 when it is missing, stale or damaged.
+	int32_t TuningStore::map(const std::string& image, uint32_t checksum, const struct stat* source) {
+		int fd = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return -1;
+		struct stat info;
+		void* area = MAP_FAILED;
+		if (0 == fstat(fd, &info) && (size_t)info.st_size >= sizeof(tuning_image_header))
+			area = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+		close(fd);
+		if (MAP_FAILED == area)
+			return -1;
+
+		const tuning_image_header* header = (const tuning_image_header*)area;
+		const uint32_t* records = (const uint32_t*)(header + 1);
+		const char* problem = nullptr;
+		if (TUNING_IMAGE_MAGIC != header->magic || TUNING_IMAGE_VERSION != header->version || checksum != header->checksum)
+			problem = "not an image of these sysdefs";
+		else if ((size_t)info.st_size != sizeof(tuning_image_header) + (size_t)header->words * sizeof(uint32_t))
+			problem = "truncated";
+		else if (nullptr != source && (mtimeNs(*source) != header->source_mtime_ns || (int64_t)source->st_size != header->source_size))
+			problem = "out of date, its XML changed";
+		else if (recordsHash(records, header->words) != header->hash)
+			problem = "damaged";
+		if (nullptr != problem) {
+			printf("Tuning image %s %s\n", image.c_str(), problem);
+			munmap(area, (size_t)info.st_size);
+			return -1;
+		}
+
+		mapping = area;
+		size = (size_t)info.st_size;
+		words = records;
+		count = header->words;
+		parameters = header->parameters;
+		printf("Tuning image %s: %u parameters\n", image.c_str(), parameters);
+		return 0;
+	}
+
+	int32_t TuningStore::compile(const std::string& xml, const std::string& image, uint32_t checksum, const struct stat& source) {
+		std::vector<uint32_t> records(RDSP_SYSDEFS_MAX_WORDS);
+		uint32_t file_checksum = 0;
+		const int32_t words = parse_user_sysdefs_xml(xml.c_str(), &file_checksum, records.data(), (int32_t)records.size());
+		if (words < 0)
+			return -1;
+		if (file_checksum != checksum) {
+			printf("Tuning: %s says sysdefs 0x%08X, its name 0x%08X\n", xml.c_str(), file_checksum, checksum);
+			return -1;
+		}
+
+		tuning_image_header header = {};
+		header.magic = TUNING_IMAGE_MAGIC;
+		header.version = TUNING_IMAGE_VERSION;
+		header.checksum = checksum;
+		header.words = (uint32_t)words;
+		for (int32_t i = 0; i < words; i += 2 + records[i + 1])
+			header.parameters++;
+		header.hash = recordsHash(records.data(), (size_t)words);
+		header.source_mtime_ns = mtimeNs(source);
+		header.source_size = (int64_t)source.st_size;
+
+		//Written aside and renamed, an AFE starting meanwhile never maps half an image
+		const std::string temporary = image + ".tmp";
+		FILE* file = fopen(temporary.c_str(), "wb");
+		bool written = (nullptr != file) && 1 == fwrite(&header, sizeof(header), 1, file) &&
+			(size_t)words == fwrite(records.data(), sizeof(uint32_t), (size_t)words, file);
+		if (nullptr != file)
+			written = (0 == fclose(file)) && written;
+		if (!written || 0 != rename(temporary.c_str(), image.c_str())) {
+			printf("Tuning: cannot write %s: %s\n", image.c_str(), strerror(errno));
+			unlink(temporary.c_str());
+			return -1;
+		}
+		printf("Tuning: %s compiled to %s, %u parameters\n", xml.c_str(), image.c_str(), header.parameters);
+		return 0;
+	}
+
+	void TuningStore::unload() {
+		if (nullptr != mapping)
+			munmap(mapping, size);
+		mapping = nullptr;
+		size = 0;
+		words = nullptr;
+		count = 0;
+		parameters = 0;
+	}
+
+	bool TuningStore::loaded() const {
+		return nullptr != mapping;
+	}
+
+	uint32_t TuningStore::apply(RETUNE_VOICESEEKERLIGHT_plugin_t* vsl) const {
+		return setParameters(vsl, words, count);
+	}
+
+	uint32_t TuningStore::parameterCount() const {
+		return parameters;
+	}
+
+	uint32_t TuningStore::setParameters(RETUNE_VOICESEEKERLIGHT_plugin_t* vsl, const uint32_t* words, size_t count) {
+		uint32_t rejected = 0;
+		for (size_t i = 0; i + 1 < count && i + 2 + words[i + 1] <= count; i += 2 + words[i + 1]) {
+			if (OK != VoiceSeekerLight_SetParameterID(vsl, words[i], words[i + 1], const_cast<uint32_t*>(&words[i + 2])))
+				rejected++;
+		}
+		return rejected;
+	}
+}
@@ -0,0 +1,71 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#ifndef __TuningStore_h__
+#define __TuningStore_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+
+#include <libVoiceSeekerLight.h>
+
+#define TUNING_IMAGE_MAGIC 0x544C5356		// "VSLT"
+#define TUNING_IMAGE_VERSION 1
+
+namespace SignalProcessor {
+
+	//Header of a parameter image, followed by its parse_user_sysdefs_xml records
+	typedef struct tuning_image_header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t checksum;				// sysdefs_checksum the records are for
+		uint32_t words;					// Words of records after the header
+		uint32_t parameters;
+		uint32_t hash;					// FNV-1a of the records
+		int64_t source_mtime_ns;		// XML the image was compiled from
+		int64_t source_size;
+	} tuning_image_header;
+
+	/*
+	 * Tuning of the VoiceSeekerLight sysdefs at hand, found by checksum.
+	 *
+	 * The tuning of sysdefs C is the user sysdefs XML vsl_tuning_<C>.xml
+	 * (8 hex digits) in the tuning directory. The first start compiles it
+	 * into a parameter image, vsl_tuning_<C>.bin in the cache directory.
+	 * Later starts map the image and set its records as they are, nothing
+	 * is parsed: the XML is only checked for a change (time and size). An
+	 * image without its XML is used as it is, a deployment can ship images only.
+	 */
+	class TuningStore {
+
+		void* mapping;
+		size_t size;
+		const uint32_t* words;
+		uint32_t count;
+		uint32_t parameters;
+
+		int32_t map(const std::string& image, uint32_t checksum, const struct stat* source);
+		int32_t compile(const std::string& xml, const std::string& image, uint32_t checksum, const struct stat& source);
+
+	public:
+		TuningStore();
+		~TuningStore();
+
+		//Maps (compiling it first when needed) the image of checksum. 1 when there is no tuning for it, -1 on an error.
+		int32_t load(const std::string& tuning_dir, const std::string& cache_dir, uint32_t checksum);
+		void unload();
+		bool loaded() const;
+
+		//Sets the loaded image, returns the parameters VoiceSeekerLight did not know
+		uint32_t apply(RETUNE_VOICESEEKERLIGHT_plugin_t* vsl) const;
+		uint32_t parameterCount() const;
+
+		//Sets count words of records in one pass, returns the parameters VoiceSeekerLight did not know
+		static uint32_t setParameters(RETUNE_VOICESEEKERLIGHT_plugin_t* vsl, const uint32_t* words, size_t count);
+	};
+}
+
+#endif
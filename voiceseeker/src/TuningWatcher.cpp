@@ -0,0 +1,158 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include "TuningWatcher.h"
+#include "TuningStore.h"
+
+#include <AFERtThread.h>
+#include <RdspSysdefsParser.h>
+
+#include <chrono>
+#include <cstdio>
+#include <sys/stat.h>
+
+namespace SignalProcessor {
+
+	TuningWatcher::TuningWatcher() : checksum{ 0 }, poll_ms{ 0 }, pending{ nullptr }, retired{ nullptr }, applied_sets{ 0 },
+		modified_sec{ 0 }, modified_nsec{ 0 }, modified_size{ 0 }, modified_inode{ 0 }, stopping{ false } {
+	}
+
+	TuningWatcher::~TuningWatcher() {
+		stop();
+	}
+
+	int32_t TuningWatcher::start(const std::string& path, uint32_t checksum, uint32_t poll_ms) {
+		stop();
+
+		this->path = path;
+		this->checksum = checksum;
+		this->poll_ms = (0 != poll_ms) ? poll_ms : 1;
+		applied_sets.store(0);
+		modified_sec = 0;
+		modified_nsec = 0;
+		modified_size = 0;
+		modified_inode = 0;
+
+		//The first set is there for the first hop already
+		if (changed())
+			load();
+		else
+			printf("Tuning: %s not found, waiting for it\n", path.c_str());
+
+		stopping = false;
+		worker = std::thread(&TuningWatcher::run, this);
+		return 0;
+	}
+
+	void TuningWatcher::stop() {
+		if (!worker.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+		//The audio thread is not running any more
+		collect();
+		delete pending.exchange(nullptr);
+	}
+
+	bool TuningWatcher::running() const {
+		return worker.joinable();
+	}
+
+	bool TuningWatcher::apply(RETUNE_VOICESEEKERLIGHT_plugin_t* vsl, uint64_t sample_index) {
+		//The previous set was not freed yet, this one waits for the next hop
+		if (nullptr != retired.load(std::memory_order_relaxed))
+			return false;
+		tuning_set* set = pending.exchange(nullptr, std::memory_order_acquire);
+		if (nullptr == set)
+			return false;
+
+		//Every parameter before the next VoiceSeekerLight_Process
+		set->rejected = TuningStore::setParameters(vsl, set->words.data(), set->words.size());
+		set->applied_at = sample_index;
+		applied_sets.fetch_add(1, std::memory_order_relaxed);
+		retired.store(set, std::memory_order_release);
+		return true;
+	}
+
+	uint64_t TuningWatcher::appliedSets() const {
+		return applied_sets.load(std::memory_order_relaxed);
+	}
+
+	//Sleeps ms unless stopped, returns false when stopped
+	bool TuningWatcher::waitInterval(uint32_t ms) {
+		std::unique_lock<std::mutex> guard(lock);
+		return !wake.wait_for(guard, std::chrono::milliseconds(ms), [this] { return stopping; });
+	}
+
+	void TuningWatcher::run() {
+		//A background job, SCHED_OTHER unless configured otherwise
+		AFERt::applyThreadConfig("afe_tuning", AFERt::threadConfigFromConfig("TuningWatcher"));
+
+		while (waitInterval(poll_ms)) {
+			collect();
+			if (changed())
+				load();
+		}
+	}
+
+	//The file was written or replaced since it was last seen. Editors write a new file and rename it.
+	bool TuningWatcher::changed() {
+		struct stat info;
+		if (0 != stat(path.c_str(), &info))
+			return false;
+		if (info.st_mtim.tv_sec == modified_sec && info.st_mtim.tv_nsec == modified_nsec &&
+			info.st_size == modified_size && info.st_ino == modified_inode)
+			return false;
+		modified_sec = info.st_mtim.tv_sec;
+		modified_nsec = info.st_mtim.tv_nsec;
+		modified_size = info.st_size;
+		modified_inode = info.st_ino;
+		return true;
+	}
+
+	void TuningWatcher::load() {
+		tuning_set* set = new tuning_set();
+		set->words.resize(RDSP_SYSDEFS_MAX_WORDS);
+		uint32_t file_checksum = 0;
+		const int32_t count = parse_user_sysdefs_xml(path.c_str(), &file_checksum, set->words.data(), (int32_t)set->words.size());
+		if (count < 0) {
+			printf("Tuning: %s rejected, keeping the parameters applied\n", path.c_str());
+			delete set;
+			return;
+		}
+		if (file_checksum != checksum) {
+			printf("Tuning: %s was made for sysdefs 0x%08X, VoiceSeekerLight has 0x%08X, rejected\n", path.c_str(), file_checksum, checksum);
+			delete set;
+			return;
+		}
+		set->words.resize(count);
+		set->parameters = 0;
+		for (int32_t i = 0; i < count; i += 2 + set->words[i + 1])
+			set->parameters++;
+		set->rejected = 0;
+		set->applied_at = 0;
+
+		printf("Tuning: %s, %u parameters, applied at the next hop\n", path.c_str(), set->parameters);
+		//A set the audio thread did not take yet is replaced
+		delete pending.exchange(set, std::memory_order_acq_rel);
+	}
+
+	//Frees the set applied last and reports it
+	void TuningWatcher::collect() {
+		tuning_set* set = retired.exchange(nullptr, std::memory_order_acquire);
+		if (nullptr == set)
+			return;
+		if (0 != set->rejected)
+			printf("Tuning: %u of %u parameters unknown to VoiceSeekerLight, the others were applied at output sample %llu\n",
+				set->rejected, set->parameters, (unsigned long long)set->applied_at);
+		else
+			printf("Tuning: %u parameters applied at output sample %llu\n", set->parameters, (unsigned long long)set->applied_at);
+		delete set;
+	}
+}
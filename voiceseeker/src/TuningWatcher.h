@@ -0,0 +1,82 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#ifndef __TuningWatcher_h__
+#define __TuningWatcher_h__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <libVoiceSeekerLight.h>
+
+namespace SignalProcessor {
+
+	/*
+	 * Applies a user sysdefs XML file (RdspSysdefsParser.h) to a running
+	 * VoiceSeekerLight, without creating it again: the AEC keeps its state.
+	 *
+	 * The watcher thread checks the file every poll_ms. A changed file is
+	 * parsed and validated there, against the checksum of the library's
+	 * sysdefs and the length of every parameter, and handed to the audio
+	 * thread as one set. The audio thread sets all its parameters between
+	 * two hops with apply(), a file that does not validate is reported and
+	 * never applied. Sets are allocated and freed by the watcher thread only.
+	 */
+	class TuningWatcher {
+
+		typedef struct tuning_set {
+			std::vector<uint32_t> words;		// parse_user_sysdefs_xml records
+			uint32_t parameters;
+			uint32_t rejected;					// Set by apply(), ids the library does not know
+			uint64_t applied_at;				// Set by apply(), output sample index
+		} tuning_set;
+
+		std::string path;
+		uint32_t checksum;
+		uint32_t poll_ms;
+
+		std::atomic<tuning_set*> pending;		// Parsed, waiting for the audio thread
+		std::atomic<tuning_set*> retired;		// Applied, waiting to be freed
+		std::atomic<uint64_t> applied_sets;
+
+		//Last version of the file seen
+		time_t modified_sec;
+		long modified_nsec;
+		off_t modified_size;
+		ino_t modified_inode;
+
+		std::thread worker;
+		std::mutex lock;
+		std::condition_variable wake;
+		bool stopping;							// Guarded by lock
+
+		void run();
+		bool waitInterval(uint32_t ms);
+		bool changed();
+		void load();
+		void collect();
+
+	public:
+		TuningWatcher();
+		~TuningWatcher();
+
+		//Loads the file now (the next apply() sets it) and starts the watcher thread.
+		//checksum: sysdefs_checksum of the VoiceSeekerLight the file must be made for.
+		int32_t start(const std::string& path, uint32_t checksum, uint32_t poll_ms);
+		void stop();
+		bool running() const;
+
+		//Audio thread, at a hop boundary: sets the parameters of a new file, if any. Never blocks nor allocates.
+		//true when a set was applied.
+		bool apply(RETUNE_VOICESEEKERLIGHT_plugin_t* vsl, uint64_t sample_index);
+		uint64_t appliedSets() const;
+	};
+}
+
+#endif
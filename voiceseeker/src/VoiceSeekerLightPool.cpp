@@ -0,0 +1,189 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include "VoiceSeekerLightPool.h"
+
+#include <AFEConfigState.h>
+#include <AFEIpcChannel.h>
+#include <AFERtThread.h>
+
+#include <cstdio>
+#include <unistd.h>
+
+namespace SignalProcessor {
+
+	VoiceSeekerLightPool::VoiceSeekerLightPool() : workerCount{ 0 }, roundIo{ nullptr }, roundStartNs{ 0 }, generation{ 0 },
+		pending{ 0 }, stopping{ false } {
+	}
+
+	VoiceSeekerLightPool::~VoiceSeekerLightPool() {
+		close();
+	}
+
+	int32_t VoiceSeekerLightPool::open(int32_t instances, const std::vector<std::unordered_map<std::string, std::string>>* settings) {
+		close();
+
+		if (instances < 1 || instances > VSL_POOL_MAX_INSTANCES) {
+			printf("VoiceSeekerLight pool: %d instances, 1 to %d are supported\n", instances, VSL_POOL_MAX_INSTANCES);
+			return -1;
+		}
+
+		AFEConfig::AFEConfigState configState;
+		const int32_t wakeWordInstance = configState.isConfigurationEnable("VslPoolWakeWordInstance", 0);
+		const uint32_t metricsIntervalMs = configState.isConfigurationEnable("VslPoolMetricsIntervalMs", 10000);
+		const int32_t cpus = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+		workerCount = configState.isConfigurationEnable("VslPoolWorkers", std::min(instances, std::max(cpus, 1)));
+		workerCount = std::max(1, std::min(std::min(workerCount, instances), (int32_t)VSL_POOL_MAX_WORKERS));
+
+		//The metrics keep a pointer to the name, the slots never move once reserved
+		slots.reserve(instances);
+		for (int32_t i = 0; i < instances; i++) {
+			instance_slot slot;
+			try {
+				slot.processor = new SignalProcessor_VoiceSeekerLight();
+			}
+			catch (int error) {
+				printf("VoiceSeekerLight pool: cannot create instance %d\n", i);
+				close();
+				return -1;
+			}
+			slot.processor->setInstance(i, i == wakeWordInstance);
+			if (0 != slot.processor->openProcessor((nullptr != settings && i < (int32_t)settings->size()) ? &(*settings)[i] : nullptr)) {
+				printf("VoiceSeekerLight pool: cannot open instance %d\n", i);
+				delete slot.processor;
+				close();
+				return -1;
+			}
+			slot.name = "VSL" + std::to_string(i);
+			slot.metrics = nullptr;
+			slot.result = 0;
+			slots.push_back(slot);
+			slots.back().metrics = new AFERt::StageMetrics(slots.back().name.c_str(), metricsIntervalMs);
+		}
+
+		stopping = false;
+		generation = 0;
+		pending = 0;
+		for (int32_t k = 0; k < workerCount; k++)
+			workers.emplace_back(&VoiceSeekerLightPool::run, this, k);
+
+		printf("VoiceSeekerLight pool: %d instances on %d workers, wake word from instance %d\n",
+			instances, workerCount, wakeWordInstance);
+		return 0;
+	}
+
+	void VoiceSeekerLightPool::close() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		start.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+		workers.clear();
+
+		for (instance_slot& slot : slots) {
+			slot.processor->closeProcessor();
+			delete slot.processor;
+			delete slot.metrics;
+		}
+		slots.clear();
+		workerCount = 0;
+	}
+
+	int32_t VoiceSeekerLightPool::getInstancesCount() const {
+		return (int32_t)slots.size();
+	}
+
+	int32_t VoiceSeekerLightPool::getWorkersCount() const {
+		return workerCount;
+	}
+
+	SignalProcessorImplementation* VoiceSeekerLightPool::getInstance(int32_t index) {
+		if (index < 0 || index >= (int32_t)slots.size())
+			return nullptr;
+		return slots[index].processor;
+	}
+
+	int32_t VoiceSeekerLightPool::processSignals(const vsl_pool_io* io, int32_t* results) {
+		if (slots.empty())
+			return -1;
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			roundIo = io;
+			roundStartNs = AFEIpc::monotonicTimeNs();
+			pending = workerCount;
+			generation++;
+		}
+		start.notify_all();
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			done.wait(guard, [this] { return 0 == pending; });
+		}
+
+		int32_t ret = 0;
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (nullptr != results)
+				results[i] = slots[i].result;
+			if (0 == ret && 0 != slots[i].result)
+				ret = slots[i].result;
+		}
+		return ret;
+	}
+
+	void VoiceSeekerLightPool::run(int32_t worker) {
+		const std::string name = "afe_vsl" + std::to_string(worker);
+		const int32_t cpus = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+		AFERt::applyThreadConfig(name.c_str(),
+			AFERt::threadConfigFromConfig("VslWorker" + std::to_string(worker), { (cpus > 0) ? worker % cpus : -1, 0 }));
+
+		uint64_t seen = 0;
+		while (true) {
+			std::unique_lock<std::mutex> guard(lock);
+			start.wait(guard, [this, seen] { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+			const vsl_pool_io* io = roundIo;
+			const uint64_t roundStart = roundStartNs;
+			guard.unlock();
+
+			//The instances of this worker run one after the other, the queue depth is the position in that order
+			for (int32_t i = worker; i < (int32_t)slots.size(); i += workerCount) {
+				instance_slot& slot = slots[i];
+				const vsl_pool_io& buffers = io[i];
+				const uint64_t begin = AFEIpc::monotonicTimeNs();
+				slot.result = slot.processor->processSignal(buffers.nChannelMicBuffer, buffers.micBufferSize,
+					buffers.nChannelRefBuffer, buffers.refBufferSize, buffers.cleanMicBuffer, buffers.cleanMicBufferSize);
+				const uint64_t end = AFEIpc::monotonicTimeNs();
+				slot.metrics->record(i / workerCount, begin - roundStart, end - begin);
+			}
+
+			guard.lock();
+			if (0 == --pending)
+				done.notify_one();
+		}
+	}
+}
+
+/*
+Same as createProcessor/destroyProcessor, for a pool of instances.
+*/
+extern "C"
+{
+	SignalProcessor::VoiceSeekerLightPool* createProcessorPool(int32_t instances) {
+		SignalProcessor::VoiceSeekerLightPool* pool = new SignalProcessor::VoiceSeekerLightPool();
+		if (0 != pool->open(instances)) {
+			delete pool;
+			pool = NULL;
+		}
+		return pool;
+	}
+
+	void destroyProcessorPool(SignalProcessor::VoiceSeekerLightPool* pool) {
+		delete pool;
+	}
+}
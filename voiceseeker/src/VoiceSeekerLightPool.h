@@ -0,0 +1,94 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#ifndef __VoiceSeekerLightPool_h__
+#define __VoiceSeekerLightPool_h__
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <AFEStageMetrics.h>
+#include "SignalProcessor_VoiceSeekerLight.h"
+
+#define VSL_POOL_MAX_INSTANCES 8
+#define VSL_POOL_MAX_WORKERS 8
+
+namespace SignalProcessor {
+
+	//Buffers of one instance for one processSignals call, as for processSignal
+	typedef struct vsl_pool_io {
+		const char* nChannelMicBuffer;
+		size_t micBufferSize;
+		const char* nChannelRefBuffer;
+		size_t refBufferSize;
+		char* cleanMicBuffer;
+		size_t cleanMicBufferSize;
+	} vsl_pool_io;
+
+	/*
+	 * Several VoiceSeekerLight instances (mic arrays or mic groups) in one
+	 * process. Each instance has its own VoiceSeekerLight heap, scratch and
+	 * working buffers. A pool of worker threads processes them: instance i
+	 * runs on worker i % workers, worker k is pinned to CPU k unless
+	 * VslWorker<k>Cpu / VslWorker<k>Priority say otherwise (Config.ini).
+	 *
+	 * processSignals hands one period of every instance to the workers and
+	 * returns when all are processed. Each instance reports the time it waited
+	 * for its worker and its processing time every VslPoolMetricsIntervalMs.
+	 *
+	 * Only instance VslPoolWakeWordInstance (0 by default) feeds the wake
+	 * word engine, voice_ui_app consumes a single stream.
+	 *
+	 * The methods are virtual so a host loading the plugin with dlopen
+	 * (createProcessorPool) can call them.
+	 */
+	class VoiceSeekerLightPool {
+
+		typedef struct instance_slot {
+			SignalProcessor_VoiceSeekerLight* processor;
+			AFERt::StageMetrics* metrics;
+			std::string name;
+			int32_t result;
+		} instance_slot;
+
+		std::vector<instance_slot> slots;
+		std::vector<std::thread> workers;
+		int32_t workerCount;
+
+		//Round handed to the workers, guarded by lock
+		std::mutex lock;
+		std::condition_variable start;
+		std::condition_variable done;
+		const vsl_pool_io* roundIo;
+		uint64_t roundStartNs;
+		uint64_t generation;
+		int32_t pending;
+		bool stopping;
+
+		void run(int32_t worker);
+
+	public:
+		VoiceSeekerLightPool();
+		virtual ~VoiceSeekerLightPool();
+
+		//Creates and opens instances processors, settings (one map per instance) may be nullptr for the defaults
+		virtual int32_t open(int32_t instances, const std::vector<std::unordered_map<std::string, std::string>>* settings = nullptr);
+		virtual void close();
+
+		virtual int32_t getInstancesCount() const;
+		virtual int32_t getWorkersCount() const;
+		//Instance for its settings and counters, nullptr when out of range
+		virtual SignalProcessorImplementation* getInstance(int32_t index);
+
+		//One period of every instance (io[0 .. instances - 1]), returns 0 when all succeeded or the first error.
+		//results (optional) receives the processSignal return value of every instance.
+		virtual int32_t processSignals(const vsl_pool_io* io, int32_t* results = nullptr);
+	};
+}
+
+#endif
@@ -23,25 +23,13 @@ namespace SignalProcessor {
 		enable_highpass_filter{ 1 }, generate_output{ 0 }, model_blob{ nullptr }, model_blob_size{ 0 }, adapt_threshold_mode{ 3 },
 		voicespot_version{ 0 }, voicespot_model_string{ nullptr }, voicespot_class_string{ nullptr }, num_samples_per_frame{ 0 },
 		num_outputs{ 0 }, last_notification{ 0 }, framecount_in{ 0 }, framecount_out{ 0 }, vad_timeout_frames{ 0 },
-		disable_trigger_frame_counter{ 0 },	num_triggers{ 0 }, voiceseeker_mcps_count{ 0 }, voiceseeker_mcps{ 0.0 }{
+		disable_trigger_frame_counter{ 0 },	num_triggers{ 0 }, keyword_stop_offset{ 0 }, voiceseeker_mcps_count{ 0 }, voiceseeker_mcps{ 0.0 }{
 
 		AFEConfig::AFEConfigState configState;
 		std::string voicespot_model = configState.isConfigurationEnable("VoiceSpotModel", "HeyNXP_en-US_1.bin");
 		std::string voicespot_params = configState.isConfigurationEnable("VoiceSpotParams", "HeyNXP_1_params.bin");
 		std::string voicespot_model_path = "/unit_tests/nxp-afe/" + voicespot_model;
 		std::string voicespot_params_path = "/unit_tests/nxp-afe/" + voicespot_params;
-		//initialize the queue attributes
-		attr.mq_flags = 0;
-		attr.mq_maxmsg = 10;
-		attr.mq_msgsize = VSLOUTBUFFERSIZE;
-		attr.mq_curmsgs = 0;
-
-		//create the message queue
-		mq_vslout = mq_open("/voicespot_vslout", O_CREAT | O_RDONLY, 0644, &attr);
-		attr.mq_msgsize = sizeof(int32_t);
-		mq_iter = mq_open("/voiceseeker_iterations", O_CREAT | O_RDONLY, 0644, &attr);
-		mq_trigg = mq_open("/voiceseeker_trigger", O_CREAT | O_RDONLY, 0644, &attr);
-		mq_offset = mq_open("/voicespot_offset", O_CREAT | O_WRONLY, 0644, &attr);
 
 		//Create VoiceSpot control structure
 #if defined (CortexA55)
@@ -125,6 +113,7 @@ namespace SignalProcessor {
 			int32_t stop_sample = trigger_sample - keyword_stop_offset_samples;
 			printf("trigger = %i, trigger_sample = %i, start_sample = %i, stop_sample = %i, score = %i\n", num_triggers, trigger_sample, start_sample, stop_sample, scores[0]);
 			printf("keyword_start_offset_samples = %i\n", keyword_start_offset_samples);
+			keyword_stop_offset = (keyword_stop_offset_samples > 0) ? keyword_stop_offset_samples : 0;
 			printf("ITER = %d\n", iteration);
 
 			//Inform VoiceSeekerLight upon a trigger event
@@ -135,20 +124,4 @@ namespace SignalProcessor {
 		}
 		return  0;
 	}
-
-	mqd_t SignalProcessor_VoiceSpot::get_mqVslout() {
-		return mq_vslout;
-	}
-
-	mqd_t SignalProcessor_VoiceSpot::get_mqIter() {
-		return mq_iter;
-	}
-
-	mqd_t SignalProcessor_VoiceSpot::get_mqTrigg() {
-		return mq_trigg;
-	}
-
-	mqd_t SignalProcessor_VoiceSpot::get_mqOffset() {
-		return mq_offset;
-	}
 }
@@ -16,7 +16,6 @@
 #include <RdspVslAppUtilities.h>
 #include <RdspCycleCounter.h>
 #include <iostream>
-#include <mqueue.h>
 
 #ifndef __SignalProcessor_VoiceSpot_h__
 #define __SignalProcessor_VoiceSpot_h__
@@ -68,25 +67,19 @@ namespace SignalProcessor {
 		int32_t vad_timeout_frames;
 		int32_t disable_trigger_frame_counter;
 		int32_t num_triggers;
+		int32_t keyword_stop_offset;				// Samples between the keyword end and the end of the triggering hop
 		int32_t voiceseeker_mcps_count;
 
 		float voiceseeker_mcps;
 
-		struct mq_attr attr;
-		mqd_t mq_vslout;
-		mqd_t mq_iter;
-		mqd_t mq_trigg;
-		mqd_t mq_offset;
-
 	public:
 		//Constructor
 		SignalProcessor_VoiceSpot();
 
 		int32_t voiceSpot_process(void* vsl_out, bool notify, int32_t iteration, int32_t enable_triggering);
-		mqd_t get_mqVslout();
-		mqd_t get_mqIter();
-		mqd_t get_mqTrigg();
-		mqd_t get_mqOffset();
+
+		//Keyword end of the last trigger, counted back from the end of the hop which triggered
+		int32_t getKeywordStopOffset() const { return keyword_stop_offset; }
 	};
 
 }
@@ -0,0 +1,121 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include "VadGate.h"
+
+#include <cstdio>
+#include <AFEConfigState.h>
+
+namespace SignalProcessor {
+
+	VadGate::VadGate() : enabled{ false }, hangover_hops{ 0 }, pre_roll_hops{ 0 }, hangover_left{ 0 }, open{ true },
+		next_sample_index{ 0 }, ring_next{ 0 }, ring_count{ 0 }, replay_first{ 0 }, replay_count{ 0 }, interval_ns{ 0 },
+		window_start_ns{ 0 }, hops{ 0 }, skipped{ 0 }, replayed{ 0 }, openings{ 0 }, engine_hops{ 0 }, engine_ns{ 0 }, engine_mean_ms{ 0.0 } {
+	}
+
+	void VadGate::init(uint32_t rate, uint32_t report_interval_ms) {
+		AFEConfig::AFEConfigState configState;
+		//Milliseconds to hops, rounded up
+		const uint64_t hop_units = 1000ull * AFE_IPC_HOP_SAMPLES;
+		enabled = (configState.isConfigurationEnable("VadGate", 0) == 1) ? true : false;
+		pre_roll_hops = (uint32_t)(((uint64_t)configState.isConfigurationEnable("VadGatePreRollMs", 300) * rate + hop_units - 1) / hop_units);
+		if (pre_roll_hops > VAD_GATE_MAX_PRE_ROLL_HOPS)
+			pre_roll_hops = VAD_GATE_MAX_PRE_ROLL_HOPS;
+		hangover_hops = (uint32_t)(((uint64_t)configState.isConfigurationEnable("VadGateHangoverMs", 1000) * rate + hop_units - 1) / hop_units);
+
+		ring.resize(pre_roll_hops);
+		ring_next = 0;
+		ring_count = 0;
+		replay_count = 0;
+		hangover_left = 0;
+		open = true;
+		interval_ns = (uint64_t)report_interval_ms * 1000000ull;
+		window_start_ns = AFEIpc::monotonicTimeNs();
+
+		if (enabled)
+			printf("VAD gate: pre-roll %u hops, hangover %u hops\n", pre_roll_hops, hangover_hops);
+	}
+
+	bool VadGate::admit(const AFEIpc::hop_record& hop) {
+		//Every hop comes here, the gated ones included
+		if (0 != interval_ns) {
+			const uint64_t now = AFEIpc::monotonicTimeNs();
+			if (now - window_start_ns >= interval_ns)
+				report(now);
+		}
+
+		replay_count = 0;
+		hops++;
+
+		if (!enabled || 0 == (hop.flags & AFE_IPC_HOP_VAD))
+			return true;
+
+		//Only hops continuing the stream make a pre-roll, a gap in the AFE output starts it over
+		if (hop.sample_index != next_sample_index)
+			ring_count = 0;
+		next_sample_index = hop.sample_index + AFE_IPC_HOP_SAMPLES;
+
+		if (0 != (hop.flags & AFE_IPC_HOP_SPEECH))
+			hangover_left = hangover_hops;
+		else if (hangover_left > 0)
+			hangover_left--;
+		else {
+			open = false;
+			skipped++;
+			if (pre_roll_hops > 0) {
+				ring[ring_next] = hop;
+				ring_next = (ring_next + 1) % pre_roll_hops;
+				if (ring_count < pre_roll_hops)
+					ring_count++;
+			}
+			return false;
+		}
+
+		if (!open) {
+			open = true;
+			openings++;
+			replay_first = (ring_next + pre_roll_hops - ring_count) % (pre_roll_hops > 0 ? pre_roll_hops : 1);
+			replay_count = ring_count;
+			replayed += ring_count;
+			ring_count = 0;
+		}
+		return true;
+	}
+
+	const AFEIpc::hop_record& VadGate::preRoll(uint32_t index) const {
+		return ring[(replay_first + index) % pre_roll_hops];
+	}
+
+	void VadGate::processed(uint64_t engine_time_ns) {
+		engine_hops++;
+		engine_ns += engine_time_ns;
+	}
+
+	void VadGate::flush() {
+		report(AFEIpc::monotonicTimeNs());
+	}
+
+	void VadGate::report(uint64_t now_ns) {
+		if (enabled && 0 != hops) {
+			//The replayed hops were skipped first and processed later, they saved nothing
+			const uint64_t saved_hops = (skipped > replayed) ? skipped - replayed : 0;
+			//A window of silence keeps the engine time of the last one it ran in
+			if (0 != engine_hops)
+				engine_mean_ms = engine_ns / 1e6 / engine_hops;
+			const double window_ms = (now_ns - window_start_ns) / 1e6;
+			printf("[VAD gate] wake word engine on %.1f%% of %llu hops (%llu pre-roll, %llu speech onsets), "
+				"%llu skipped, %.1f ms of CPU saved (%.1f%% of one core, %.3f ms per hop)\n",
+				100.0 * engine_hops / hops, (unsigned long long)hops, (unsigned long long)replayed, (unsigned long long)openings,
+				(unsigned long long)saved_hops, saved_hops * engine_mean_ms, 100.0 * saved_hops * engine_mean_ms / window_ms, engine_mean_ms);
+		}
+
+		window_start_ns = now_ns;
+		hops = 0;
+		skipped = 0;
+		replayed = 0;
+		openings = 0;
+		engine_hops = 0;
+		engine_ns = 0;
+	}
+}
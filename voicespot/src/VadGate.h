@@ -0,0 +1,79 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <vector>
+
+#include <AFEIpcChannel.h>
+
+#ifndef __VadGate_h__
+#define __VadGate_h__
+
+#define VAD_GATE_MAX_PRE_ROLL_HOPS 64		// Longest pre-roll, 800 ms
+
+namespace SignalProcessor {
+
+	/*
+	 * Skips the wake word engine while the AFE's VAD hears no speech.
+	 *
+	 * The AFE flags every hop it ran the VAD on (AFE_IPC_HOP_VAD) and the
+	 * ones with speech (AFE_IPC_HOP_SPEECH). The gate opens on speech and
+	 * stays open for VadGateHangoverMs after it. While it is closed the hops
+	 * are kept in a ring of VadGatePreRollMs: when it opens they are handed
+	 * out once, oldest first, so the engine hears the keyword onset the VAD
+	 * was late for. Hops without the VAD flag are never gated.
+	 *
+	 * Every report interval the duty cycle of the engine and the CPU time it
+	 * saved (skipped hops times the engine's mean time per hop) are printed.
+	 * Used by one thread.
+	 */
+	class VadGate {
+
+		bool enabled;
+		uint32_t hangover_hops;
+		uint32_t pre_roll_hops;
+		uint32_t hangover_left;
+		bool open;
+		uint64_t next_sample_index;
+
+		std::vector<AFEIpc::hop_record> ring;	// Hops skipped while closed, oldest overwritten first
+		uint32_t ring_next;
+		uint32_t ring_count;
+		uint32_t replay_first;					// Pre-roll handed out by the last admit()
+		uint32_t replay_count;
+
+		//Report window
+		uint64_t interval_ns;
+		uint64_t window_start_ns;
+		uint64_t hops;
+		uint64_t skipped;
+		uint64_t replayed;
+		uint64_t openings;
+		uint64_t engine_hops;
+		uint64_t engine_ns;
+		double engine_mean_ms;
+
+		void report(uint64_t now_ns);
+
+	public:
+		VadGate();
+
+		//Reads VadGate, VadGatePreRollMs and VadGateHangoverMs from Config.ini. report_interval_ms 0 disables the reports.
+		void init(uint32_t rate, uint32_t report_interval_ms);
+		bool isEnabled() const { return enabled; }
+
+		//false: the engine skips this hop, it is kept for the pre-roll.
+		//true: the engine runs on preRoll(0 .. preRollCount() - 1) first, then on this hop.
+		bool admit(const AFEIpc::hop_record& hop);
+		uint32_t preRollCount() const { return replay_count; }
+		const AFEIpc::hop_record& preRoll(uint32_t index) const;
+
+		//Time the engine took for one hop (pre-roll included), for the duty cycle report
+		void processed(uint64_t engine_time_ns);
+		//Prints the report of the current window now (end of a replay)
+		void flush();
+	};
+}
+
+#endif
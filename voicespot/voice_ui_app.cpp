@@ -4,12 +4,25 @@
 ----------------------------------------------------------------------------*/
 
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 #include <AudioStream.h>
 
 #include "RdspAppUtilities.h"
+#include "RdspPcmConvert.h"
 #include "SignalProcessor_VoiceSpot.h"
 #include "SignalProcessor_VIT.h"
 #include "RdspBuffer.h"
+#include "AFEIpcChannel.h"
+#include "AFEPayload.h"
+#include "AFEConfigState.h"
+#include "VadGate.h"
+#include "AFESpscRing.h"
+#include "AFERtThread.h"
+#include "AFEStageMetrics.h"
+#include "AFEStreamAligner.h"
 
 std::string commandUsageStr =
     "Invalid input arguments!\n" \
@@ -25,82 +38,65 @@ static snd_pcm_format_t format = SND_PCM_FORMAT_S32_LE;
 static int period_size = 128;
 static int buffer_size = period_size * 4;
 static int rate = 16000;
-
-//Define structure for circular buffer
-typedef struct {
-	char* samples;
-	int32_t head, tail;
-	size_t size, num_entries;
-} queue;
-
-void initQueue(queue* q, size_t samples_delay, size_t maxSize) {
-	q->size = maxSize;
-	q->samples = (char*)malloc(q->size);
-	q->num_entries = 0;
-	q->head = 0;
-	q->tail = 0;
-
-	//Initialize buffer to zeros
-	memset(q->samples, 0, q->size);
-}
-
-void queueDestroy(queue* q) {
-	free(q->samples);
-}
-
-void enqueue(queue* q, const char* samples_ref, size_t sizeBuff) {
-	int32_t avail_bytes = q->size - q->tail;
-
-	if (avail_bytes >= sizeBuff) {
-		memcpy(q->samples + q->tail, (char*)samples_ref, sizeBuff);
-		q->tail = (q->tail + sizeBuff) % q->size;
-		q->num_entries += sizeBuff;
-	} else {
-		memcpy((q->samples) + q->tail, (char*)samples_ref, avail_bytes);
-		q->tail = 0;
-		int32_t rest_of_samples = sizeBuff - avail_bytes;
-		memcpy((q->samples) + q->tail, (char*)samples_ref + avail_bytes, rest_of_samples);
-		q->tail = (q->tail + rest_of_samples) % q->size;
-		q->num_entries += sizeBuff;
-	}
-}
-
-const char* dequeue(queue* q, size_t sizeBuff) {
-	char* sample_buff = q->samples + q->head;
-	q->head = (q->head + sizeBuff) % q->size;
-
-	q->num_entries -= sizeBuff;
-
-	return sample_buff;
-}
-
-int match(char *src, int src_len, queue* q, int *index) {
-
-	int found = 0;
-	int idx = 0;
-	int i,j,a;
-	int *dst = (int *)q->samples;
-	int *src_tmp = (int *)src;
-	int dst_len = q->num_entries;
-
-	/* Samplesize is 4 bytes */
-	for (i = 0; i < dst_len/4; i++) {
-		for (j = 0; j < src_len/4; j++) {
-			a = (j + idx + q->head/4) % (q->size/4);
-
-			if (dst[a] != src_tmp[j])
-				break;
-		}
-
-		if (j == src_len/4) {
-			found = 1;
-			*index = idx*4;
-			break;
-		}
-		idx++;
-	}
-
-	return found;
+static const int alignMaxDelay = VOICESEEKER_OUT_NHOP * 40; /* Longest delay between the AFE output and its capture */
+static const int vitWindowHops = 3 * 80; /* VIT command window after a wake word, 3 seconds */
+static const int vitPreRollMaxHops = 128; /* Longest pre-roll, must fit in the VIT ring with room to spare */
+
+/* One AFE hop travelling through the pipeline */
+typedef struct hop_item {
+	AFEIpc::hop_record hop;
+	int32_t stream_offset;		/* Correction of keyword offsets for unstamped hops */
+	bool stamped;
+	bool window_start;			/* First hop of a VIT command window */
+	uint16_t skip_samples;		/* Leading samples VIT ignores, the keyword tail in the first pre-roll hop */
+	uint32_t payload_samples;	/* When set, VIT reads this many samples from hop.sample_index on in the AFE payload, not hop.samples */
+	uint64_t enqueue_ns;		/* When the item was put in the ring feeding the stage */
+} hop_item;
+
+/*
+ * ingest (main thread) -> VoiceSpot thread -> VIT thread
+ *
+ * The ingest stage receives the AFE hops (and aligns them when unstamped). It
+ * waits when the VoiceSpot stage falls behind, the AFE then applies its own
+ * overflow policy. The VoiceSpot stage never waits on VIT: hops of the command
+ * window the VIT ring has no room for are dropped and counted.
+ *
+ * The VoiceSpot stage remembers the last hops it processed. On a trigger the
+ * ones after the keyword end are sent to VIT first (pre-roll), VIT works
+ * through them as fast as it can and then continues in real time, so a
+ * command spoken right after the wake word is heard from its start.
+ * While the AFE exports its output (PayloadExport) nothing is remembered:
+ * the pre-roll is one item naming the samples after the keyword end, which
+ * VIT reads from the AFE's shared payload ring (the AFE copies each hop to
+ * it, voice_ui_app copies none).
+ */
+typedef struct pipeline {
+	AFERt::SpscRing<hop_item, 64> toVoiceSpot;
+	AFERt::SpscRing<hop_item, 256> toVit;
+	std::atomic<bool> vitWindowOpen;	/* Set by the VoiceSpot stage, cleared by either stage */
+	AFEIpc::HopConsumer afeChannel;		/* Triggers are sent by the VoiceSpot stage, or by VIT in VIT wake word mode */
+	SignalProcessor_VoiceSpot* voiceSpot;
+	SignalProcessor_VIT* vit;
+	bool vitWakeWord;
+	bool notify;
+	uint32_t metricsIntervalMs;
+	uint32_t preRollHops;				/* Hops kept for the pre-roll, 0 disables it */
+	VadGate vadGate;					/* Used by the VoiceSpot stage */
+	std::atomic<uint64_t> vitHopNs;		/* Last VIT time per hop, for the VAD gate report in VIT wake word mode */
+} pipeline;
+
+/* Only detections are reported, the AFE polls for them and never waits on this process */
+static void sendKeywordTrigger(pipeline& p, const hop_item& item, int32_t keyword_start_offset_samples) {
+	AFEIpc::trigger_record trigger;
+	trigger.sample_index = item.hop.sample_index + AFE_IPC_HOP_SAMPLES;
+	/* A stamped hop is the AFE output itself, the offset needs no correction */
+	trigger.offset = keyword_start_offset_samples + (item.stamped ? 0 : item.stream_offset);
+	trigger.iteration = item.hop.iteration;
+	trigger.detect_time_ns = AFEIpc::monotonicTimeNs();
+	if (item.stamped)
+		printf("Keyword detected %.1f ms after capture\n", (trigger.detect_time_ns - item.hop.capture_time_ns) / 1e6);
+	if (p.afeChannel.sendTrigger(trigger) < 0)
+		printf("AFE is not consuming triggers, trigger dropped\n");
 }
 
 /**
@@ -110,19 +106,21 @@ int match(char *src, int src_len, queue* q, int *index) {
 *
 * @param VIT            SignalProcessor_VIT class
 * @param buffer         buffer from VoiceSpot
+* @param num_samples    samples of buffer
 * @param vit_frame_buf  VIT frame buffer
 * @param vit_frame_siz  VIT frame size
+* @param clipped        incremented by the samples saturated in the conversion to 16 bit
 *
 * @return true if VIT has detection
 */
-static bool VoiceSpotToVITProcess(SignalProcessor_VIT &VIT, void *buffer, rdsp_buffer *vit_frame_buf, int vit_frame_size, int *start_offset, bool notify, int32_t iteration) {
+static bool VoiceSpotToVITProcess(SignalProcessor_VIT &VIT, void *buffer, int num_samples, rdsp_buffer *vit_frame_buf, int vit_frame_size, int *start_offset, bool notify, int32_t iteration, uint32_t *clipped) {
 	/* Since the frame size is different between VoiceSpot and VIT, a frame buffer is needed for VIT input audio */
 	int16_t vit_frame_buffer_lin[VOICESEEKER_OUT_NHOP];
 	float* frame_buffer_float = (float *)buffer;
-	rdsp_float_to_pcm((char *)vit_frame_buffer_lin, &frame_buffer_float, VOICESEEKER_OUT_NHOP, 1, 2);
+	*clipped += rdsp_float_interleave_to_pcm(&frame_buffer_float, (char *)vit_frame_buffer_lin, num_samples, 1, RDSP_PCM_FORMAT_S16_LE);
 
 	/* Write buffered VoiceSpot audio frame to VIT frame buffer */
-	RdspBuffer_WriteInputBlocks(vit_frame_buf, VOICESEEKER_OUT_NHOP, (uint8_t*)vit_frame_buffer_lin);
+	RdspBuffer_WriteInputBlocks(vit_frame_buf, num_samples, (uint8_t*)vit_frame_buffer_lin);
 	bool command_found = false;
 	int16_t cmd_id = 0;
 	while (RdspBuffer_NumBlocksAvailable(vit_frame_buf, 0) >= (int32_t)vit_frame_size) {
@@ -141,16 +139,273 @@ static bool VoiceSpotToVITProcess(SignalProcessor_VIT &VIT, void *buffer, rdsp_b
 	return false;
 }
 
+/*
+ * Runs VIT on the samples of a payload item, read from the AFE's shared
+ * payload ring without a copy, at most one hop at a time. Stops when VIT completes or when the AFE
+ * wrote over what VIT was given (the item came too late), *lost counts the
+ * samples VIT did not get. Returns true if VIT has detection.
+ */
+static bool PayloadToVITProcess(SignalProcessor_VIT &VIT, AFEIpc::PayloadReader& payload, const hop_item& item, rdsp_buffer *vit_frame_buf, int vit_frame_size, int *start_offset, bool notify, uint32_t *clipped, uint32_t *lost) {
+	AFEIpc::payload_span span[2];
+	/* A restarted AFE exports a new object, the mapping of the old one is dropped */
+	if (!payload.spans(item.hop.sample_index, item.payload_samples, span) &&
+		(0 != payload.open() || !payload.spans(item.hop.sample_index, item.payload_samples, span))) {
+		*lost += item.payload_samples;
+		return false;
+	}
+
+	uint32_t done = 0;
+	for (int k = 0; k < 2; k++) {
+		for (uint32_t pos = 0; pos < span[k].count; ) {
+			const uint32_t n = std::min(span[k].count - pos, (uint32_t)VOICESEEKER_OUT_NHOP);
+			bool found = VoiceSpotToVITProcess(VIT, (void*)(span[k].samples + pos), n, vit_frame_buf, vit_frame_size, start_offset, notify, item.hop.iteration, clipped);
+			/* What VIT got was still the AFE output, or it is discarded with the rest */
+			if (!payload.valid(item.hop.sample_index + done)) {
+				*lost += item.payload_samples - done;
+				return false;
+			}
+			if (found)
+				return true;
+			pos += n;
+			done += n;
+		}
+	}
+	return false;
+}
+
+/*
+ * Sends VIT the hops between the keyword end and the triggering hop, oldest
+ * first, and marks the start of the window. Only hops continuing the sample
+ * index of the triggering hop qualify, a gap in the AFE output ends the
+ * pre-roll. Returns the number of hops sent, they count in the VIT window.
+ * With the AFE payload the triggering item becomes the whole pre-roll: the
+ * samples from the keyword end to the end of the triggering hop, read by VIT
+ * from the payload ring.
+ */
+static int32_t sendPreRoll(pipeline& p, AFERt::StageMetrics& metrics, const std::vector<hop_item>& history,
+	uint32_t history_next, uint32_t history_count, bool payload, hop_item& trigger_item) {
+	const int32_t stop_offset = p.voiceSpot->getKeywordStopOffset();
+	uint32_t hops = 0;
+
+	/* Only the sample index the AFE stamped is the one of its payload ring */
+	if (payload && trigger_item.stamped && p.preRollHops > 0 && stop_offset > VOICESEEKER_OUT_NHOP) {
+		const uint32_t span = std::min((uint32_t)stop_offset, (p.preRollHops + 1) * VOICESEEKER_OUT_NHOP);
+		trigger_item.hop.sample_index = trigger_item.hop.sample_index + VOICESEEKER_OUT_NHOP - span;
+		trigger_item.payload_samples = span;
+		trigger_item.window_start = true;
+		trigger_item.skip_samples = 0;
+		hops = (span - 1) / VOICESEEKER_OUT_NHOP;
+		if (hops > 0)
+			printf("VIT pre-roll of %u hops from the AFE payload ring (%d samples after the keyword end)\n", hops, stop_offset);
+		return hops;
+	}
+
+	/* Hops before the triggering one which hold audio after the keyword end */
+	uint32_t wanted = (stop_offset > VOICESEEKER_OUT_NHOP) ? (stop_offset - 1) / VOICESEEKER_OUT_NHOP : 0;
+	if (wanted > history_count)
+		wanted = history_count;
+	uint64_t expected_sample_index = trigger_item.hop.sample_index;
+	while (hops < wanted) {
+		const hop_item& previous = history[(history_next + p.preRollHops - 1 - hops) % p.preRollHops];
+		if (previous.hop.sample_index + AFE_IPC_HOP_SAMPLES != expected_sample_index)
+			break;
+		expected_sample_index = previous.hop.sample_index;
+		hops++;
+	}
+
+	/* The keyword tail in the first hop VIT gets is skipped */
+	const int32_t span = (hops + 1) * VOICESEEKER_OUT_NHOP;
+	const uint16_t skip = (stop_offset > 0 && stop_offset < span) ? span - stop_offset : 0;
+
+	for (uint32_t i = hops; i > 0; i--) {
+		hop_item pre_roll = history[(history_next + p.preRollHops - i) % p.preRollHops];
+		pre_roll.window_start = (i == hops);
+		pre_roll.skip_samples = (i == hops) ? skip : 0;
+		pre_roll.enqueue_ns = AFEIpc::monotonicTimeNs();
+		if (!p.toVit.push(pre_roll))
+			metrics.drop();
+	}
+	trigger_item.window_start = (0 == hops);
+	trigger_item.skip_samples = (0 == hops) ? skip : 0;
+
+	if (hops > 0)
+		printf("VIT pre-roll of %u hops (%d samples after the keyword end)\n", hops, stop_offset);
+	return hops;
+}
+
+static void voiceSpotStage(pipeline* p) {
+	AFERt::applyThreadConfig("vui_voicespot", AFERt::threadConfigFromConfig("VoiceUiVoiceSpot"));
+	AFERt::StageMetrics metrics("VoiceSpot", p->metricsIntervalMs);
+	hop_item item;
+	int32_t window_hops = 0;
+	/* Last hops VoiceSpot processed, oldest overwritten first */
+	std::vector<hop_item> history(p->preRollHops);
+	uint32_t history_next = 0;
+	uint32_t history_count = 0;
+	/* The AFE exports its output, the pre-roll is read from there and the history is not kept */
+	bool payload = false;
+	uint32_t payload_check = 0;
+
+	/* VoiceSpot on one hop, true when it completed the wake word (the VIT window is opened) */
+	auto spot = [&](hop_item& spotted) {
+		const uint64_t spot_ns = AFEIpc::monotonicTimeNs();
+		int32_t keyword_start_offset_samples = p->voiceSpot->voiceSpot_process(spotted.hop.samples, p->notify, spotted.hop.iteration, spotted.hop.enable_triggering);
+		p->vadGate.processed(AFEIpc::monotonicTimeNs() - spot_ns);
+		if (keyword_start_offset_samples > 0) {
+			sendKeywordTrigger(*p, spotted, keyword_start_offset_samples);
+			/* VIT also gets the hop which completed the wake word, and the ones before it back to the keyword end */
+			p->vitWindowOpen.store(true);
+			window_hops = sendPreRoll(*p, metrics, history, history_next, history_count, payload, spotted);
+			return true;
+		}
+		if (p->preRollHops > 0 && !payload) {
+			history[history_next] = spotted;
+			history_next = (history_next + 1) % p->preRollHops;
+			if (history_count < p->preRollHops)
+				history_count++;
+		}
+		return false;
+	};
+
+	/* VIT gets the hop, it counts in the command window */
+	auto forwardToVit = [&](hop_item& forwarded) {
+		if (p->vitWakeWord)
+			p->vadGate.processed(p->vitHopNs.load(std::memory_order_relaxed));
+		else if (++window_hops >= vitWindowHops)
+			p->vitWindowOpen.store(false);
+		forwarded.enqueue_ns = AFEIpc::monotonicTimeNs();
+		if (!p->toVit.push(forwarded))
+			metrics.drop();
+	};
+
+	while (true) {
+		p->toVoiceSpot.popWait(item);
+		const uint32_t depth = p->toVoiceSpot.depth();
+		const uint64_t start_ns = AFEIpc::monotonicTimeNs();
+		const uint64_t wait_ns = start_ns - item.enqueue_ns;
+
+		/* Started, stopped or restarted with another PayloadExport, the AFE is looked for again now and then */
+		if (0 == payload_check++ % AFE_IPC_PEER_CHECK_HOPS) {
+			const bool published = !p->vitWakeWord && AFEIpc::PayloadReader::published();
+			if (published != payload) {
+				printf("AFE payload %s, VIT pre-roll %s\n", published ? "exported" : "not exported", published ? "read from the AFE payload ring" : "copied");
+				payload = published;
+				history_count = 0;
+			}
+		}
+
+		/* VoiceSpot pauses while VIT listens for a command */
+		bool forward = p->vitWakeWord || p->vitWindowOpen.load();
+		item.window_start = false;
+		item.skip_samples = 0;
+		item.payload_samples = 0;
+		if (!forward || p->vitWakeWord) {
+			/* The wake word engine (VoiceSpot, or VIT in VIT wake word mode) skips the hops without speech.
+			   When the VAD hears speech again the last skipped hops go first, the keyword onset is not lost. */
+			const bool admitted = p->vadGate.admit(item.hop);
+			for (uint32_t i = 0; admitted && i < p->vadGate.preRollCount(); i++) {
+				hop_item replay = item;
+				replay.hop = p->vadGate.preRoll(i);
+				if (!forward)
+					forward = spot(replay);
+				if (forward)
+					forwardToVit(replay);
+			}
+			if (!admitted)
+				forward = false;
+			else if (!forward)
+				forward = spot(item);
+		}
+		else {
+			/* Hops VIT gets are never pre-roll of a later window */
+			history_count = 0;
+		}
+
+		if (forward)
+			forwardToVit(item);
+
+		metrics.record(depth, wait_ns, AFEIpc::monotonicTimeNs() - start_ns);
+	}
+}
+
+static void vitStage(pipeline* p) {
+	AFERt::applyThreadConfig("vui_vit", AFERt::threadConfigFromConfig("VoiceUiVit"));
+	AFERt::StageMetrics metrics("VIT", p->metricsIntervalMs);
+	hop_item item;
+	bool listening = false;
+	bool catching_up = false;	/* Working through the pre-roll and the backlog of the window start */
+	uint32_t burst_hops = 0;
+	uint64_t burst_start_ns = 0;
+	/* VIT uses a frame size of 480 samples */
+	int vit_frame_size = VIT_SAMPLES_PER_30MS_FRAME;
+	rdsp_buffer vit_frame_buf;
+	/* Pre-roll read from the AFE payload ring, mapped on the first one */
+	AFEIpc::PayloadReader payload;
+
+	/* vit_frame_buf stores vit input frames */
+	/* The size shoud be larger than input frames size */
+	RdspBuffer_Create(&vit_frame_buf, 1, sizeof(int16_t), 6 * VOICESEEKER_OUT_NHOP);
+	vit_frame_buf.assume_full = 0;
+
+	while (true) {
+		p->toVit.popWait(item);
+		const uint32_t depth = p->toVit.depth();
+		const uint64_t start_ns = AFEIpc::monotonicTimeNs();
+
+		if (item.window_start) {
+			listening = true;
+			catching_up = true;
+			burst_hops = 0;
+			burst_start_ns = start_ns;
+		}
+		/* Hops still queued from a window which already found its command */
+		if (!p->vitWakeWord && !listening)
+			continue;
+
+		int32_t keyword_start_offset_samples = 0;
+		uint32_t clipped = 0;
+		bool found;
+		if (0 != item.payload_samples) {
+			uint32_t lost = 0;
+			found = PayloadToVITProcess(*p->vit, payload, item, &vit_frame_buf, vit_frame_size, &keyword_start_offset_samples, p->notify, &clipped, &lost);
+			if (0 != lost)
+				printf("VIT pre-roll: %u samples no longer in the AFE payload\n", lost);
+		}
+		else
+			found = VoiceSpotToVITProcess(*p->vit, item.hop.samples + item.skip_samples, VOICESEEKER_OUT_NHOP - item.skip_samples, &vit_frame_buf, vit_frame_size, &keyword_start_offset_samples, p->notify, item.hop.iteration, &clipped);
+		metrics.clip(clipped);
+		if (p->vitWakeWord) {
+			if (keyword_start_offset_samples > 0)
+				sendKeywordTrigger(*p, item, keyword_start_offset_samples);
+		}
+		else if (found) {
+			listening = false;
+			p->vitWindowOpen.store(false);
+		}
+
+		if (catching_up) {
+			burst_hops += (0 != item.payload_samples) ? (item.payload_samples + VOICESEEKER_OUT_NHOP - 1) / VOICESEEKER_OUT_NHOP : 1;
+			if (0 == depth || !listening) {
+				printf("VIT caught up: %u hops (%.0f ms of audio) in %.1f ms\n", burst_hops,
+					burst_hops * 1000.0 * VOICESEEKER_OUT_NHOP / rate, (AFEIpc::monotonicTimeNs() - burst_start_ns) / 1e6);
+				catching_up = false;
+			}
+		}
+
+		const uint64_t process_ns = AFEIpc::monotonicTimeNs() - start_ns;
+		p->vitHopNs.store(process_ns, std::memory_order_relaxed);
+		metrics.record(depth, start_ns - item.enqueue_ns, process_ns);
+	}
+
+	RdspBuffer_Destroy(&vit_frame_buf);
+}
+
 //VoiceSpot's main
 int main(int argc, char *argv[]) {
-	ssize_t bytes_read;
-	char buffer[VSLOUTBUFFERSIZE];
-	int32_t iterations;
-	int32_t enable_triggering;
-	int32_t keyword_start_offset_samples;
+	hop_item item;
+	AFEIpc::hop_record& hop = item.hop;
+	uint64_t expected_sample_index = 0;
 	bool wakewordnotify = false;
-	bool micSamplesReady = false;
-	bool voice_ww_detect = false;
 
 	struct streamSettings captureOutputSettings =
 	{
@@ -166,23 +421,17 @@ int main(int argc, char *argv[]) {
 
 	int sampleSize = snd_pcm_format_width(format) / 8;
 	char* captureBuffer = (char *)calloc(period_size * captureOutputChannels, sampleSize);
-	char* tmp_buf = (char*)malloc(VOICESEEKER_OUT_NHOP * sampleSize);
-	float* float_buffer = (float*)malloc(sizeof(float) * period_size * captureOutputChannels);
+	/* One hop of capture, the aligner compares it with the AFE hop */
+	char* tmp_buf = (char*)malloc(VOICESEEKER_OUT_NHOP * captureOutputChannels * sampleSize);
+	float* float_buffer = (float*)malloc(sizeof(float) * VOICESEEKER_OUT_NHOP * captureOutputChannels);
 	int tmp_pos = 0;
 	int capture_pos = period_size;
 	int err;
-	int queue_size = VSLOUTBUFFERSIZE * 40;
-	queue seekeroutput;
-	int index;
-	int framenum = 0;
-	int frameoffset = 0;
-	/* VIT uses a frame size of 480 samples */
-	int vit_frame_size = VIT_SAMPLES_PER_30MS_FRAME;
-	int vit_frame_count = 3 * 80;  /* 3 seconds*/
-	rdsp_buffer vit_frame_buf;
-	VIT_Handle_t VITHandle = PL_NULL;
+	AFERt::StreamAligner aligner;
+	int32_t stream_offset = 0;	/* Samples the capture lags the AFE hops, while the aligner is locked */
+	bool aligned = false;
 
-	initQueue(&seekeroutput, 0, queue_size);
+	CHECK(0 == aligner.init(alignMaxDelay));
 
 	if (argc == 2 && !strcmp(argv[1], "-notify"))
 		wakewordnotify = true;
@@ -191,27 +440,73 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	/* vit_frame_buf stores vit input frames */
-	/* The size shoud be larger than input frames size */
-	RdspBuffer_Create(&vit_frame_buf, 1, sizeof(int16_t), 6 * VOICESEEKER_OUT_NHOP);
-	vit_frame_buf.assume_full = 0;
+	/* Rings and stages live for the whole process */
+	pipeline* p = new pipeline();
+	p->notify = wakewordnotify;
+	AFEConfig::AFEConfigState configState;
+	p->metricsIntervalMs = configState.isConfigurationEnable("VoiceUiMetricsIntervalMs", 10000);
+	p->preRollHops = configState.isConfigurationEnable("VitPreRollMs", 1000) * rate / (1000 * VOICESEEKER_OUT_NHOP);
+	if (p->preRollHops > vitPreRollMaxHops)
+		p->preRollHops = vitPreRollMaxHops;
+	p->vadGate.init(rate, p->metricsIntervalMs);
+	p->vitHopNs.store(0);
+
+	/* voice_ui_app owns the channel, the AFE attaches to it on its first hop */
+	CHECK(0 == p->afeChannel.create(AFEIpc::transportFromConfig()));
 
 	SignalProcessor_VoiceSpot VoiceSpot{};
 	SignalProcessor_VIT VIT{};
-	VITHandle = VIT.VIT_open_model();
+	VIT_Handle_t VITHandle = VIT.VIT_open_model();
 	VIT.VIT_Handle = VITHandle;
+	p->voiceSpot = &VoiceSpot;
+	p->vit = &VIT;
+	p->vitWakeWord = VIT.isVITWakeWordEnable();
+	if (p->vitWakeWord && VIT.isVoiceSpotEnable()) {
+		printf("Disable voicespot if using VIT wakeword detection\n");
+		VIT.VIT_close_model(VITHandle);
+		return 1;
+	}
+
+	std::thread voiceSpotThread(voiceSpotStage, p);
+	std::thread vitThread(vitStage, p);
+	AFERt::applyThreadConfig("vui_ingest", AFERt::threadConfigFromConfig("VoiceUiIngest"));
+	AFERt::StageMetrics metrics("Ingest", p->metricsIntervalMs);
 
+	/* Only needed to align hops which are not stamped by the AFE (legacy message queues) */
 	AudioStream captureOutput;
-	captureOutput.open(captureOutputSettings);
-	captureOutput.start();
+	bool captureOpen = false;
 
 	while (true) {
-		mqd_t mqVslOut = VoiceSpot.get_mqVslout();
-		mqd_t mqIter = VoiceSpot.get_mqIter();
-		mqd_t mqTrigg = VoiceSpot.get_mqTrigg();
-		mqd_t mqOffset = VoiceSpot.get_mqOffset();
+		CHECK(0 == p->afeChannel.receiveHop(hop));
+		const uint64_t start_ns = AFEIpc::monotonicTimeNs();
+		const bool stamped = (0 != (hop.flags & AFE_IPC_HOP_STAMPED));
+		//The AFE drops hops instead of stalling when we fall behind, a gap in the sample index shows it.
+		//The streams are no longer in step then, the alignment starts over.
+		if (hop.sample_index != expected_sample_index) {
+			if (hop.sample_index < expected_sample_index)
+				printf("AFE restarted\n");
+			else if (0 != expected_sample_index)
+				printf("AFE dropped %llu hops\n", (unsigned long long)((hop.sample_index - expected_sample_index) / AFE_IPC_HOP_SAMPLES));
+			aligner.reset();
+		}
+		expected_sample_index = hop.sample_index + AFE_IPC_HOP_SAMPLES;
 
-		while (tmp_pos < VOICESEEKER_OUT_NHOP) {
+		if (!stamped && !captureOpen) {
+			printf("AFE hops are not stamped, aligning them with the %s capture\n", captureOutputName);
+			captureOutput.open(captureOutputSettings);
+			captureOutput.start();
+			captureOpen = true;
+		}
+		else if (stamped && captureOpen) {
+			captureOutput.close();
+			captureOpen = false;
+			capture_pos = period_size;
+			tmp_pos = 0;
+			stream_offset = 0;
+			aligned = false;
+		}
+
+		while (!stamped && tmp_pos < VOICESEEKER_OUT_NHOP) {
 			if (capture_pos == period_size) {
 				err = captureOutput.readFrames(captureBuffer, period_size * captureOutputChannels * sampleSize);
 				if (err < 0)
@@ -239,66 +534,46 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
-		rdsp_pcm_to_float(tmp_buf, &float_buffer, VOICESEEKER_OUT_NHOP, 1, sampleSize);
-		tmp_pos = 0;
-
-		bytes_read = mq_receive(mqVslOut, (char*)buffer, VSLOUTBUFFERSIZE, NULL);
-		bytes_read = mq_receive(mqIter, (char*)&iterations, sizeof(int32_t), NULL);
-		bytes_read = mq_receive(mqTrigg, (char*)&enable_triggering, sizeof(int32_t), NULL);
-		framenum++;
-
-		if (seekeroutput.num_entries >= (queue_size - VSLOUTBUFFERSIZE))
-			dequeue(&seekeroutput, VSLOUTBUFFERSIZE);
-
-		enqueue(&seekeroutput, buffer, VSLOUTBUFFERSIZE);
-
-		/* 200 * 100 / 16000 = 1.25s, check the offset between voiceseeker and voicespot */
-		if (framenum > 100) {
-			if (seekeroutput.num_entries >= 2*VSLOUTBUFFERSIZE) {
-				int found = 0;
-				found = match(tmp_buf, VSLOUTBUFFERSIZE, &seekeroutput, &index);
-				if (found) {
-					dequeue(&seekeroutput, index + VSLOUTBUFFERSIZE);
-					frameoffset = seekeroutput.num_entries;
-					framenum = 0;
+		/* Track the offset between the AFE hops and their capture, keep the last good one while unsure */
+		if (!stamped) {
+			rdsp_pcm_to_float(tmp_buf, &float_buffer, VOICESEEKER_OUT_NHOP, 1, sampleSize);
+			tmp_pos = 0;
+
+			if (aligner.process(hop.samples, float_buffer, VOICESEEKER_OUT_NHOP)) {
+				const AFERt::alignment_estimate& estimate = aligner.estimate();
+				if (aligner.locked() && estimate.delay != stream_offset) {
+					stream_offset = estimate.delay;
+					printf("Stream offset %d samples (confidence %.2f, stable for %d updates)\n",
+						stream_offset, estimate.confidence, estimate.stable_updates);
 				}
+				else if (aligned && !aligner.locked()) {
+					printf("Stream offset unstable (estimate %d samples, confidence %.2f), keeping %d samples\n",
+						estimate.delay, estimate.confidence, stream_offset);
+				}
+				aligned = aligner.locked();
 			}
 		}
 
-		keyword_start_offset_samples = 0;
-		if (VIT.isVITWakeWordEnable()) {
-			if (VIT.isVoiceSpotEnable()) {
-				printf("Disable voicespot if using VIT wakeword detection\n");
-				break;
-			}
-			bool VIT_Result = VoiceSpotToVITProcess(VIT, buffer, &vit_frame_buf, vit_frame_size, &keyword_start_offset_samples, wakewordnotify, iterations);
-		}
-		else if (!voice_ww_detect) {
-			keyword_start_offset_samples = VoiceSpot.voiceSpot_process(buffer, wakewordnotify, iterations, enable_triggering);
-			if (keyword_start_offset_samples){
-				voice_ww_detect = true;
-				vit_frame_count = 3* 80;
-			}
-		}
-
-		keyword_start_offset_samples += frameoffset / sampleSize;
-		CHECK(0 <= mq_send(mqOffset, (char*)&keyword_start_offset_samples, sizeof(int32_t), 0));
-
-		if (voice_ww_detect) {
-			voice_ww_detect = !VoiceSpotToVITProcess(VIT, buffer, &vit_frame_buf, vit_frame_size, &keyword_start_offset_samples, wakewordnotify, iterations);
-			vit_frame_count--;
-			if (!vit_frame_count)
-				voice_ww_detect = false;
-		}
+		/* AFE to ingest delivery is the wait of this stage */
+		item.stamped = stamped;
+		item.stream_offset = stream_offset;
+		item.enqueue_ns = AFEIpc::monotonicTimeNs();
+		const uint32_t depth = p->toVoiceSpot.depth();
+		p->toVoiceSpot.pushWait(item);
+		metrics.record(depth, stamped ? start_ns - hop.capture_time_ns : 0, AFEIpc::monotonicTimeNs() - start_ns);
 	}
 
+	voiceSpotThread.join();
+	vitThread.join();
 	/* Close VIT model */
 	VIT.VIT_close_model(VITHandle);
-	RdspBuffer_Destroy(&vit_frame_buf);
+	aligner.destroy();
+	if (captureOpen)
+		captureOutput.close();
 	free(captureBuffer);
 	free(tmp_buf);
 	free(float_buffer);
+	delete p;
 
 	return 0;
 }
-
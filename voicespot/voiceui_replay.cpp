@@ -0,0 +1,435 @@
+/*----------------------------------------------------------------------------
+	Copyright 2024 NXP
+	SPDX-License-Identifier: BSD-3-Clause
+----------------------------------------------------------------------------*/
+
+/*
+ * Offline replay of the voice UI pipeline: VoiceSeekerLight -> VoiceSpot -> VIT
+ * driven by WAV files instead of ALSA, in one process and as fast as the CPU
+ * allows. The AFE plugin is loaded like the AFE does (createProcessor) and its
+ * hops come through the regular wake word channel, which is drained after each
+ * period, so keyword offsets are fed back to VoiceSeekerLight as on target.
+ *
+ * Prints the real time factor, the time spent per stage and the triggers.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include "SignalProcessorImplementation.h"
+#include "SignalProcessor_VoiceSpot.h"
+#include "SignalProcessor_VIT.h"
+#include "VadGate.h"
+#include "RdspAppUtilities.h"
+#include "RdspBuffer.h"
+#include "RdspWavfile.h"
+#include "AFEIpcChannel.h"
+#include "AFEConfigState.h"
+
+std::string commandUsageStr =
+	"Invalid input arguments!\n" \
+	"Refer to the following command:\n" \
+	"./voiceui_replay <mic.wav> [ref.wav] [-plugin libvoiceseekerlight.so] [-notify] [-hop] [-float]\n" \
+	"  mic.wav  microphones, as many channels as the AFE expects\n" \
+	"  ref.wav  loudspeaker reference, silence when left out\n" \
+	"  -hop     drive the AFE one hop at a time (processHop) instead of per period\n" \
+	"  -float   hand the AFE float samples (processSignalFloat/processHopFloat), no conversion to S32_LE\n";
+
+using namespace SignalProcessor;
+
+static const char* defaultPlugin = "./libvoiceseekerlight.so.2.0";
+static const int vitWindowHops = 3 * 80; /* VIT command window after a wake word, 3 seconds */
+static const int vitPreRollMaxHops = 128;
+static const int pcmSampleSize = 4; /* The replay feeds the plugin S32_LE, it also takes S16_LE, S24_LE, S24_3LE and FLOAT_LE */
+
+typedef SignalProcessorImplementation* (*create_processor_t)();
+typedef void (*destroy_processor_t)(SignalProcessorImplementation*);
+
+enum {
+	STAGE_INPUT,		/* WAV read and conversion to the AFE format (none with -float) */
+	STAGE_AFE,			/* processSignal or processHop, including the hop publish */
+	STAGE_CHANNEL,		/* Hop receive and trigger reply */
+	STAGE_VOICESPOT,
+	STAGE_VIT,
+	STAGE_COUNT
+};
+
+static const char* stageNames[STAGE_COUNT] = { "Input", "AFE", "Channel", "VoiceSpot", "VIT" };
+
+typedef struct stage_time {
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint32_t calls;
+} stage_time;
+
+typedef struct replay_trigger {
+	uint64_t detect_sample;		/* AFE output sample the keyword was detected at */
+	int32_t start_offset;		/* Keyword start, samples before detect_sample */
+	int32_t stop_offset;		/* Keyword end, samples before detect_sample */
+	int32_t command;			/* VIT command id, -1 when none was recognized */
+} replay_trigger;
+
+static void stageAdd(stage_time& stage, uint64_t start_ns) {
+	const uint64_t ns = AFEIpc::monotonicTimeNs() - start_ns;
+	stage.total_ns += ns;
+	if (ns > stage.max_ns)
+		stage.max_ns = ns;
+	stage.calls++;
+}
+
+static bool loadWav(const char* name, rdsp_wav_file_t& wav, uint32_t rate, int32_t channels) {
+	wav = rdsp_wav_read_open(name);
+	if (NULL == wav.fid)
+		return false;
+	if (wav.fmt.pcm.sample_rate != rate || wav.fmt.pcm.num_channels != channels) {
+		printf("%s: %u Hz %u channels, the AFE expects %u Hz %d channels\n", name,
+			wav.fmt.pcm.sample_rate, wav.fmt.pcm.num_channels, rate, channels);
+		rdsp_wav_close(&wav);
+		return false;
+	}
+	return true;
+}
+
+/* Planar float buffers, one pointer per channel */
+static float** allocPlanar(int32_t channels, int32_t samples) {
+	float* buffer = (float*)calloc((size_t)channels * samples, sizeof(float));
+	float** planar = (float**)malloc(sizeof(float*) * channels);
+	for (int32_t ich = 0; ich < channels; ich++)
+		planar[ich] = buffer + ich * samples;
+	return planar;
+}
+
+static void freePlanar(float** planar) {
+	free(planar[0]);
+	free(planar);
+}
+
+/* Same framing as voice_ui_app, VIT consumes 30 ms frames */
+static bool feedVit(SignalProcessor_VIT& VIT, float* samples, int num_samples, rdsp_buffer* vit_frame_buf, int16_t* cmd_id,
+	int* start_offset, bool notify, int32_t iteration) {
+	int16_t vit_frame_buffer_lin[VOICESEEKER_OUT_NHOP];
+	rdsp_float_to_pcm((char*)vit_frame_buffer_lin, &samples, num_samples, 1, 2);
+	RdspBuffer_WriteInputBlocks(vit_frame_buf, num_samples, (uint8_t*)vit_frame_buffer_lin);
+
+	while (RdspBuffer_NumBlocksAvailable(vit_frame_buf, 0) >= VIT_SAMPLES_PER_30MS_FRAME) {
+		RdspBuffer_ReadInputBlocks(vit_frame_buf, 0, VIT_SAMPLES_PER_30MS_FRAME, (uint8_t*)vit_frame_buffer_lin);
+		if (VIT.VIT_Process_Phase(VIT.VIT_Handle, vit_frame_buffer_lin, cmd_id, start_offset, notify, iteration))
+			return true;
+	}
+	return false;
+}
+
+int main(int argc, char* argv[]) {
+	const char* micName = nullptr;
+	const char* refName = nullptr;
+	const char* pluginName = defaultPlugin;
+	bool notify = false;
+	bool perHop = false;
+	bool floatSamples = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-notify"))
+			notify = true;
+		else if (!strcmp(argv[i], "-hop"))
+			perHop = true;
+		else if (!strcmp(argv[i], "-float"))
+			floatSamples = true;
+		else if (!strcmp(argv[i], "-plugin") && i + 1 < argc)
+			pluginName = argv[++i];
+		else if (nullptr == micName && '-' != argv[i][0])
+			micName = argv[i];
+		else if (nullptr == refName && '-' != argv[i][0])
+			refName = argv[i];
+		else {
+			std::cout << commandUsageStr << std::endl;
+			return 1;
+		}
+	}
+	if (nullptr == micName) {
+		std::cout << commandUsageStr << std::endl;
+		return 1;
+	}
+
+	AFEConfig::AFEConfigState configState;
+	if (configState.isConfigurationEnable("WWDectionDisable", 0) == 1) {
+		printf("Wake word detection is disabled in Config.ini (WWDectionDisable), nothing to replay\n");
+		return 1;
+	}
+
+	void* plugin = dlopen(pluginName, RTLD_NOW);
+	if (nullptr == plugin) {
+		printf("Cannot load %s: %s\n", pluginName, dlerror());
+		return 1;
+	}
+	create_processor_t createProcessor = (create_processor_t)dlsym(plugin, "createProcessor");
+	destroy_processor_t destroyProcessor = (destroy_processor_t)dlsym(plugin, "destroyProcessor");
+	CHECK(nullptr != createProcessor && nullptr != destroyProcessor);
+
+	/* A channel of its own, the AFE and voice_ui_app may be running on the device: the objects
+	 * get the pid as suffix unless AFE_IPC_CHANNEL is set (loaded plugin reads the same variable) */
+	setenv(AFE_IPC_CHANNEL_ENV, ("_replay" + std::to_string(getpid())).c_str(), 0);
+
+	/* The channel must exist before the AFE opens, the replay is both of its ends */
+	AFEIpc::HopConsumer channel;
+	CHECK(0 == channel.create(AFEIpc::transportFromConfig()));
+
+	SignalProcessorImplementation* afe = createProcessor();
+	CHECK(nullptr != afe);
+	CHECK(0 == afe->openProcessor());
+	if (strcmp(afe->getSampleFormat(), "S32_LE")) {
+		printf("Unsupported AFE sample format %s\n", afe->getSampleFormat());
+		return 1;
+	}
+	/* The float entry points are negotiated at open, the default configuration gives the rest of the settings */
+	if (floatSamples) {
+		const uint32_t needed = perHop ? SIGNAL_PROCESSOR_CAP_FLOAT_HOP : SIGNAL_PROCESSOR_CAP_FLOAT_PLANAR;
+		if (afe->getInterfaceVersion() < 2 || needed != (afe->getCapabilities() & needed)) {
+			printf("The AFE plugin does not support %s\n", perHop ? "processHopFloat" : "processSignalFloat");
+			return 1;
+		}
+		const std::unordered_map<std::string, std::string> settings = {
+			{ "sample_format", afe->getSampleFormat() },
+			{ "sample_rate", std::to_string(afe->getSampleRate()) },
+			{ "period_size", std::to_string(afe->getPeriodSize()) },
+			{ "input_channels", std::to_string(afe->getInputChannelsCount()) },
+			{ "channel2output", "0" },
+			{ "interface_version", "2" }
+		};
+		CHECK(0 == afe->closeProcessor());
+		CHECK(0 == afe->openProcessor(&settings));
+	}
+
+	const uint32_t rate = afe->getSampleRate();
+	/* A period is one hop when the AFE is driven per hop */
+	const int32_t period = perHop ? afe->getHopSize() : afe->getPeriodSize();
+	if (period <= 0) {
+		printf("The AFE plugin does not support processHop\n");
+		return 1;
+	}
+	const int32_t micChannels = afe->getInputChannelsCount();
+	const int32_t refChannels = afe->getReferenceChannelsCount();
+
+	rdsp_wav_file_t micWav;
+	rdsp_wav_file_t refWav = { 0 };
+	if (!loadWav(micName, micWav, rate, micChannels))
+		return 1;
+	if (nullptr != refName && !loadWav(refName, refWav, rate, refChannels))
+		return 1;
+
+	float** mic = allocPlanar(micChannels, period);
+	float** ref = allocPlanar(refChannels, period);
+	std::vector<char> micPcm((size_t)period * micChannels * pcmSampleSize);
+	std::vector<char> refPcm((size_t)period * refChannels * pcmSampleSize);
+	std::vector<char> cleanPcm((size_t)period * pcmSampleSize);
+	float** clean = allocPlanar(1, period);
+	const const_float_span micSpan = { mic, (size_t)micChannels, (size_t)period };
+	const const_float_span refSpan = { ref, (size_t)refChannels, (size_t)period };
+	const float_span cleanSpan = { clean, 1, (size_t)period };
+
+	SignalProcessor_VoiceSpot VoiceSpot{};
+	SignalProcessor_VIT VIT{};
+	VIT.VIT_Handle = VIT.VIT_open_model();
+	const bool vitWakeWord = VIT.isVITWakeWordEnable();
+	rdsp_buffer vit_frame_buf;
+	RdspBuffer_Create(&vit_frame_buf, 1, sizeof(int16_t), 6 * VOICESEEKER_OUT_NHOP);
+	vit_frame_buf.assume_full = 0;
+
+	/* Pre-roll as in voice_ui_app, VIT starts at the keyword end */
+	uint32_t preRollHops = configState.isConfigurationEnable("VitPreRollMs", 1000) * rate / (1000 * VOICESEEKER_OUT_NHOP);
+	if (preRollHops > vitPreRollMaxHops)
+		preRollHops = vitPreRollMaxHops;
+	std::vector<AFEIpc::hop_record> history(preRollHops);
+	uint32_t history_next = 0;
+	uint32_t history_count = 0;
+	/* Wake word engine gated by the AFE's VAD (VadGate), reported once at the end */
+	VadGate vadGate;
+	vadGate.init(rate, 0);
+
+	stage_time stages[STAGE_COUNT] = {};
+	std::vector<replay_trigger> triggers;
+	AFEIpc::hop_record received;
+	AFEIpc::hop_record hop;
+	uint64_t periods = 0;
+	uint64_t hops = 0;
+	uint64_t lostHops = 0;
+	uint64_t expected_sample_index = 0;
+	bool vitListening = false;
+	int32_t window_hops = 0;
+
+	const uint64_t replay_start_ns = AFEIpc::monotonicTimeNs();
+	while (true) {
+		uint64_t start_ns = AFEIpc::monotonicTimeNs();
+		if (rdsp_wav_read_float(mic, period, &micWav) != (size_t)period)
+			break;
+		/* A short or missing reference continues as silence */
+		size_t refRead = (nullptr != refWav.fid) ? rdsp_wav_read_float(ref, period, &refWav) : 0;
+		for (int32_t ich = 0; refRead < (size_t)period && ich < refChannels; ich++)
+			memset(ref[ich] + refRead, 0, (period - refRead) * sizeof(float));
+		if (!floatSamples) {
+			rdsp_float_to_pcm(micPcm.data(), mic, period, micChannels, pcmSampleSize);
+			rdsp_float_to_pcm(refPcm.data(), ref, period, refChannels, pcmSampleSize);
+		}
+		stageAdd(stages[STAGE_INPUT], start_ns);
+
+		start_ns = AFEIpc::monotonicTimeNs();
+		int ret;
+		if (floatSamples)
+			ret = perHop ? afe->processHopFloat(micSpan, refSpan, cleanSpan) : afe->processSignalFloat(micSpan, refSpan, cleanSpan);
+		else
+			ret = perHop ?
+				afe->processHop(micPcm.data(), micPcm.size(), refPcm.data(), refPcm.size(), cleanPcm.data(), cleanPcm.size()) :
+				afe->processSignal(micPcm.data(), micPcm.size(), refPcm.data(), refPcm.size(), cleanPcm.data(), cleanPcm.size());
+		if (ret < 0) {
+			printf("%s%s failed at period %llu\n", perHop ? "processHop" : "processSignal", floatSamples ? "Float" : "",
+				(unsigned long long)periods);
+			break;
+		}
+		stageAdd(stages[STAGE_AFE], start_ns);
+		periods++;
+
+		while (true) {
+			start_ns = AFEIpc::monotonicTimeNs();
+			if (!channel.pollHop(received))
+				break;
+			stageAdd(stages[STAGE_CHANNEL], start_ns);
+			if (received.sample_index != expected_sample_index)
+				lostHops += (received.sample_index - expected_sample_index) / AFE_IPC_HOP_SAMPLES;
+			expected_sample_index = received.sample_index + AFE_IPC_HOP_SAMPLES;
+			hops++;
+
+			/* As in voice_ui_app: the wake word engine skips the hops without speech, the last ones go first when speech starts */
+			const bool gated = vitWakeWord || !vitListening;
+			if (gated && !vadGate.admit(received))
+				continue;
+			const uint32_t replayHops = gated ? vadGate.preRollCount() : 0;
+
+			for (uint32_t replay = 0; replay <= replayHops; replay++) {
+				hop = (replay < replayHops) ? vadGate.preRoll(replay) : received;
+
+				int16_t cmd_id = 0;
+				if (!vitWakeWord && !vitListening) {
+					start_ns = AFEIpc::monotonicTimeNs();
+					int32_t keyword_start_offset_samples = VoiceSpot.voiceSpot_process(hop.samples, notify, hop.iteration, hop.enable_triggering);
+					stageAdd(stages[STAGE_VOICESPOT], start_ns);
+					vadGate.processed(AFEIpc::monotonicTimeNs() - start_ns);
+
+					if (keyword_start_offset_samples <= 0) {
+						if (preRollHops > 0) {
+							history[history_next] = hop;
+							history_next = (history_next + 1) % preRollHops;
+							if (history_count < preRollHops)
+								history_count++;
+						}
+						continue;
+					}
+
+					const int32_t stop_offset = VoiceSpot.getKeywordStopOffset();
+					triggers.push_back({ hop.sample_index + AFE_IPC_HOP_SAMPLES, keyword_start_offset_samples, stop_offset, -1 });
+
+					/* VoiceSeekerLight applies it with its next period, as on target */
+					AFEIpc::trigger_record trigger = { hop.sample_index + AFE_IPC_HOP_SAMPLES, keyword_start_offset_samples,
+						hop.iteration, AFEIpc::monotonicTimeNs() };
+					start_ns = AFEIpc::monotonicTimeNs();
+					channel.sendTrigger(trigger);
+					stageAdd(stages[STAGE_CHANNEL], start_ns);
+
+					/* Hops after the keyword end VoiceSpot already went through */
+					uint32_t pre = (stop_offset > VOICESEEKER_OUT_NHOP) ? (stop_offset - 1) / VOICESEEKER_OUT_NHOP : 0;
+					if (pre > history_count)
+						pre = history_count;
+					const int32_t span = (pre + 1) * VOICESEEKER_OUT_NHOP;
+					int32_t skip = (stop_offset > 0 && stop_offset < span) ? span - stop_offset : 0;
+
+					start_ns = AFEIpc::monotonicTimeNs();
+					int vit_start_offset = 0;
+					bool found = false;
+					for (uint32_t i = pre; i > 0 && !found; i--, skip = 0) {
+						AFEIpc::hop_record& previous = history[(history_next + preRollHops - i) % preRollHops];
+						found = feedVit(VIT, previous.samples + skip, VOICESEEKER_OUT_NHOP - skip, &vit_frame_buf, &cmd_id,
+							&vit_start_offset, notify, previous.iteration);
+					}
+					/* Then the trigger hop itself, minus the keyword tail when nothing came before it */
+					if (!found)
+						found = feedVit(VIT, hop.samples + skip, VOICESEEKER_OUT_NHOP - skip, &vit_frame_buf, &cmd_id,
+							&vit_start_offset, notify, hop.iteration);
+					stageAdd(stages[STAGE_VIT], start_ns);
+					window_hops = pre + 1;
+					history_count = 0;
+					vitListening = !found;
+					if (found)
+						triggers.back().command = cmd_id;
+				}
+				else {
+					start_ns = AFEIpc::monotonicTimeNs();
+					int start_offset = 0;
+					bool found = feedVit(VIT, hop.samples, VOICESEEKER_OUT_NHOP, &vit_frame_buf, &cmd_id, &start_offset, notify, hop.iteration);
+					stageAdd(stages[STAGE_VIT], start_ns);
+					if (vitWakeWord)
+						vadGate.processed(AFEIpc::monotonicTimeNs() - start_ns);
+
+					if (vitWakeWord) {
+						/* VIT spots the wake word itself, a command follows without a window */
+						if (start_offset > 0) {
+							triggers.push_back({ hop.sample_index + AFE_IPC_HOP_SAMPLES, start_offset, 0, -1 });
+							AFEIpc::trigger_record trigger = { hop.sample_index + AFE_IPC_HOP_SAMPLES, start_offset, hop.iteration, AFEIpc::monotonicTimeNs() };
+							channel.sendTrigger(trigger);
+						}
+						else if (found && !triggers.empty())
+							triggers.back().command = cmd_id;
+					}
+					else if (found) {
+						triggers.back().command = cmd_id;
+						vitListening = false;
+					}
+					else if (++window_hops >= vitWindowHops)
+						vitListening = false;
+				}
+			}
+		}
+	}
+	const uint64_t replay_ns = AFEIpc::monotonicTimeNs() - replay_start_ns;
+
+	const double audio_s = (double)periods * period / rate;
+	printf("\nReplayed %.2f s of audio (%llu periods of %d samples, %llu hops, %llu lost) in %.3f s: %.1f x real time\n",
+		audio_s, (unsigned long long)periods, period, (unsigned long long)hops, (unsigned long long)lostHops,
+		replay_ns / 1e9, (replay_ns > 0) ? audio_s * 1e9 / replay_ns : 0.0);
+	printf("Clean mic output latency %d samples\n", afe->getLatency());
+	if (vadGate.isEnabled())
+		vadGate.flush();
+
+	printf("%-10s %10s %7s %8s %12s %10s\n", "stage", "total ms", "share", "calls", "mean us", "max us");
+	for (int i = 0; i < STAGE_COUNT; i++) {
+		const stage_time& stage = stages[i];
+		printf("%-10s %10.1f %6.1f%% %8u %12.1f %10.1f\n", stageNames[i], stage.total_ns / 1e6,
+			(replay_ns > 0) ? 100.0 * stage.total_ns / replay_ns : 0.0, stage.calls,
+			(stage.calls > 0) ? stage.total_ns / 1e3 / stage.calls : 0.0, stage.max_ns / 1e3);
+	}
+
+	/* Times are in the AFE output, which lags the microphones by the VoiceSeekerLight delay */
+	printf("\n%u triggers\n", (uint32_t)triggers.size());
+	for (size_t i = 0; i < triggers.size(); i++) {
+		const replay_trigger& t = triggers[i];
+		printf("%3u  detected %8.3f s  keyword %8.3f - %8.3f s  command %d\n", (uint32_t)i + 1,
+			(double)t.detect_sample / rate, (double)(t.detect_sample - t.start_offset) / rate,
+			(double)(t.detect_sample - t.stop_offset) / rate, t.command);
+	}
+
+	RdspBuffer_Destroy(&vit_frame_buf);
+	VIT.VIT_close_model(VIT.VIT_Handle);
+	afe->closeProcessor();
+	destroyProcessor(afe);
+	channel.destroy();
+	dlclose(plugin);
+	rdsp_wav_close(&micWav);
+	if (nullptr != refWav.fid)
+		rdsp_wav_close(&refWav);
+	freePlanar(mic);
+	freePlanar(ref);
+	freePlanar(clean);
+
+	return 0;
+}